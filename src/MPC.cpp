@@ -1,17 +1,32 @@
+#include <algorithm>
 #include <iomanip>
 #include <cppad/cppad.hpp>
 #include <cppad/ipopt/solve.hpp>
 
 #include "MPC.h"
 #include "problem.h"
+#include "solver_threads.h"
+#include "wrap_angle.h"
 #include "Eigen-3.3/Eigen/Core"
 
-// Maximum steering angle (25 degrees) in radians.
-const double MAX_STEER_RADIANS = 25.0 / 180 * M_PI;
-
 // Wait this long before recording stats, in seconds.
 const double WARMUP = 5;
 
+// When solves are predicted to miss the deadline, still try one in this many
+// updates, to find out whether they have got faster.
+const size_t DEADLINE_PROBE_INTERVAL = 10;
+
+// Number of recent latencies to keep for estimating quantiles.
+const size_t LATENCY_SAMPLES = 50;
+
+// Solves that take longer than this, in seconds, have missed the deadline.
+// This is well under Ipopt's CPU time limit, so that the solve times that the
+// prediction learns from are not cut off at the deadline.
+const double DEFAULT_SOLVE_DEADLINE = 0.2;
+
+// Ipopt's CPU time limit for each solve, in seconds.
+const double DEFAULT_MAX_CPU_TIME = 0.5;
+
 // If car is going slower than this, in miles per hour, assume it has crashed.
 const double MIN_SPEED = 5;
 
@@ -24,15 +39,63 @@ const double MAX_CTE = 4.5;
 MPC::MPC(ReferencePolynomial &reference, Problem &problem) :
   reference(reference),
   problem(problem),
-  vars(N_VARS),
-  vars_lowerbound(N_VARS), vars_upperbound(N_VARS),
-  constraints_lowerbound(N_CONSTRAINTS), constraints_upperbound(N_CONSTRAINTS)
+  tuning(false),
+  adaptive(false),
+  solve_time(0),
+  cost(0),
+  use_fallback(false),
+  solve_deadline(DEFAULT_SOLVE_DEADLINE),
+  max_cpu_time(DEFAULT_MAX_CPU_TIME),
+  clock(&Clock::steady()),
+  vars(problem.n_vars),
+  vars_lowerbound(problem.n_vars), vars_upperbound(problem.n_vars),
+  constraints_lowerbound(problem.n_constraints),
+  constraints_upperbound(problem.n_constraints),
+  latency_samples(LATENCY_SAMPLES),
+  frenet_px(0),
+  frenet_py(0),
+  frenet_psi(0),
+  frenet_s(0)
 {
   Reset();
+  SetBounds();
+}
+
+MPC::~MPC() {}
+
+void MPC::Reset() {
+  // Initial latency estimate, before we start estimating it.
+  const double LATENCY_DEFAULT = 0.15;
+
+  reference.Reset();
+
+  t_init = clock->now();
+  t = t_init;
+  crashed = false;
+  runtime = 0;
+  previous_speed = 0;
+  distance = 0;
+  previous_cte = 0;
+  total_absolute_cte = 0;
+
+  latency = LATENCY_DEFAULT;
+  latest_latency = LATENCY_DEFAULT;
+  latency_sample_index = 0;
+
+  adaptive_horizon.Reset();
 
+  fallback_reason = NO_FALLBACK;
+  deadline_skips = 0;
+  updates = 0;
+  for (size_t i = 0; i < NUM_FALLBACK_REASONS; ++i) {
+    fallback_counts[i] = 0;
+  }
+}
+
+void MPC::SetBounds() {
   // Set all non-actuators upper and lowerlimits
   // to the max negative and positive values.
-  for (int i = 0; i < delta_start; i++) {
+  for (size_t i = 0; i < problem.delta_start; i++) {
     vars_lowerbound[i] = -1.0e19;
     vars_upperbound[i] = 1.0e19;
   }
@@ -40,44 +103,98 @@ MPC::MPC(ReferencePolynomial &reference, Problem &problem) :
   // The upper and lower limits of delta are set to -25 and 25
   // degrees (values in radians).
   // NOTE: Feel free to change this to something else.
-  for (int i = delta_start; i < throttle_start; i++) {
+  for (size_t i = problem.delta_start; i < problem.throttle_start; i++) {
     vars_lowerbound[i] = -MAX_STEER_RADIANS;
     vars_upperbound[i] = MAX_STEER_RADIANS;
   }
 
   // Acceleration/decceleration upper and lower limits.
   // NOTE: Feel free to change this to something else.
-  for (int i = throttle_start; i < N_VARS; i++) {
+  for (size_t i = problem.throttle_start; i < problem.n_vars; i++) {
     vars_lowerbound[i] = -1.0;
     vars_upperbound[i] = 1.0;
   }
 
   // All of these should be 0 except the initial
   // state indices.
-  for (int i = 0; i < N_CONSTRAINTS; i++) {
+  for (size_t i = 0; i < problem.n_constraints; i++) {
     constraints_lowerbound[i] = 0;
     constraints_upperbound[i] = 0;
   }
 }
 
-MPC::~MPC() {}
-
-void MPC::Reset() {
-  // Initial latency estimate, before we start estimating it.
-  const double LATENCY_DEFAULT = 0.15;
+// Linearly interpolate a variable with `old_count` values spaced `old_dt`
+// apart to get `new_count` values spaced `new_dt` apart. Past the end of the
+// old values, hold the last one.
+static void ResampleVariable(
+  const MPC::Dvector &old_vars, size_t old_start, size_t old_count,
+  double old_dt, MPC::Dvector &new_vars, size_t new_start, size_t new_count,
+  double new_dt)
+{
+  for (size_t j = 0; j < new_count; ++j) {
+    double k = j * new_dt / old_dt;
+    size_t i = (size_t)k;
+    if (i + 1 >= old_count) {
+      new_vars[new_start + j] = old_vars[old_start + old_count - 1];
+    } else {
+      double w = k - i;
+      new_vars[new_start + j] = (1 - w) * old_vars[old_start + i] +
+        w * old_vars[old_start + i + 1];
+    }
+  }
+}
 
-  reference.Reset();
+void MPC::CopySettings(const MPC &other) {
+  tuning = other.tuning;
+  adaptive = other.adaptive;
+  adaptive_horizon = other.adaptive_horizon;
+  use_fallback = other.use_fallback;
+  solve_deadline = other.solve_deadline;
+  max_cpu_time = other.max_cpu_time;
+  fallback = other.fallback;
+  if (clock != other.clock) SetClock(other.clock);
+  problem.CopySettings(other.problem);
+  SetHorizon(other.problem.n, other.problem.dt);
+}
 
-  t_init = std::chrono::steady_clock::now();
+void MPC::SetClock(const Clock *clock) {
+  this->clock = clock;
+  t_init = clock->now();
   t = t_init;
-  crashed = false;
-  runtime = 0;
-  previous_speed = 0;
-  distance = 0;
-  previous_cte = 0;
-  total_absolute_cte = 0;
+}
 
-  latency = LATENCY_DEFAULT;
+void MPC::SetHorizon(size_t n, double dt) {
+  if (n == problem.n && dt == problem.dt) return;
+
+  Dvector old_vars(vars);
+  size_t old_n = problem.n;
+  double old_dt = problem.dt;
+  size_t old_starts[] = {
+    problem.x_start, problem.y_start, problem.psi_start, problem.v_start,
+    problem.delta_start, problem.throttle_start
+  };
+
+  problem.SetHorizon(n);
+  problem.dt = dt;
+  size_t new_starts[] = {
+    problem.x_start, problem.y_start, problem.psi_start, problem.v_start,
+    problem.delta_start, problem.throttle_start
+  };
+
+  vars.resize(problem.n_vars);
+  for (size_t k = 0; k < 6; ++k) {
+    // The first four are states; the last two are actuations.
+    size_t old_count = k < 4 ? old_n : old_n - 1;
+    size_t new_count = k < 4 ? n : n - 1;
+    ResampleVariable(old_vars, old_starts[k], old_count, old_dt,
+      vars, new_starts[k], new_count, dt);
+  }
+
+  vars_lowerbound.resize(problem.n_vars);
+  vars_upperbound.resize(problem.n_vars);
+  constraints_lowerbound.resize(problem.n_constraints);
+  constraints_upperbound.resize(problem.n_constraints);
+  SetBounds();
 }
 
 void MPC::Update(
@@ -85,6 +202,81 @@ void MPC::Update(
   const std::vector<double> &ptsy_vector,
   double px, double py, double psi,
   double speed_mph, double delta, double throttle)
+{
+  Observe(ptsx_vector, ptsy_vector, px, py, psi, speed_mph);
+  bool ok = Control(latency, px, py, psi, speed_mph, delta, throttle);
+  if (!tuning) Trace(ok);
+}
+
+bool MPC::Control(double delay, double px, double py, double psi,
+  double speed_mph, double delta, double throttle)
+{
+  double x0, y0, psi0, v0;
+  Project(delay, speed_mph, delta, throttle, x0, y0, psi0, v0);
+
+  if (adaptive) {
+    size_t n;
+    double dt;
+    adaptive_horizon.Choose(v0, n, dt);
+    SetHorizon(n, dt);
+  }
+
+  // Decide on the warmup and deadline fallbacks before solving, so that we
+  // don't pay for a solve that we would not use.
+  fallback_reason = NO_FALLBACK;
+  if (use_fallback) {
+    std::chrono::duration<double> elapsed = t - t_init;
+    if (elapsed.count() < WARMUP) {
+      fallback_reason = FALLBACK_WARMUP;
+    } else if (adaptive_horizon.PredictSolveTime(problem.n) > solve_deadline
+      && deadline_skips + 1 < DEADLINE_PROBE_INTERVAL) {
+      fallback_reason = FALLBACK_DEADLINE;
+      ++deadline_skips;
+    }
+  }
+
+  bool ok = false;
+  if (fallback_reason == NO_FALLBACK) {
+    deadline_skips = 0;
+    if (problem.frenet) {
+      double s0, d0, epsi0, frenet_v0;
+      ProjectFrenet(delay, px, py, psi, speed_mph, delta, throttle,
+        s0, d0, epsi0, frenet_v0);
+      ok = Solve(s0, d0, epsi0, frenet_v0);
+    } else {
+      ok = Solve(x0, y0, psi0, v0);
+    }
+
+    // A solve that runs out of time stops at Ipopt's max_cpu_time, so it
+    // fails, too.
+    if (use_fallback && !ok) fallback_reason = FALLBACK_FAILED;
+  } else {
+    solve_time = 0;
+  }
+
+  if (fallback_reason != NO_FALLBACK) {
+    fallback.Update(reference, x0, y0, psi0, v0,
+      problem.ref_v * MPH_TO_METERS_PER_SECOND);
+    ++fallback_counts[fallback_reason];
+  }
+  return ok;
+}
+
+void MPC::Trace(bool ok) const {
+  std::cout <<
+    "ok=" << ok <<
+    " cost=" << setw(8) << cost <<
+    " latency=" << setw(8) << latency <<
+    " solve=" << setw(8) << solve_time <<
+    " N=" << setw(2) << problem.n <<
+    " dt=" << setw(8) << problem.dt <<
+    " fallback=" << fallback_reason << std::endl;
+}
+
+void MPC::Observe(
+  const std::vector<double> &ptsx_vector,
+  const std::vector<double> &ptsy_vector,
+  double px, double py, double psi, double speed_mph)
 {
   // Smoothing factor for the exponential moving average of the timestep.
   const double LATENCY_SMOOTH = 0.1;
@@ -93,16 +285,22 @@ void MPC::Update(
   // with them.
   double speed = speed_mph * MPH_TO_METERS_PER_SECOND;
 
-  auto new_t = std::chrono::steady_clock::now();
+  auto new_t = clock->now();
   std::chrono::duration<double> dt_duration = new_t - t;
   double new_latency = dt_duration.count();
   latency = new_latency * LATENCY_SMOOTH + latency * (1 - LATENCY_SMOOTH);
+  latest_latency = new_latency;
   t = new_t;
 
+  latency_samples[latency_sample_index % LATENCY_SAMPLES] = new_latency;
+  ++latency_sample_index;
+  ++updates;
+
   reference.Update(ptsx_vector, ptsy_vector, px, py, psi);
 
-  // calculate the cross track error
-  double cte = reference.coeffs[0];
+  // calculate the cross track error from the reference that we are tracking,
+  // which need not be the polynomial
+  double cte = reference.Evaluate(0);
 
   if (tuning) {
     std::chrono::duration<double> runtime_duration = new_t - t_init;
@@ -118,32 +316,112 @@ void MPC::Update(
     total_absolute_cte += fabs((cte + previous_cte) / 2.0) * new_latency;
     previous_cte = cte;
   }
+}
 
+void MPC::Project(double delay, double speed_mph, double delta,
+  double throttle, double &x0, double &y0, double &psi0, double &v0) const
+{
   // Project forward to compensate for latency. These are the same equations
   // used in the optimization problem, but x0, y0 and psi0 are zero here,
   // because we have used them to transform the waypoints.
+  double speed = speed_mph * MPH_TO_METERS_PER_SECOND;
+  double acceleration = throttle_to_acceleration(throttle, speed);
+  x0 = speed * delay;
+  y0 = 0;
+  psi0 = - speed * delta / Lf * delay;
+  v0 = speed + acceleration * delay;
+}
+
+void MPC::ProjectFrenet(double delay, double px, double py, double psi,
+  double speed_mph, double delta, double throttle,
+  double &s0, double &d0, double &epsi0, double &v0)
+{
+  const TrackMap &track = *reference.track;
+
+  // Find the car's Frenet coordinates now. The arc length is relative to the
+  // car, so the plan starts near s = 0.
+  frenet_px = px;
+  frenet_py = py;
+  frenet_psi = psi;
+  frenet_s = track.Project(px, py);
+  double track_x, track_y;
+  track.Position(frenet_s, track_x, track_y);
+  double heading = track.Heading(frenet_s);
+  double curvature = track.Curvature(frenet_s);
+  double d = -(px - track_x) * sin(heading) + (py - track_y) * cos(heading);
+  double epsi = WrapAngle(psi - heading);
+
+  // Project forward with the same equations used in the optimization
+  // problem, remembering the simulator's steering convention.
+  double speed = speed_mph * MPH_TO_METERS_PER_SECOND;
   double acceleration = throttle_to_acceleration(throttle, speed);
-  double x0 = speed * latency;
-  double y0 = 0;
-  double psi0 = - speed * delta / Lf * latency;
-  double v0 = speed + acceleration * latency;
+  double s_dot = speed * cos(epsi) / (1 - d * curvature);
+  s0 = s_dot * delay;
+  d0 = d + speed * sin(epsi) * delay;
+  epsi0 = epsi + (-speed * delta / Lf - curvature * s_dot) * delay;
+  v0 = speed + acceleration * delay;
+
+  LookUpCurvatures(s0, v0);
+}
+
+void MPC::LookUpCurvatures(double s0, double v0) {
+  for (size_t i = 0; i < problem.n; ++i) {
+    problem.curvatures[i] = reference.track->Curvature(
+      frenet_s + s0 + v0 * problem.dt * i);
+  }
+}
+
+void MPC::FrenetToVehicle(size_t i, double &x, double &y, double &psi) const
+{
+  const TrackMap &track = *reference.track;
+  double arc_length = frenet_s + vars[problem.x_start + i];
+  double d = vars[problem.y_start + i];
+  double track_x, track_y;
+  track.Position(arc_length, track_x, track_y);
+  double heading = track.Heading(arc_length);
+
+  double world_x = track_x - d * sin(heading) - frenet_px;
+  double world_y = track_y + d * cos(heading) - frenet_py;
+  x = world_x * cos(frenet_psi) + world_y * sin(frenet_psi);
+  y = -world_x * sin(frenet_psi) + world_y * cos(frenet_psi);
+  psi = WrapAngle(vars[problem.psi_start + i] + heading - frenet_psi);
+}
+
+double MPC::LatencyQuantile(double q) const {
+  size_t count = std::min(latency_sample_index, LATENCY_SAMPLES);
+  if (count == 0) return latency;
 
+  std::vector<double> samples(
+    latency_samples.begin(), latency_samples.begin() + count);
+  size_t k = std::min((size_t)(q * count), count - 1);
+  std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+  return samples[k];
+}
+
+bool MPC::Solve(double x0, double y0, double psi0, double v0) {
   // Set the initial variable values
-  vars[x_start] = x0;
-  vars[y_start] = y0;
-  vars[psi_start] = psi0;
-  vars[v_start] = v0;
+  vars[problem.x_start] = x0;
+  vars[problem.y_start] = y0;
+  vars[problem.psi_start] = psi0;
+  vars[problem.v_start] = v0;
 
   // Lower and upper limits for constraints
-  constraints_lowerbound[x_start] = x0;
-  constraints_lowerbound[y_start] = y0;
-  constraints_lowerbound[psi_start] = psi0;
-  constraints_lowerbound[v_start] = v0;
-
-  constraints_upperbound[x_start] = x0;
-  constraints_upperbound[y_start] = y0;
-  constraints_upperbound[psi_start] = psi0;
-  constraints_upperbound[v_start] = v0;
+  constraints_lowerbound[problem.x_start] = x0;
+  constraints_lowerbound[problem.y_start] = y0;
+  constraints_lowerbound[problem.psi_start] = psi0;
+  constraints_lowerbound[problem.v_start] = v0;
+
+  constraints_upperbound[problem.x_start] = x0;
+  constraints_upperbound[problem.y_start] = y0;
+  constraints_upperbound[problem.psi_start] = psi0;
+  constraints_upperbound[problem.v_start] = v0;
+
+  // Tabulate the reference around where we expect the car to be at each
+  // step.
+  if (reference.tabulated() && !problem.frenet) {
+    reference.Tabulate(x0, v0 * problem.dt, problem.n,
+      problem.reference_table);
+  }
 
   //
   // NOTE: You don't have to worry about these options
@@ -161,60 +439,94 @@ void MPC::Update(
   options += "Sparse  true        reverse\n";
   // NOTE: Currently the solver has a maximum time limit of 0.5 seconds.
   // Change this as you see fit.
-  options += "Numeric max_cpu_time          0.5\n";
+  options += "Numeric max_cpu_time          " +
+    std::to_string(max_cpu_time) + "\n";
+  options += LinearSolverOptions();
 
   // place to return solution
   CppAD::ipopt::solve_result<Dvector> solution;
 
   // solve the problem
-  CppAD::ipopt::solve<Dvector, Problem>(
-      options, vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
-      constraints_upperbound, problem, solution);
-
-  // Print tracing info.
-  bool ok = solution.status == CppAD::ipopt::solve_result<Dvector>::success;
-  if (!tuning) {
-    std::cout <<
-      "ok=" << ok <<
-      " cost=" << setw(8) << solution.obj_value <<
-      " latency=" << setw(8) << latency << std::endl;
+  auto solve_start = std::chrono::steady_clock::now();
+  {
+    auto lock = LockSolver();
+    CppAD::ipopt::solve<Dvector, Problem>(
+        options, vars, vars_lowerbound, vars_upperbound,
+        constraints_lowerbound, constraints_upperbound, problem, solution);
   }
+  std::chrono::duration<double> solve_duration =
+    std::chrono::steady_clock::now() - solve_start;
+  solve_time = solve_duration.count();
+  adaptive_horizon.Observe(problem.n, solve_time);
 
+  cost = solution.obj_value;
   vars = solution.x;
+
+  return solution.status == CppAD::ipopt::solve_result<Dvector>::success;
 }
 
 double MPC::steer() const {
   // Note: the delta in the problem is positive for a left turn and negative
   // for a right turn; the simulator uses the opposite convention.
-  return -vars[delta_start] / MAX_STEER_RADIANS;
+  double delta = vars[problem.delta_start];
+  if (fallback_reason != NO_FALLBACK) {
+    delta = std::min(std::max(fallback.delta, -MAX_STEER_RADIANS),
+      MAX_STEER_RADIANS);
+  }
+  return -delta / MAX_STEER_RADIANS;
 }
 
 double MPC::throttle() const {
-  return vars[throttle_start];
+  if (fallback_reason != NO_FALLBACK) {
+    return fallback.throttle;
+  }
+  return vars[problem.throttle_start];
 }
 
 std::vector<double> MPC::x_values() const {
-  return get_variable(x_start, N);
+  if (!problem.frenet) return get_variable(problem.x_start, problem.n);
+  std::vector<double> xs(problem.n);
+  double y, psi;
+  for (size_t i = 0; i < problem.n; ++i) FrenetToVehicle(i, xs[i], y, psi);
+  return xs;
 }
 
 std::vector<double> MPC::y_values() const {
-  return get_variable(y_start, N);
+  if (!problem.frenet) return get_variable(problem.y_start, problem.n);
+  std::vector<double> ys(problem.n);
+  double x, psi;
+  for (size_t i = 0; i < problem.n; ++i) FrenetToVehicle(i, x, ys[i], psi);
+  return ys;
 }
 
 std::vector<double> MPC::psi_values() const {
-  return get_variable(psi_start, N);
+  if (!problem.frenet) return get_variable(problem.psi_start, problem.n);
+  std::vector<double> psis(problem.n);
+  double x, y;
+  for (size_t i = 0; i < problem.n; ++i) FrenetToVehicle(i, x, y, psis[i]);
+  return psis;
+}
+
+void MPC::PlanPoint(size_t i, double &x, double &y) const {
+  if (!problem.frenet) {
+    x = vars[problem.x_start + i];
+    y = vars[problem.y_start + i];
+    return;
+  }
+  double psi;
+  FrenetToVehicle(i, x, y, psi);
 }
 
 std::vector<double> MPC::v_values() const {
-  return get_variable(v_start, N);
+  return get_variable(problem.v_start, problem.n);
 }
 
 std::vector<double> MPC::delta_values() const {
-  return get_variable(delta_start, N - 1);
+  return get_variable(problem.delta_start, problem.n - 1);
 }
 
 std::vector<double> MPC::throttle_values() const {
-  return get_variable(throttle_start, N - 1);
+  return get_variable(problem.throttle_start, problem.n - 1);
 }
 
 std::vector<double> MPC::get_variable(size_t start, size_t count) const {
@@ -228,6 +540,11 @@ std::vector<double> MPC::get_variable(size_t start, size_t count) const {
 std::ostream &operator<<(std::ostream &os, const MPC &mpc) {
   os << "{\"runtime\":" << mpc.runtime
     << ", \"distance\":" << mpc.distance
-    << ", \"total_absolute_cte\":" << mpc.total_absolute_cte << "}";
+    << ", \"total_absolute_cte\":" << mpc.total_absolute_cte
+    << ", \"updates\":" << mpc.updates
+    << ", \"fallback_warmup\":" << mpc.fallback_counts[MPC::FALLBACK_WARMUP]
+    << ", \"fallback_failed\":" << mpc.fallback_counts[MPC::FALLBACK_FAILED]
+    << ", \"fallback_deadline\":"
+    << mpc.fallback_counts[MPC::FALLBACK_DEADLINE] << "}";
   return os;
 }
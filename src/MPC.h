@@ -5,6 +5,9 @@
 #include <vector>
 #include <cppad/cppad.hpp>
 
+#include "adaptive_horizon.h"
+#include "clock.h"
+#include "fallback_controller.h"
 #include "problem.h"
 #include "reference_polynomial.h"
 
@@ -24,6 +27,48 @@ public:
   // Is the controller being tuned?
   bool tuning;
 
+  // Should we choose the horizon length and timestep on each update?
+  bool adaptive;
+
+  // Chooses the horizon when `adaptive` is set.
+  AdaptiveHorizon adaptive_horizon;
+
+  // Time taken by the latest solve, in seconds.
+  double solve_time;
+
+  // Objective value from the latest solve.
+  double cost;
+
+  // Should we use the fallback controller when we can't trust the MPC?
+  bool use_fallback;
+
+  // Solves that take longer than this, in seconds, have missed the deadline.
+  double solve_deadline;
+
+  // Ipopt's CPU time limit for each solve, in seconds. Keep this above the
+  // deadline, so that slow solves show how slow they are.
+  double max_cpu_time;
+
+  // Computes the actuations when we fall back.
+  FallbackController fallback;
+
+  enum FallbackReason {
+    NO_FALLBACK,
+    FALLBACK_WARMUP,
+    FALLBACK_FAILED,
+    FALLBACK_DEADLINE,
+    NUM_FALLBACK_REASONS
+  };
+
+  // Why the fallback controller was used for the latest update, if it was.
+  FallbackReason fallback_reason;
+
+  // Number of updates since the last Reset.
+  size_t updates;
+
+  // Number of updates since the last Reset on which we fell back, by reason.
+  size_t fallback_counts[NUM_FALLBACK_REASONS];
+
   // When tuning, do we think the car has crashed?
   bool crashed;
 
@@ -42,15 +87,22 @@ public:
   // When tuning, sum of absolute CTE over a whole run, in meters.
   double total_absolute_cte;
 
+  // Where the latency estimate and the tuning stats get the time; the steady
+  // clock by default. The solve time is always measured on the steady clock.
+  const Clock *clock;
+
   // Time of last Reset.
   std::chrono::steady_clock::time_point t_init;
 
   // Time of last solve, if any.
   std::chrono::steady_clock::time_point t;
 
-  // Time from last solve to current solve, in seconds.
+  // Time from last solve to current solve, in seconds (moving average).
   double latency;
 
+  // Time from last solve to current solve, in seconds (latest only).
+  double latest_latency;
+
   // Called upon a new connection.
   void Reset();
 
@@ -61,6 +113,74 @@ public:
     double px, double py, double psi, double speed_mph,
     double delta, double throttle);
 
+  /**
+   * The part of Update that runs before the solve: update the latency
+   * estimate, the reference and the tuning stats.
+   */
+  void Observe(
+    const std::vector<double> &ptsx_vector,
+    const std::vector<double> &ptsy_vector,
+    double px, double py, double psi, double speed_mph);
+
+  /**
+   * The part of Update that runs after Observe: project the state forward by
+   * the given delay, in seconds, choose the horizon, and then either solve
+   * or fall back. Returns true if the solver succeeded.
+   */
+  bool Control(double delay, double px, double py, double psi,
+    double speed_mph, double delta, double throttle);
+
+  /**
+   * Print a line of tracing info about the latest update.
+   */
+  void Trace(bool ok) const;
+
+  /**
+   * Project the state forward by the given delay, in seconds, to get the
+   * initial state for the solve (vehicle coordinates, SI units).
+   */
+  void Project(double delay, double speed_mph, double delta,
+    double throttle, double &x0, double &y0, double &psi0, double &v0) const;
+
+  /**
+   * Project the state forward by the given delay, in seconds, in the Frenet
+   * frame of the reference's track map, to get the initial state for a
+   * Frenet solve. This also looks up the curvature for each time step.
+   */
+  void ProjectFrenet(double delay, double px, double py, double psi,
+    double speed_mph, double delta, double throttle,
+    double &s0, double &d0, double &epsi0, double &v0);
+
+  /**
+   * Estimate the given quantile (in [0, 1]) of recent latencies, in seconds.
+   */
+  double LatencyQuantile(double q) const;
+
+  /**
+   * Solve from the given initial state (vehicle coordinates) using the
+   * current reference, without any latency compensation. Returns true if the
+   * solver succeeded.
+   */
+  bool Solve(double x0, double y0, double psi0, double v0);
+
+  /**
+   * Copy the controller settings, including the problem's settings and the
+   * horizon, from another MPC, e.g. one configured from the command line.
+   */
+  void CopySettings(const MPC &other);
+
+  /**
+   * Take the time from the given clock from now on, restarting the runtime
+   * and the latency measurement.
+   */
+  void SetClock(const Clock *clock);
+
+  /**
+   * Change the number of time steps and the timestep, keeping the previous
+   * solution (resampled to the new timestep) as the initial guess.
+   */
+  void SetHorizon(size_t n, double dt);
+
   Dvector vars;
   Dvector vars_lowerbound;
   Dvector vars_upperbound;
@@ -82,6 +202,10 @@ public:
   // Get the psi values from the latest solve (vehicle coordinates).
   std::vector<double> psi_values() const;
 
+  // Get the position at step i of the latest solve (vehicle coordinates)
+  // without copying the whole plan.
+  void PlanPoint(size_t i, double &x, double &y) const;
+
   // Get the v (speed) values from the latest solve.
   std::vector<double> v_values() const;
 
@@ -92,6 +216,34 @@ public:
   std::vector<double> throttle_values() const;
 
 private:
+  // Updates in a row on which we fell back because solves were predicted to
+  // miss the deadline.
+  size_t deadline_skips;
+
+  // Recent latencies, in seconds, in a ring buffer.
+  std::vector<double> latency_samples;
+  size_t latency_sample_index;
+
+  // Frenet formulation: the car's pose and arc length along the track at the
+  // latest update, for converting the plan back into vehicle coordinates.
+  double frenet_px;
+  double frenet_py;
+  double frenet_psi;
+  double frenet_s;
+
+  /**
+   * Look up the track curvature for each time step, assuming that the car
+   * keeps going along the track at the given speed from arc length s0.
+   */
+  void LookUpCurvatures(double s0, double v0);
+
+  /**
+   * Convert a time step of a Frenet plan into vehicle coordinates.
+   */
+  void FrenetToVehicle(size_t i, double &x, double &y, double &psi) const;
+
+  void SetBounds();
+
   std::vector<double> get_variable(size_t start, size_t count) const;
 };
 
@@ -0,0 +1,39 @@
+#include "actuation_delay.h"
+
+#include <algorithm>
+#include <cmath>
+
+ActuationDelay::ActuationDelay(uv_loop_t *loop, Clock &clock,
+  std::function<void()> callback) :
+  timer(new uv_timer_t), clock(clock), callback(callback)
+{
+  uv_timer_init(loop, timer);
+  timer->data = this;
+}
+
+ActuationDelay::~ActuationDelay() {
+  uv_timer_stop(timer);
+  timer->data = nullptr;
+  uv_close((uv_handle_t *)timer, [](uv_handle_t *handle) {
+    delete (uv_timer_t *)handle;
+  });
+}
+
+void ActuationDelay::Start(double delay) {
+  double wait = clock.Delay(std::max(delay, 0.0));
+  uint64_t timeout = (uint64_t)std::round(wait * 1000);
+  uv_timer_start(timer, OnTimeout, timeout, 0);
+}
+
+void ActuationDelay::Stop() {
+  uv_timer_stop(timer);
+}
+
+bool ActuationDelay::pending() const {
+  return uv_is_active((const uv_handle_t *)timer);
+}
+
+void ActuationDelay::OnTimeout(uv_timer_t *timer) {
+  ActuationDelay *delay = (ActuationDelay *)timer->data;
+  if (delay) delay->callback();
+}
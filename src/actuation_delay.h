@@ -0,0 +1,54 @@
+#ifndef ACTUATION_DELAY_H
+#define ACTUATION_DELAY_H
+
+#include <functional>
+#include <uv.h>
+
+#include "clock.h"
+
+/**
+ * A one-shot timer on a libuv loop for sending the actuations after the
+ * actuation delay. Unlike sleeping in the message handler, this leaves the
+ * loop free to service other sockets and timers in the meantime. The delay
+ * is on the given clock, so on a simulated clock the callback comes on the
+ * next turn of the loop.
+ */
+class ActuationDelay {
+public:
+  /**
+   * @param loop to run the timer on
+   * @param clock to measure the delay on
+   * @param callback to call on the loop's thread when the delay is up
+   */
+  ActuationDelay(uv_loop_t *loop, Clock &clock,
+    std::function<void()> callback);
+
+  virtual ~ActuationDelay();
+
+  /**
+   * Call the callback after the given delay, in seconds (rounded to the
+   * nearest millisecond). This replaces any pending call.
+   */
+  void Start(double delay);
+
+  /**
+   * Cancel the pending call, if any.
+   */
+  void Stop();
+
+  // Is a call pending?
+  bool pending() const;
+
+private:
+  // Heap allocated, because libuv may still use it for a loop iteration
+  // after we close it.
+  uv_timer_t *timer;
+
+  Clock &clock;
+
+  std::function<void()> callback;
+
+  static void OnTimeout(uv_timer_t *timer);
+};
+
+#endif /* ACTUATION_DELAY_H */
@@ -0,0 +1,98 @@
+#include "adaptive_horizon.h"
+
+#include <algorithm>
+#include <cmath>
+
+// The defaults give N = 20 and dt = 0.05 at about 50mph, which is what the
+// controller was tuned with.
+const double DEFAULT_LOOKAHEAD = 22; // m
+const double DEFAULT_STEP_LENGTH = 1.1; // m
+const double DEFAULT_MAX_LOOKAHEAD_TIME = 2; // s
+const double DEFAULT_SOLVE_BUDGET = 0.04; // s
+const size_t DEFAULT_MIN_N = 6;
+const size_t DEFAULT_MAX_N = 40;
+const double DEFAULT_MIN_DT = 0.03; // s
+const double DEFAULT_MAX_DT = 0.2; // s
+
+// Below this speed, in m/s, plan as if we were going this fast.
+const double MIN_PLANNING_SPEED = 1;
+
+// Smoothing factor for the solve time model; larger values forget old solves
+// more quickly.
+const double SOLVE_TIME_SMOOTH = 0.05;
+
+// Relative tolerance for deciding that the solve time model is singular,
+// which happens when all recent solves used the same N.
+const double SINGULAR_TOLERANCE = 1e-6;
+
+AdaptiveHorizon::AdaptiveHorizon() :
+  lookahead(DEFAULT_LOOKAHEAD),
+  step_length(DEFAULT_STEP_LENGTH),
+  max_lookahead_time(DEFAULT_MAX_LOOKAHEAD_TIME),
+  solve_budget(DEFAULT_SOLVE_BUDGET),
+  min_n(DEFAULT_MIN_N),
+  max_n(DEFAULT_MAX_N),
+  min_dt(DEFAULT_MIN_DT),
+  max_dt(DEFAULT_MAX_DT)
+{
+  Reset();
+}
+
+void AdaptiveHorizon::Reset() {
+  sum_w = 0;
+  sum_n = 0;
+  sum_nn = 0;
+  sum_t = 0;
+  sum_nt = 0;
+}
+
+void AdaptiveHorizon::Observe(size_t n, double seconds) {
+  double decay = 1 - SOLVE_TIME_SMOOTH;
+  sum_w = decay * sum_w + 1;
+  sum_n = decay * sum_n + n;
+  sum_nn = decay * sum_nn + n * n;
+  sum_t = decay * sum_t + seconds;
+  sum_nt = decay * sum_nt + n * seconds;
+}
+
+double AdaptiveHorizon::PredictSolveTime(size_t n) const {
+  if (sum_w <= 0) return 0;
+
+  double mean_n = sum_n / sum_w;
+  double mean_t = sum_t / sum_w;
+  double var_n = sum_nn / sum_w - mean_n * mean_n;
+  if (var_n < SINGULAR_TOLERANCE * mean_n * mean_n) {
+    // We can't separate the fixed and per-step costs, so assume that the
+    // solve time is proportional to n.
+    return mean_t / mean_n * n;
+  }
+
+  double cov_nt = sum_nt / sum_w - mean_n * mean_t;
+  double slope = std::max(cov_nt / var_n, 0.0);
+  double intercept = mean_t - slope * mean_n;
+  return intercept + slope * n;
+}
+
+size_t AdaptiveHorizon::MaxAffordableSteps() const {
+  size_t n = max_n;
+  while (n > min_n && PredictSolveTime(n) > solve_budget) --n;
+  return n;
+}
+
+void AdaptiveHorizon::Choose(double speed, size_t &n, double &dt) const {
+  speed = std::max(speed, MIN_PLANNING_SPEED);
+
+  dt = std::min(std::max(step_length / speed, min_dt), max_dt);
+
+  double lookahead_time = std::min(lookahead / speed, max_lookahead_time);
+  n = (size_t)std::ceil(lookahead_time / dt) + 1;
+  n = std::min(std::max(n, min_n), max_n);
+
+  // If we can't afford the steps, look just as far ahead in fewer, longer
+  // steps, as far as the dynamics allow.
+  size_t affordable_n = MaxAffordableSteps();
+  if (n > affordable_n) {
+    n = affordable_n;
+    dt = std::min(std::max(lookahead_time / (n - 1), dt), max_dt);
+  }
+}
@@ -0,0 +1,79 @@
+#ifndef ADAPTIVE_HORIZON_H
+#define ADAPTIVE_HORIZON_H
+
+#include <cstddef>
+
+/**
+ * Choose the number of time steps (N) and the timestep (dt) on each tick, so
+ * that the plan looks roughly a fixed distance ahead without overrunning a
+ * budget for the solve time.
+ *
+ * The timestep grows at low speed, where the dynamics are gentle, so that
+ * each step covers about the same distance; the lookahead time is capped, so
+ * at low speed we also need fewer steps. At high speed, we would need more
+ * steps to keep the same spatial resolution, so we only add them if the
+ * predicted solve time fits in the budget; otherwise we stretch the timestep
+ * instead.
+ *
+ * The solve time is predicted with a linear model, solve time = a + b * N,
+ * that is fitted to recent solves by exponentially weighted least squares.
+ * (CppAD's Ipopt interface does not report the iteration count, so we model
+ * the wall clock time directly, which includes the iterations anyway.)
+ */
+struct AdaptiveHorizon {
+  AdaptiveHorizon();
+
+  // Target lookahead distance, in meters.
+  double lookahead;
+
+  // Target distance covered by each time step, in meters.
+  double step_length;
+
+  // Maximum lookahead time, in seconds.
+  double max_lookahead_time;
+
+  // Budget for a single solve, in seconds.
+  double solve_budget;
+
+  // Bounds on the number of time steps.
+  size_t min_n;
+  size_t max_n;
+
+  // Bounds on the timestep, in seconds.
+  double min_dt;
+  double max_dt;
+
+  /**
+   * Forget the solve time model for a new run.
+   */
+  void Reset();
+
+  /**
+   * Record that a solve with n time steps took the given time, in seconds.
+   */
+  void Observe(size_t n, double seconds);
+
+  /**
+   * Predict the time to solve a problem with n time steps, in seconds.
+   */
+  double PredictSolveTime(size_t n) const;
+
+  /**
+   * Choose the number of time steps and timestep for the given speed, in m/s.
+   */
+  void Choose(double speed, size_t &n, double &dt) const;
+
+private:
+  // Exponentially weighted sums for the least squares fit of the solve time
+  // model: weight, n, n^2, time and n * time.
+  double sum_w;
+  double sum_n;
+  double sum_nn;
+  double sum_t;
+  double sum_nt;
+
+  // The largest n that we predict can be solved within the budget.
+  size_t MaxAffordableSteps() const;
+};
+
+#endif /* ADAPTIVE_HORIZON_H */
@@ -0,0 +1,169 @@
+#include "binary_protocol.h"
+
+#include <algorithm>
+#include <cstring>
+
+// We copy numbers to and from the wire as they are in memory.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The binary protocol assumes a little endian host"
+#endif
+
+// Initial size of the buffer; a steer message with 20 steps in the plan and
+// six waypoints takes under 600 bytes.
+const size_t INITIAL_BUFFER_SIZE = 1024;
+
+// Number of doubles before the waypoints in a telemetry frame.
+const size_t TELEMETRY_FIELDS = 6;
+
+namespace {
+
+// Position in a frame; all reads are bounds checked against `end`.
+struct Reader {
+  const char *p;
+  const char *end;
+
+  bool Read(void *value, size_t length) {
+    if ((size_t)(end - p) < length) return false;
+    memcpy(value, p, length);
+    p += length;
+    return true;
+  }
+
+  bool ReadDouble(double &value) { return Read(&value, sizeof(value)); }
+
+  bool ReadUint32(uint32_t &value) { return Read(&value, sizeof(value)); }
+
+  bool ReadDoubles(uint32_t count, std::vector<double> &values) {
+    if ((size_t)(end - p) / sizeof(double) < count) return false;
+    values.resize(count);
+    return count == 0 || Read(&values[0], count * sizeof(double));
+  }
+};
+
+} // namespace
+
+bool ParseBinaryHeader(const char *data, size_t length, BinaryHeader &header)
+{
+  if (length < BINARY_HEADER_SIZE) return false;
+  memcpy(&header.magic, data, 4);
+  memcpy(&header.version, data + 4, 2);
+  memcpy(&header.type, data + 6, 2);
+  return header.magic == BINARY_PROTOCOL_MAGIC;
+}
+
+TelemetryEvent ParseBinaryTelemetry(const char *data, size_t length,
+  Telemetry &telemetry)
+{
+  BinaryHeader header;
+  if (!ParseBinaryHeader(data, length, header)) return TELEMETRY_NONE;
+  if (header.type == BINARY_MANUAL) return TELEMETRY_MANUAL;
+  if (header.type != BINARY_TELEMETRY) return TELEMETRY_OTHER;
+
+  Reader reader = { data + BINARY_HEADER_SIZE, data + length };
+  uint32_t num_points;
+  if (!reader.ReadDouble(telemetry.x) || !reader.ReadDouble(telemetry.y) ||
+    !reader.ReadDouble(telemetry.psi) ||
+    !reader.ReadDouble(telemetry.speed) ||
+    !reader.ReadDouble(telemetry.steering_angle) ||
+    !reader.ReadDouble(telemetry.throttle) ||
+    !reader.ReadUint32(num_points) ||
+    !reader.ReadDoubles(num_points, telemetry.ptsx) ||
+    !reader.ReadDoubles(num_points, telemetry.ptsy)) {
+    return TELEMETRY_INVALID;
+  }
+
+  // Version 2 adds the simulator's time.
+  telemetry.sim_time = -1;
+  if (header.version >= 2 && !reader.ReadDouble(telemetry.sim_time)) {
+    return TELEMETRY_INVALID;
+  }
+  if (reader.p != reader.end) return TELEMETRY_INVALID;
+  return TELEMETRY_OK;
+}
+
+bool ParseBinarySteer(const char *data, size_t length,
+  double &steering_angle, double &throttle)
+{
+  BinaryHeader header;
+  if (!ParseBinaryHeader(data, length, header) ||
+    header.type != BINARY_STEER) {
+    return false;
+  }
+  Reader reader = { data + BINARY_HEADER_SIZE, data + length };
+  return reader.ReadDouble(steering_angle) && reader.ReadDouble(throttle);
+}
+
+BinaryEncoder::BinaryEncoder() :
+  version(BINARY_PROTOCOL_VERSION),
+  buffer(INITIAL_BUFFER_SIZE),
+  size(0),
+  count_offset(0),
+  count(0)
+{ }
+
+void BinaryEncoder::Hello(uint16_t hello_version) {
+  uint16_t saved = version;
+  version = hello_version;
+  Header(BINARY_HELLO);
+  version = saved;
+}
+
+void BinaryEncoder::Manual() {
+  Header(BINARY_MANUAL);
+}
+
+void BinaryEncoder::EncodeTelemetry(const Telemetry &telemetry) {
+  Header(BINARY_TELEMETRY);
+  AppendDouble(telemetry.x);
+  AppendDouble(telemetry.y);
+  AppendDouble(telemetry.psi);
+  AppendDouble(telemetry.speed);
+  AppendDouble(telemetry.steering_angle);
+  AppendDouble(telemetry.throttle);
+  uint32_t num_points = std::min(telemetry.ptsx.size(), telemetry.ptsy.size());
+  AppendUint32(num_points);
+  if (num_points > 0) {
+    Append(&telemetry.ptsx[0], num_points * sizeof(double));
+    Append(&telemetry.ptsy[0], num_points * sizeof(double));
+  }
+  if (version >= 2) AppendDouble(telemetry.sim_time);
+}
+
+void BinaryEncoder::Begin(double steering_angle, double throttle) {
+  Header(BINARY_STEER);
+  AppendDouble(steering_angle);
+  AppendDouble(throttle);
+}
+
+void BinaryEncoder::BeginArray(const char *) {
+  count_offset = size;
+  count = 0;
+  AppendUint32(0);
+}
+
+void BinaryEncoder::Add(double value) {
+  AppendDouble(value);
+  ++count;
+}
+
+void BinaryEncoder::EndArray() {
+  memcpy(&buffer[count_offset], &count, sizeof(count));
+}
+
+void BinaryEncoder::End() { }
+
+void BinaryEncoder::Header(uint16_t type) {
+  size = 0;
+  uint32_t magic = BINARY_PROTOCOL_MAGIC;
+  Append(&magic, sizeof(magic));
+  Append(&version, sizeof(version));
+  Append(&type, sizeof(type));
+}
+
+void BinaryEncoder::Append(const void *data, size_t length) {
+  if (size + length > buffer.size()) {
+    buffer.resize(std::max(2 * buffer.size(), size + length));
+  }
+  memcpy(&buffer[size], data, length);
+  size += length;
+}
@@ -0,0 +1,123 @@
+#ifndef BINARY_PROTOCOL_H
+#define BINARY_PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "telemetry.h"
+
+/**
+ * A compact binary protocol for our own simulators and tools, sent as binary
+ * WebSocket frames alongside the socket.io text frames that the Unity
+ * simulator uses. See DATA.md for the layouts.
+ *
+ * Every frame starts with a header: a magic word, the protocol version and
+ * the message type. The client opens with a HELLO that has the highest
+ * version it speaks, and we reply with a HELLO that has the version we will
+ * both use, or version 0 if we have none in common. Numbers are little
+ * endian and fields are packed, with no padding.
+ */
+
+// Bump this whenever a layout changes.
+const uint16_t BINARY_PROTOCOL_VERSION = 2;
+
+// Oldest version that we still speak.
+const uint16_t MIN_BINARY_PROTOCOL_VERSION = 1;
+
+// "MPCB", as a little endian word.
+const uint32_t BINARY_PROTOCOL_MAGIC = 0x4243504d;
+
+enum BinaryMessageType {
+  // Both ways: open the binary protocol with the given version.
+  BINARY_HELLO = 1,
+  // Simulator to controller: the telemetry fields.
+  BINARY_TELEMETRY,
+  // Both ways: the simulator is in manual mode.
+  BINARY_MANUAL,
+  // Controller to simulator: the actuations and the plan.
+  BINARY_STEER
+};
+
+struct BinaryHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t type;
+};
+
+// Size of the header on the wire.
+const size_t BINARY_HEADER_SIZE = 8;
+
+/**
+ * Read the header of a binary frame. Returns false if the frame is not in
+ * this protocol.
+ */
+bool ParseBinaryHeader(const char *data, size_t length, BinaryHeader &header);
+
+/**
+ * Parse a binary telemetry frame into the struct. Like ParseTelemetry, this
+ * does not allocate once the waypoint vectors are big enough.
+ */
+TelemetryEvent ParseBinaryTelemetry(const char *data, size_t length,
+  Telemetry &telemetry);
+
+/**
+ * Parse the actuations from a binary steer frame, skipping the plan.
+ */
+bool ParseBinarySteer(const char *data, size_t length,
+  double &steering_angle, double &throttle);
+
+/**
+ * Writes binary frames into a buffer that is reused from frame to frame.
+ *
+ * The steer message has the same interface as SteerEncoder: Begin, then
+ * BeginArray, Add and EndArray for mpc_x, mpc_y, next_x and next_y, in that
+ * order, then End. The array names are not sent.
+ */
+class BinaryEncoder {
+public:
+  BinaryEncoder();
+
+  // Version to put in the headers.
+  uint16_t version;
+
+  void Hello(uint16_t hello_version);
+
+  void Manual();
+
+  void EncodeTelemetry(const Telemetry &telemetry);
+
+  void Begin(double steering_angle, double throttle);
+
+  void BeginArray(const char *name);
+
+  void Add(double value);
+
+  void EndArray();
+
+  void End();
+
+  const char *data() const { return &buffer[0]; }
+
+  size_t length() const { return size; }
+
+private:
+  std::vector<char> buffer;
+
+  // Length of the frame so far.
+  size_t size;
+
+  // Where the current array's count goes, and the count so far.
+  size_t count_offset;
+  uint32_t count;
+
+  void Header(uint16_t type);
+
+  void Append(const void *data, size_t length);
+
+  void AppendDouble(double value) { Append(&value, sizeof(value)); }
+
+  void AppendUint32(uint32_t value) { Append(&value, sizeof(value)); }
+};
+
+#endif /* BINARY_PROTOCOL_H */
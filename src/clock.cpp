@@ -0,0 +1,22 @@
+#include "clock.h"
+
+Clock &Clock::steady() {
+  static SteadyClock clock;
+  return clock;
+}
+
+ManualClock::ManualClock() : nanoseconds(0) { }
+
+Clock::time_point ManualClock::now() const {
+  return time_point(std::chrono::duration_cast<duration>(
+    std::chrono::nanoseconds(nanoseconds.load())));
+}
+
+double ManualClock::Delay(double) {
+  return 0;
+}
+
+void ManualClock::Set(time_point time) {
+  nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    time.time_since_epoch()).count();
+}
@@ -0,0 +1,70 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+/**
+ * Where the controller gets the time, so that it can run against the real
+ * clock or against a clock that a replay or simulation drives.
+ *
+ * The times are steady clock time points either way, so they can be stored
+ * and subtracted as before. Timers ask the clock how long to wait with
+ * Delay, so a simulated clock can skip the wait and run faster than real
+ * time.
+ */
+class Clock {
+public:
+  typedef std::chrono::steady_clock::time_point time_point;
+  typedef std::chrono::steady_clock::duration duration;
+
+  virtual ~Clock() { }
+
+  virtual time_point now() const = 0;
+
+  /**
+   * How long to wait in real time, in seconds, for the given time to pass on
+   * this clock, for a timer.
+   */
+  virtual double Delay(double seconds) = 0;
+
+  /**
+   * The real, steady clock, which is the default everywhere.
+   */
+  static Clock &steady();
+};
+
+/**
+ * The real, steady clock.
+ */
+class SteadyClock : public Clock {
+public:
+  virtual time_point now() const { return std::chrono::steady_clock::now(); }
+
+  virtual double Delay(double seconds) { return seconds; }
+};
+
+/**
+ * A clock that only moves when it is told to: a replay sets it from the
+ * recorded times, and a simulated session from the simulator's own time in
+ * each telemetry message. Timers don't wait on it, and don't move it either;
+ * the simulator's time already covers any delay. It can be read from any
+ * thread while one thread sets it.
+ */
+class ManualClock : public Clock {
+public:
+  ManualClock();
+
+  virtual time_point now() const;
+
+  virtual double Delay(double seconds);
+
+  void Set(time_point time);
+
+private:
+  // Nanoseconds since the steady clock's epoch.
+  std::atomic<int64_t> nanoseconds;
+};
+
+#endif /* CLOCK_H */
@@ -0,0 +1,13 @@
+#ifndef CLOSE_CODES_H
+#define CLOSE_CODES_H
+
+// Close code for a normal end to the run.
+const int NORMAL_CLOSE_CODE = 1000;
+
+// Use this code when closing the socket after we detect that the car has
+// crashed; this lets the server know that it was closed intentionally, rather
+// than due to a network / simulator crashing problem.
+const int CAR_CRASHED_CODE = 2000;
+const int MAX_RUNTIME_CODE = 2001;
+
+#endif /* CLOSE_CODES_H */
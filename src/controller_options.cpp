@@ -0,0 +1,64 @@
+#include "controller_options.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <sysexits.h>
+
+#include "solver_threads.h"
+
+int ConfigureController(std::map<std::string, std::string> &options,
+  TrackMap &track, ReferencePolynomial &reference, Problem &problem,
+  MPC &mpc)
+{
+  if (options.count("adaptive-horizon")) {
+    mpc.adaptive = true;
+  }
+  if (options.count("solve-budget")) {
+    mpc.adaptive_horizon.solve_budget =
+      atof(options["solve-budget"].c_str());
+  }
+  if (options.count("lookahead")) {
+    mpc.adaptive_horizon.lookahead = atof(options["lookahead"].c_str());
+  }
+
+  if (options.count("track")) {
+    if (!track.Load(options["track"])) {
+      std::cerr << "Failed to load track from " << options["track"] <<
+        std::endl;
+      return EX_NOINPUT;
+    }
+    reference.track = &track;
+  }
+
+  if (options.count("spline-reference")) {
+    reference.model = REFERENCE_SPLINE;
+  }
+  if (options.count("piecewise-reference")) {
+    reference.model = REFERENCE_PIECEWISE;
+  }
+
+  if (options.count("fallback")) {
+    mpc.use_fallback = true;
+  }
+  if (options.count("solve-deadline")) {
+    mpc.solve_deadline = atof(options["solve-deadline"].c_str());
+  }
+  if (options.count("max-cpu-time")) {
+    mpc.max_cpu_time = atof(options["max-cpu-time"].c_str());
+  }
+
+  if (options.count("linear-solver")) {
+    SetLinearSolver(options["linear-solver"],
+      options.count("thread-safe-linear-solver") > 0);
+  }
+
+  if (options.count("frenet")) {
+    if (track.empty()) {
+      std::cerr << "--frenet requires --track" << std::endl;
+      return EX_USAGE;
+    }
+    problem.frenet = true;
+  }
+
+  return EX_OK;
+}
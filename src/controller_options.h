@@ -0,0 +1,26 @@
+#ifndef CONTROLLER_OPTIONS_H
+#define CONTROLLER_OPTIONS_H
+
+#include <map>
+#include <string>
+
+#include "MPC.h"
+#include "problem.h"
+#include "reference_polynomial.h"
+#include "track_map.h"
+
+/**
+ * Set up a controller that runs in process, as in the replay and the
+ * simulator, from the options that configure the plain MPC in mpc:
+ * --adaptive-horizon, --solve-budget, --lookahead, --track,
+ * --spline-reference, --piecewise-reference, --fallback, --solve-deadline,
+ * --max-cpu-time, --linear-solver and --frenet. The track, if any, is loaded into `track`,
+ * which must outlive the reference.
+ *
+ * @return EX_OK, or an exit status after printing the problem to stderr
+ */
+int ConfigureController(std::map<std::string, std::string> &options,
+  TrackMap &track, ReferencePolynomial &reference, Problem &problem,
+  MPC &mpc);
+
+#endif /* CONTROLLER_OPTIONS_H */
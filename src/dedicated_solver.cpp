@@ -0,0 +1,122 @@
+#include "dedicated_solver.h"
+
+#include <cstring>
+#include <iostream>
+#include <pthread.h>
+
+#include "solver_threads.h"
+
+DedicatedSolver::DedicatedSolver(uv_loop_t *loop, SolveFunction solve,
+  DoneFunction done) :
+  dropped(0),
+  solve(solve),
+  done(done),
+  async(new uv_async_t),
+  running(false),
+  busy(false),
+  generation(0),
+  result(0),
+  result_generation(0)
+{
+  uv_async_init(loop, async, OnAsync);
+  async->data = this;
+}
+
+DedicatedSolver::~DedicatedSolver() {
+  Stop();
+  async->data = nullptr;
+  uv_close((uv_handle_t *)async, [](uv_handle_t *handle) {
+    delete (uv_async_t *)handle;
+  });
+}
+
+void DedicatedSolver::Start(int cpu) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (running) return;
+  running = true;
+  busy = false;
+  thread = std::thread(&DedicatedSolver::Run, this);
+
+  if (cpu < 0) return;
+#ifdef __linux__
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  int error = pthread_setaffinity_np(thread.native_handle(), sizeof(cpus),
+    &cpus);
+  if (error) {
+    std::cerr << "Failed to pin the solver thread to CPU " << cpu << ": " <<
+      strerror(error) << std::endl;
+  }
+#else
+  std::cerr << "Pinning the solver thread is not supported" << std::endl;
+#endif
+}
+
+void DedicatedSolver::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!running) return;
+    running = false;
+    ++generation;
+  }
+  condition.notify_one();
+  thread.join();
+}
+
+bool DedicatedSolver::Post() {
+  bool stale = mailbox.Publish();
+  if (stale) ++dropped;
+
+  // The mailbox itself doesn't need the lock, but taking it here means that
+  // the solver thread can't miss the notification.
+  { std::lock_guard<std::mutex> lock(mutex); }
+  condition.notify_one();
+  return stale;
+}
+
+void DedicatedSolver::Release() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    busy = false;
+  }
+  condition.notify_one();
+}
+
+void DedicatedSolver::Run() {
+  RegisterSolverThread();
+
+  std::unique_lock<std::mutex> lock(mutex);
+  while (running) {
+    condition.wait(lock, [this] {
+      return !running || (!busy && mailbox.fresh());
+    });
+    if (!running) break;
+
+    busy = true;
+    size_t solving_generation = generation;
+    lock.unlock();
+    mailbox.Take();
+    int code = solve(mailbox.readable());
+    lock.lock();
+
+    result = code;
+    result_generation = solving_generation;
+    uv_async_send(async);
+  }
+
+  UnregisterSolverThread();
+}
+
+void DedicatedSolver::OnAsync(uv_async_t *async) {
+  DedicatedSolver *solver = (DedicatedSolver *)async->data;
+  if (!solver) return;
+
+  int code;
+  {
+    std::lock_guard<std::mutex> lock(solver->mutex);
+    if (solver->result_generation != solver->generation) return;
+    code = solver->result;
+  }
+  solver->done(code);
+}
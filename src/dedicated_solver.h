@@ -0,0 +1,110 @@
+#ifndef DEDICATED_SOLVER_H
+#define DEDICATED_SOLVER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <uv.h>
+
+#include "latest_mailbox.h"
+#include "telemetry.h"
+
+/**
+ * Runs the solves on a dedicated thread, so that a long solve does not hold
+ * up the event loop.
+ *
+ * The loop thread parses each telemetry message straight into a lock-free
+ * mailbox in which the latest message wins. The solver thread takes the
+ * newest telemetry whenever it is free, so stale telemetry is dropped rather
+ * than queued behind a long solve. The result is handed back to the loop
+ * through a uv_async_t, and the solver thread then waits for the loop to
+ * Release it before it solves again, so the loop can read the MPC's plan
+ * (e.g. to send it after the actuation delay) without any locking.
+ *
+ * Each result is tagged with the generation of the solver that produced it,
+ * and Stop starts a new generation, so a result that reaches the loop after
+ * Stop (e.g. because the simulator disconnected mid-solve) is dropped rather
+ * than handed to `done`.
+ *
+ * The solver thread registers itself with RegisterSolverThread, so count it
+ * when calling SetUpSolverThreads.
+ */
+class DedicatedSolver {
+public:
+  // Solve for the given telemetry on the solver thread, and return a code
+  // for the loop.
+  typedef std::function<int(Telemetry &)> SolveFunction;
+
+  // Handle the code from a solve on the loop thread.
+  typedef std::function<void(int)> DoneFunction;
+
+  DedicatedSolver(uv_loop_t *loop, SolveFunction solve, DoneFunction done);
+
+  virtual ~DedicatedSolver();
+
+  /**
+   * Start the solver thread, pinned to the given CPU if it is not negative.
+   */
+  void Start(int cpu);
+
+  /**
+   * Stop the solver thread and wait for it to finish. Any result that has
+   * not reached the loop yet is dropped.
+   */
+  void Stop();
+
+  /**
+   * The telemetry for the loop thread to parse the next message into.
+   */
+  Telemetry &writable() { return mailbox.writable(); }
+
+  /**
+   * Hand the writable telemetry to the solver thread. Call on the loop thread.
+   * Returns true if this dropped the previous telemetry, which the solver
+   * thread had not started on.
+   */
+  bool Post();
+
+  /**
+   * Let the solver thread solve again, once the loop is done with the result
+   * of the previous solve. Call on the loop thread.
+   */
+  void Release();
+
+  // Number of messages dropped because a newer one arrived before the solver
+  // thread was free. Only the loop thread uses this.
+  size_t dropped;
+
+private:
+  LatestMailbox<Telemetry> mailbox;
+
+  SolveFunction solve;
+  DoneFunction done;
+
+  // Heap allocated, because libuv may still use it for a loop iteration
+  // after we close it.
+  uv_async_t *async;
+
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable condition;
+
+  // The following are protected by the mutex.
+  bool running;
+  bool busy;
+
+  // Incremented by each Stop; results from an earlier generation are stale.
+  size_t generation;
+
+  // Code from the latest solve, and the generation that it belongs to.
+  int result;
+  size_t result_generation;
+
+  void Run();
+
+  static void OnAsync(uv_async_t *async);
+};
+
+#endif /* DEDICATED_SOLVER_H */
@@ -0,0 +1,36 @@
+#include "fallback_controller.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "problem.h"
+
+const double DEFAULT_LOOKAHEAD_TIME = 0.6; // s
+const double DEFAULT_MIN_LOOKAHEAD = 5; // m
+const double DEFAULT_SPEED_GAIN = 0.2; // 1 / (m/s)
+
+FallbackController::FallbackController() :
+  lookahead_time(DEFAULT_LOOKAHEAD_TIME),
+  min_lookahead(DEFAULT_MIN_LOOKAHEAD),
+  speed_gain(DEFAULT_SPEED_GAIN),
+  delta(0),
+  throttle(0)
+{ }
+
+void FallbackController::Update(const ReferencePolynomial &reference,
+  double x0, double y0, double psi0, double v0, double ref_v)
+{
+  // Find the goal point on the reference, and put it in the car's frame.
+  double lookahead = std::max(min_lookahead, lookahead_time * v0);
+  double goal_x = x0 + lookahead * cos(psi0);
+  double dx = goal_x - x0;
+  double dy = reference.Evaluate(goal_x) - y0;
+  double local_y = -dx * sin(psi0) + dy * cos(psi0);
+
+  // The arc through the goal point has curvature 2 y / d^2, and in the
+  // kinematic model the curvature is delta / Lf.
+  double curvature = 2 * local_y / (dx * dx + dy * dy);
+  delta = curvature * Lf;
+
+  throttle = std::min(std::max(speed_gain * (ref_v - v0), -1.0), 1.0);
+}
@@ -0,0 +1,41 @@
+#ifndef FALLBACK_CONTROLLER_H
+#define FALLBACK_CONTROLLER_H
+
+#include "reference_polynomial.h"
+
+/**
+ * A pure pursuit controller that steers toward a point on the reference
+ * polynomial a short way ahead, and holds the reference speed with a
+ * proportional controller on the throttle.
+ *
+ * It takes a few microseconds, so we can fall back on it when the MPC solve
+ * fails or takes too long, or while we're still estimating the latency.
+ */
+struct FallbackController {
+  FallbackController();
+
+  // Time to look ahead along the reference, in seconds.
+  double lookahead_time;
+
+  // Minimum lookahead distance, in meters.
+  double min_lookahead;
+
+  // Throttle per m/s of speed error.
+  double speed_gain;
+
+  // Steering angle from the latest update, in radians (positive to the left,
+  // as in the MPC).
+  double delta;
+
+  // Throttle from the latest update, in [-1, 1].
+  double throttle;
+
+  /**
+   * Compute the actuations from the given state, in vehicle coordinates,
+   * with speed v0 in m/s, and the reference speed ref_v in m/s.
+   */
+  void Update(const ReferencePolynomial &reference,
+    double x0, double y0, double psi0, double v0, double ref_v);
+};
+
+#endif /* FALLBACK_CONTROLLER_H */
@@ -0,0 +1,77 @@
+//
+// Print the ticks in flight recorder segments as CSV, one row per tick, with
+// what became of it and the time spent in each phase that it reached. Usage:
+//
+//   ./flight_dump flight/mpc-*.flight > ticks.csv
+//
+// The segments are read in the order given; the file names sort into order
+// for each session.
+//
+#include <iostream>
+#include <sysexits.h>
+
+#include "flight_log.h"
+
+// A phase of a tick, from one steady clock time in nanoseconds to another;
+// either is 0 if the tick never got that far.
+struct Phase {
+  int64_t start_ns;
+  int64_t end_ns;
+};
+
+// Print the phase's length in microseconds, or nothing if it didn't happen.
+static std::ostream &operator<<(std::ostream &os, const Phase &phase) {
+  if (phase.start_ns && phase.end_ns) {
+    os << (phase.end_ns - phase.start_ns) / 1e3;
+  }
+  return os;
+}
+
+static Phase Microseconds(int64_t start_ns, int64_t end_ns) {
+  Phase phase = { start_ns, end_ns };
+  return phase;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " segment..." << std::endl;
+    return EX_USAGE;
+  }
+
+  std::cout << "session,segment,tick,outcome,received_s,parse_us,queue_us,solve_us,"
+    "delay_us,send_us,x,y,psi,speed,steering_angle,throttle,num_points,"
+    "steer,throttle_out,solve_time,cost,latency,fallback_reason,num_plan" <<
+    std::endl;
+  std::cout.precision(17);
+
+  int status = EX_OK;
+  FlightLogReader reader;
+  FlightTick tick;
+  for (int i = 1; i < argc; ++i) {
+    if (!reader.Open(argv[i])) {
+      std::cerr << "Not a flight log: " << argv[i] << std::endl;
+      status = EX_DATAERR;
+      continue;
+    }
+    const FlightSegmentHeader &header = reader.header();
+    while (reader.Next(tick)) {
+      const Telemetry &telemetry = tick.telemetry;
+      std::cout << header.session << "," << header.sequence << "," <<
+        tick.tick << "," << FlightOutcomeName(tick.outcome) << "," <<
+        (tick.received_ns - header.created_steady_ns +
+          header.created_system_ns) / 1e9 << "," <<
+        Microseconds(tick.received_ns, tick.posted_ns) << "," <<
+        Microseconds(tick.posted_ns, tick.solve_start_ns) << "," <<
+        Microseconds(tick.solve_start_ns, tick.solve_end_ns) << "," <<
+        Microseconds(tick.solve_end_ns, tick.send_start_ns) << "," <<
+        Microseconds(tick.send_start_ns, tick.send_end_ns) << "," <<
+        telemetry.x << "," << telemetry.y << "," << telemetry.psi << "," <<
+        telemetry.speed << "," << telemetry.steering_angle << "," <<
+        telemetry.throttle << "," << telemetry.ptsx.size() << "," <<
+        tick.steering_angle << "," << tick.throttle << "," <<
+        tick.solve_time << "," << tick.cost << "," << tick.latency << "," <<
+        tick.fallback_reason << "," << tick.mpc_x.size() << std::endl;
+    }
+  }
+  return status;
+}
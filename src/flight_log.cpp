@@ -0,0 +1,188 @@
+#include "flight_log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+// We copy numbers to and from the log as they are in memory.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The flight log assumes a little endian host"
+#endif
+
+// Size of a tick's payload without its waypoints and plan.
+const size_t TICK_FIXED_SIZE = 160;
+
+namespace {
+
+struct Writer {
+  char *p;
+
+  void Write(const void *value, size_t length) {
+    memcpy(p, value, length);
+    p += length;
+  }
+
+  template <typename T>
+  void Write(T value) { Write(&value, sizeof(value)); }
+
+  void WriteDoubles(const std::vector<double> &values, size_t count) {
+    if (count > 0) Write(&values[0], count * sizeof(double));
+  }
+};
+
+// Position in a segment; all reads are bounds checked against `end`.
+struct Reader {
+  const char *p;
+  const char *end;
+
+  bool Read(void *value, size_t length) {
+    if ((size_t)(end - p) < length) return false;
+    memcpy(value, p, length);
+    p += length;
+    return true;
+  }
+
+  template <typename T>
+  bool Read(T &value) { return Read(&value, sizeof(value)); }
+
+  bool ReadDoubles(uint32_t count, std::vector<double> &values) {
+    if ((size_t)(end - p) / sizeof(double) < count) return false;
+    values.resize(count);
+    return count == 0 || Read(&values[0], count * sizeof(double));
+  }
+};
+
+} // namespace
+
+const char *FlightOutcomeName(uint32_t outcome) {
+  switch (outcome) {
+  case FLIGHT_SENT: return "sent";
+  case FLIGHT_DROPPED: return "dropped";
+  case FLIGHT_MANUAL: return "manual";
+  case FLIGHT_CLOSED: return "closed";
+  case FLIGHT_ABANDONED: return "abandoned";
+  }
+  return "unknown";
+}
+
+FlightTick::FlightTick() :
+  tick(0),
+  outcome(FLIGHT_SENT),
+  received_ns(0), posted_ns(0), solve_start_ns(0), solve_end_ns(0),
+  send_start_ns(0), send_end_ns(0),
+  steering_angle(0), throttle(0),
+  solve_time(0), cost(0), latency(0), fallback_reason(0)
+{ }
+
+size_t FlightTick::size() const {
+  size_t num_points = std::min(telemetry.ptsx.size(), telemetry.ptsy.size());
+  size_t num_plan = std::min(mpc_x.size(), mpc_y.size());
+  return TICK_FIXED_SIZE + 2 * sizeof(double) * (num_points + num_plan);
+}
+
+char *WriteFlightTick(char *out, const FlightTick &tick) {
+  uint32_t num_points =
+    std::min(tick.telemetry.ptsx.size(), tick.telemetry.ptsy.size());
+  uint32_t num_plan = std::min(tick.mpc_x.size(), tick.mpc_y.size());
+
+  Writer writer = { out };
+  writer.Write(tick.tick);
+  writer.Write(tick.outcome);
+  writer.Write(tick.received_ns);
+  writer.Write(tick.posted_ns);
+  writer.Write(tick.solve_start_ns);
+  writer.Write(tick.solve_end_ns);
+  writer.Write(tick.send_start_ns);
+  writer.Write(tick.send_end_ns);
+
+  const Telemetry &telemetry = tick.telemetry;
+  writer.Write(telemetry.x);
+  writer.Write(telemetry.y);
+  writer.Write(telemetry.psi);
+  writer.Write(telemetry.speed);
+  writer.Write(telemetry.steering_angle);
+  writer.Write(telemetry.throttle);
+  writer.Write(num_points);
+  writer.WriteDoubles(telemetry.ptsx, num_points);
+  writer.WriteDoubles(telemetry.ptsy, num_points);
+
+  writer.Write(tick.steering_angle);
+  writer.Write(tick.throttle);
+  writer.Write(tick.solve_time);
+  writer.Write(tick.cost);
+  writer.Write(tick.latency);
+  writer.Write(tick.fallback_reason);
+  writer.Write(num_plan);
+  writer.WriteDoubles(tick.mpc_x, num_plan);
+  writer.WriteDoubles(tick.mpc_y, num_plan);
+  return writer.p;
+}
+
+FlightLogReader::FlightLogReader() : offset(0), segment_header() { }
+
+FlightLogReader::~FlightLogReader() { }
+
+bool FlightLogReader::Open(const std::string &pathname) {
+  data.clear();
+  offset = 0;
+
+  std::ifstream file(pathname.c_str(), std::ios::binary);
+  if (!file) return false;
+  data.assign(std::istreambuf_iterator<char>(file),
+    std::istreambuf_iterator<char>());
+
+  Reader reader = { data.data(), data.data() + data.size() };
+  char magic[sizeof(FLIGHT_LOG_MAGIC)];
+  FlightSegmentHeader &header = segment_header;
+  if (!reader.Read(magic, sizeof(magic)) ||
+    memcmp(magic, FLIGHT_LOG_MAGIC, sizeof(magic)) != 0 ||
+    !reader.Read(header.version) || header.version != FLIGHT_LOG_VERSION ||
+    !reader.Read(header.header_size) ||
+    header.header_size != FLIGHT_HEADER_SIZE ||
+    !reader.Read(header.segment_size) || !reader.Read(header.session) ||
+    !reader.Read(header.sequence) || !reader.Read(header.created_system_ns) ||
+    !reader.Read(header.created_steady_ns) || !reader.Read(header.session_start_ns) ||
+    !reader.Read(header.used) || !reader.Read(header.last_index)) {
+    data.clear();
+    return false;
+  }
+
+  // Ignore anything past what the recorder had finished writing.
+  if (header.used < data.size()) data.resize(header.used);
+  offset = FLIGHT_HEADER_SIZE;
+  return true;
+}
+
+bool FlightLogReader::Next(FlightTick &tick) {
+  while (offset + FLIGHT_RECORD_HEADER_SIZE <= data.size()) {
+    Reader reader = { data.data() + offset, data.data() + data.size() };
+    uint32_t type, length;
+    if (!reader.Read(type) || !reader.Read(length) ||
+      (size_t)(reader.end - reader.p) < length) {
+      return false;
+    }
+    offset += FLIGHT_RECORD_HEADER_SIZE + length;
+    if (type != FLIGHT_TICK) continue;
+
+    reader.end = reader.p + length;
+    Telemetry &telemetry = tick.telemetry;
+    uint32_t num_points, num_plan;
+    return reader.Read(tick.tick) && reader.Read(tick.outcome) &&
+      reader.Read(tick.received_ns) && reader.Read(tick.posted_ns) &&
+      reader.Read(tick.solve_start_ns) &&
+      reader.Read(tick.solve_end_ns) && reader.Read(tick.send_start_ns) &&
+      reader.Read(tick.send_end_ns) &&
+      reader.Read(telemetry.x) && reader.Read(telemetry.y) &&
+      reader.Read(telemetry.psi) && reader.Read(telemetry.speed) &&
+      reader.Read(telemetry.steering_angle) &&
+      reader.Read(telemetry.throttle) && reader.Read(num_points) &&
+      reader.ReadDoubles(num_points, telemetry.ptsx) &&
+      reader.ReadDoubles(num_points, telemetry.ptsy) &&
+      reader.Read(tick.steering_angle) && reader.Read(tick.throttle) &&
+      reader.Read(tick.solve_time) && reader.Read(tick.cost) &&
+      reader.Read(tick.latency) && reader.Read(tick.fallback_reason) &&
+      reader.Read(num_plan) && reader.ReadDoubles(num_plan, tick.mpc_x) &&
+      reader.ReadDoubles(num_plan, tick.mpc_y);
+  }
+  return false;
+}
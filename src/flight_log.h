@@ -0,0 +1,184 @@
+#ifndef FLIGHT_LOG_H
+#define FLIGHT_LOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "telemetry.h"
+
+/**
+ * The format of the flight recorder's logs (see flight_recorder.h).
+ *
+ * A log is a sequence of segment files. Each segment starts with a fixed
+ * header, followed by records, each of which is a type, a payload length and
+ * the payload. Numbers are little endian and fields are packed, with no
+ * padding. Times are nanoseconds on the steady clock; the header also has the
+ * system clock time at which the segment was created, to relate the two, and
+ * the time at which the session started.
+ *
+ * A tick record holds a message from the simulator, what became of it, and,
+ * if we solved for it, the actuations and plan and the time of each phase
+ * along the way. Every message is recorded, including those that the solver
+ * dropped for newer ones and those from manual mode, in the order they
+ * arrived. Every
+ * FLIGHT_INDEX_INTERVAL ticks, and at the end of each segment, an index
+ * record lists the offset and arrival time of each tick since the previous
+ * index, and the offset of the previous index, so tools can seek by time
+ * without reading every tick. The header has the number of bytes in use and
+ * the offset of the latest index, which are updated after each record, so a
+ * segment can be read back even if the process died while writing it.
+ */
+
+// Identifies a segment file.
+const char FLIGHT_LOG_MAGIC[8] = { 'M', 'P', 'C', 'F', 'L', 'O', 'G', 0 };
+
+// Bump this whenever a layout changes.
+const uint32_t FLIGHT_LOG_VERSION = 2;
+
+// Size of the segment header.
+const size_t FLIGHT_HEADER_SIZE = 80;
+
+// Offsets of the fields in the segment header that change as we write.
+const size_t FLIGHT_HEADER_USED = 64;
+const size_t FLIGHT_HEADER_LAST_INDEX = 72;
+
+// Size of a record's type and length.
+const size_t FLIGHT_RECORD_HEADER_SIZE = 8;
+
+// Ticks between index records.
+const size_t FLIGHT_INDEX_INTERVAL = 64;
+
+// Size of each entry in an index record.
+const size_t FLIGHT_INDEX_ENTRY_SIZE = 24;
+
+enum FlightRecordType {
+  FLIGHT_TICK = 1,
+  FLIGHT_INDEX
+};
+
+// What became of a tick's message.
+enum FlightOutcome {
+  // We solved for it and sent the actuations.
+  FLIGHT_SENT,
+  // Newer telemetry arrived before the solver thread was free for it.
+  FLIGHT_DROPPED,
+  // The simulator was in manual mode, so there was no telemetry.
+  FLIGHT_MANUAL,
+  // We solved for it and then closed the session instead of sending the
+  // actuations, because the car crashed or the run was over.
+  FLIGHT_CLOSED,
+  // The simulator disconnected before we sent the actuations.
+  FLIGHT_ABANDONED
+};
+
+/**
+ * Name of a FlightOutcome, e.g. "dropped", for tools.
+ */
+const char *FlightOutcomeName(uint32_t outcome);
+
+/**
+ * The segment header: magic, then these fields in order.
+ */
+struct FlightSegmentHeader {
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t segment_size;
+  uint64_t session;
+  // Position of this segment in the session's log, from 0.
+  uint64_t sequence;
+  int64_t created_system_ns;
+  int64_t created_steady_ns;
+  // When the session started, and its controller was reset, or 0 if not
+  // known.
+  int64_t session_start_ns;
+  // Bytes in use, including the header.
+  uint64_t used;
+  // Offset of the latest index record, or 0 if there is none.
+  uint64_t last_index;
+};
+
+/**
+ * One message: what came in, what went out and when. The times, actuations
+ * and plan are 0 or empty for the phases that the message never reached.
+ */
+struct FlightTick {
+  FlightTick();
+
+  // Number of ticks in the session before this one.
+  uint64_t tick;
+
+  // A FlightOutcome.
+  uint32_t outcome;
+
+  // When the message arrived, when it was parsed and handed to the solver
+  // thread, when the solve started and ended, and when we started and
+  // finished sending the actuations.
+  int64_t received_ns;
+  int64_t posted_ns;
+  int64_t solve_start_ns;
+  int64_t solve_end_ns;
+  int64_t send_start_ns;
+  int64_t send_end_ns;
+
+  // The telemetry as it arrived; empty for a message from manual mode.
+  Telemetry telemetry;
+
+  // What we sent, in [-1, 1].
+  double steering_angle;
+  double throttle;
+
+  // From the MPC: time taken by the solve (s), objective value, latency
+  // estimate (s) and why it fell back, if it did.
+  double solve_time;
+  double cost;
+  double latency;
+  uint32_t fallback_reason;
+
+  // The plan we sent, in vehicle coordinates.
+  std::vector<double> mpc_x;
+  std::vector<double> mpc_y;
+
+  /**
+   * Size of the tick's payload when written.
+   */
+  size_t size() const;
+};
+
+/**
+ * Write the tick's payload at `out`, which must have room for tick.size()
+ * bytes, and return the end of what was written.
+ */
+char *WriteFlightTick(char *out, const FlightTick &tick);
+
+/**
+ * Reads the ticks back from segment files, in order.
+ */
+class FlightLogReader {
+public:
+  FlightLogReader();
+
+  virtual ~FlightLogReader();
+
+  /**
+   * Open a segment file. Returns false if it could not be read or is not a
+   * segment of a version that we can read.
+   */
+  bool Open(const std::string &pathname);
+
+  /**
+   * Read the next tick, skipping index records. Returns false at the end of
+   * the segment, or if the rest of it is corrupt.
+   */
+  bool Next(FlightTick &tick);
+
+  const FlightSegmentHeader &header() const { return segment_header; }
+
+private:
+  std::vector<char> data;
+  size_t offset;
+  FlightSegmentHeader segment_header;
+};
+
+#endif /* FLIGHT_LOG_H */
@@ -0,0 +1,287 @@
+#include "flight_recorder.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Smallest segment that we will create, in bytes.
+const size_t MIN_SEGMENT_SIZE = 1 << 20;
+
+// Room to keep at the end of a segment for its last index record.
+const size_t INDEX_RESERVE = FLIGHT_RECORD_HEADER_SIZE + 12 +
+  FLIGHT_INDEX_INTERVAL * FLIGHT_INDEX_ENTRY_SIZE;
+
+std::atomic<unsigned> FlightRecorder::rotations(0);
+
+struct FlightRecorder::Work {
+  uv_work_t request;
+
+  // Null if the recorder has gone away, or for retiring a segment.
+  FlightRecorder *recorder;
+
+  uint64_t session;
+  int64_t started_ns;
+  Segment segment;
+  size_t used;
+  bool ok;
+};
+
+static int64_t Nanoseconds(std::chrono::nanoseconds duration) {
+  return duration.count();
+}
+
+FlightRecorder::FlightRecorder(uv_loop_t *loop, const std::string &directory,
+  uint64_t session, std::chrono::steady_clock::time_point started,
+  size_t segment_size) :
+  dropped(0),
+  loop(loop),
+  directory(directory),
+  session(session),
+  started_ns(Nanoseconds(started.time_since_epoch())),
+  segment_size(std::max(segment_size, MIN_SEGMENT_SIZE)),
+  used(FLIGHT_HEADER_SIZE),
+  preparing(nullptr),
+  last_index(0),
+  ticks(0),
+  rotate(false),
+  rotation(rotations.load())
+{
+  index.reserve(FLIGHT_INDEX_INTERVAL);
+
+  current.size = this->segment_size;
+  current.sequence = 0;
+  current.pathname = Pathname(current.sequence);
+  if (!CreateSegment(current, session, started_ns)) return;
+  PrepareNext();
+}
+
+FlightRecorder::~FlightRecorder() {
+  // Let a segment that is still being prepared clean up after itself.
+  if (preparing) preparing->recorder = nullptr;
+
+  if (next.data) {
+    RetireSegment(next, 0);
+  }
+
+  if (current.data) {
+    if (!index.empty()) WriteIndex();
+    UpdateHeader();
+    RetireSegment(current, used);
+  }
+}
+
+void FlightRecorder::Record(FlightTick &tick) {
+  tick.tick = ticks++;
+  if (!current.data) {
+    ++dropped;
+    return;
+  }
+
+  size_t payload = tick.size();
+  size_t length = FLIGHT_RECORD_HEADER_SIZE + payload;
+  bool full = used + length + INDEX_RESERVE > current.size;
+  bool requested = rotate || rotation != rotations.load();
+  if ((full || requested) && next.data) {
+    if (!index.empty()) WriteIndex();
+    UpdateHeader();
+
+    Work *work = new Work;
+    work->request.data = work;
+    work->recorder = nullptr;
+    work->session = session;
+    work->started_ns = started_ns;
+    work->segment = current;
+    work->used = used;
+    uv_queue_work(loop, &work->request, OnRetire, OnRetired);
+
+    current = next;
+    next = Segment();
+    used = FLIGHT_HEADER_SIZE;
+    last_index = 0;
+    rotate = false;
+    rotation = rotations.load();
+    PrepareNext();
+  }
+
+  // The next segment isn't ready yet, or is too small for this tick.
+  if (used + length + INDEX_RESERVE > current.size) {
+    ++dropped;
+    return;
+  }
+
+  char *out = current.data + used;
+  uint32_t type = FLIGHT_TICK;
+  uint32_t payload_length = payload;
+  memcpy(out, &type, sizeof(type));
+  memcpy(out + 4, &payload_length, sizeof(payload_length));
+  WriteFlightTick(out + FLIGHT_RECORD_HEADER_SIZE, tick);
+
+  IndexEntry entry = { tick.tick, tick.received_ns, used };
+  index.push_back(entry);
+  used += length;
+  if (index.size() == FLIGHT_INDEX_INTERVAL) WriteIndex();
+  UpdateHeader();
+}
+
+void FlightRecorder::Rotate() {
+  rotate = true;
+}
+
+void FlightRecorder::RequestRotation() {
+  rotations.fetch_add(1);
+}
+
+void FlightRecorder::PrepareNext() {
+  Work *work = new Work;
+  work->request.data = work;
+  work->recorder = this;
+  work->session = session;
+  work->started_ns = started_ns;
+  work->segment.size = segment_size;
+  work->segment.sequence = current.sequence + 1;
+  work->segment.pathname = Pathname(work->segment.sequence);
+  work->used = 0;
+  work->ok = false;
+  preparing = work;
+  uv_queue_work(loop, &work->request, OnPrepare, OnPrepared);
+}
+
+void FlightRecorder::WriteIndex() {
+  char *out = current.data + used;
+  uint32_t type = FLIGHT_INDEX;
+  uint32_t count = index.size();
+  uint32_t length = 12 + count * FLIGHT_INDEX_ENTRY_SIZE;
+  memcpy(out, &type, 4);
+  memcpy(out + 4, &length, 4);
+  memcpy(out + 8, &last_index, 8);
+  memcpy(out + 16, &count, 4);
+  out += FLIGHT_RECORD_HEADER_SIZE + 12;
+  for (size_t i = 0; i < index.size(); ++i) {
+    memcpy(out, &index[i].tick, 8);
+    memcpy(out + 8, &index[i].received_ns, 8);
+    memcpy(out + 16, &index[i].offset, 8);
+    out += FLIGHT_INDEX_ENTRY_SIZE;
+  }
+  last_index = used;
+  used += FLIGHT_RECORD_HEADER_SIZE + length;
+  index.clear();
+}
+
+void FlightRecorder::UpdateHeader() {
+  uint64_t used_bytes = used;
+  memcpy(current.data + FLIGHT_HEADER_USED, &used_bytes, 8);
+  memcpy(current.data + FLIGHT_HEADER_LAST_INDEX, &last_index, 8);
+}
+
+std::string FlightRecorder::Pathname(uint64_t sequence) const {
+  char name[64];
+  snprintf(name, sizeof(name), "/mpc-%d-%llu-%06llu.flight", (int)getpid(),
+    (unsigned long long)session, (unsigned long long)sequence);
+  return directory + name;
+}
+
+bool FlightRecorder::CreateSegment(Segment &segment, uint64_t session,
+  int64_t started_ns)
+{
+  int fd = open(segment.pathname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    std::cerr << "Failed to create flight log " << segment.pathname << ": " <<
+      strerror(errno) << std::endl;
+    return false;
+  }
+
+  // Allocate the blocks up front where we can, so that running out of disk
+  // space is an error here rather than a SIGBUS when we write to the map.
+#ifdef __linux__
+  int error = posix_fallocate(fd, 0, segment.size);
+#else
+  int error = ftruncate(fd, segment.size) == 0 ? 0 : errno;
+#endif
+  void *memory = MAP_FAILED;
+  if (error == 0) {
+    memory = mmap(nullptr, segment.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+      fd, 0);
+    if (memory == MAP_FAILED) error = errno;
+  }
+  close(fd);
+  if (error) {
+    std::cerr << "Failed to allocate flight log " << segment.pathname <<
+      ": " << strerror(error) << std::endl;
+    unlink(segment.pathname.c_str());
+    return false;
+  }
+
+  FlightSegmentHeader header;
+  header.version = FLIGHT_LOG_VERSION;
+  header.header_size = FLIGHT_HEADER_SIZE;
+  header.segment_size = segment.size;
+  header.session = session;
+  header.sequence = segment.sequence;
+  header.created_system_ns = Nanoseconds(
+    std::chrono::system_clock::now().time_since_epoch());
+  header.created_steady_ns = Nanoseconds(
+    std::chrono::steady_clock::now().time_since_epoch());
+  header.session_start_ns = started_ns;
+  header.used = FLIGHT_HEADER_SIZE;
+  header.last_index = 0;
+
+  char *out = (char *)memory;
+  memcpy(out, FLIGHT_LOG_MAGIC, sizeof(FLIGHT_LOG_MAGIC));
+  memcpy(out + 8, &header.version, 4);
+  memcpy(out + 12, &header.header_size, 4);
+  memcpy(out + 16, &header.segment_size, 8);
+  memcpy(out + 24, &header.session, 8);
+  memcpy(out + 32, &header.sequence, 8);
+  memcpy(out + 40, &header.created_system_ns, 8);
+  memcpy(out + 48, &header.created_steady_ns, 8);
+  memcpy(out + 56, &header.session_start_ns, 8);
+  memcpy(out + FLIGHT_HEADER_USED, &header.used, 8);
+  memcpy(out + FLIGHT_HEADER_LAST_INDEX, &header.last_index, 8);
+
+  segment.data = out;
+  return true;
+}
+
+void FlightRecorder::RetireSegment(const Segment &segment, size_t used) {
+  munmap(segment.data, segment.size);
+  if (used == 0) {
+    // Never used, so don't leave it lying around.
+    unlink(segment.pathname.c_str());
+  } else if (truncate(segment.pathname.c_str(), used) != 0) {
+    std::cerr << "Failed to trim flight log " << segment.pathname << ": " <<
+      strerror(errno) << std::endl;
+  }
+}
+
+void FlightRecorder::OnPrepare(uv_work_t *request) {
+  Work *work = (Work *)request->data;
+  work->ok = CreateSegment(work->segment, work->session,
+    work->started_ns);
+}
+
+void FlightRecorder::OnPrepared(uv_work_t *request, int status) {
+  Work *work = (Work *)request->data;
+  FlightRecorder *recorder = work->recorder;
+  if (recorder) {
+    recorder->preparing = nullptr;
+    if (work->ok) recorder->next = work->segment;
+  } else if (work->ok) {
+    RetireSegment(work->segment, 0);
+  }
+  delete work;
+}
+
+void FlightRecorder::OnRetire(uv_work_t *request) {
+  Work *work = (Work *)request->data;
+  RetireSegment(work->segment, work->used);
+}
+
+void FlightRecorder::OnRetired(uv_work_t *request, int status) {
+  delete (Work *)request->data;
+}
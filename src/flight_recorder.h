@@ -0,0 +1,135 @@
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <uv.h>
+
+#include "flight_log.h"
+
+/**
+ * Records every tick of a session to an append-only log of memory-mapped
+ * segment files, for analysis after the fact (see flight_log.h for the
+ * format).
+ *
+ * Each segment is created at its full size and mapped up front, so writing a
+ * tick is just copying it into memory: there are no system calls, and the
+ * kernel writes the pages back in its own time. The next segment is created,
+ * sized and mapped on libuv's thread pool while we write to the current one,
+ * and full segments are trimmed and unmapped there too, so rotating only
+ * swaps two mappings on the loop thread.
+ *
+ * Record and Rotate must be called on the loop thread. If the log can't be
+ * written (e.g. the disk is full), recording stops rather than holding up the
+ * session.
+ */
+class FlightRecorder {
+public:
+  /**
+   * @param loop whose thread pool prepares and retires the segments
+   * @param directory to write the segments to, which must exist
+   * @param session identifies the session in the file names and headers
+   * @param started when the session started, for the headers
+   * @param segment_size of each segment file, in bytes
+   */
+  FlightRecorder(uv_loop_t *loop, const std::string &directory,
+    uint64_t session, std::chrono::steady_clock::time_point started,
+    size_t segment_size);
+
+  virtual ~FlightRecorder();
+
+  /**
+   * Append a tick; its tick number is set here.
+   */
+  void Record(FlightTick &tick);
+
+  /**
+   * Start a new segment before the next tick.
+   */
+  void Rotate();
+
+  /**
+   * Make every recorder in the process rotate before its next tick, e.g. on
+   * SIGHUP from logrotate. This is safe to call from a signal handler.
+   */
+  static void RequestRotation();
+
+  // Is the recorder still writing?
+  bool recording() const { return current.data != nullptr; }
+
+  // Ticks that did not fit in a segment, or arrived after recording stopped.
+  size_t dropped;
+
+private:
+  // A mapped segment file.
+  struct Segment {
+    Segment() : data(nullptr), size(0), sequence(0) { }
+    char *data;
+    size_t size;
+    uint64_t sequence;
+    std::string pathname;
+  };
+
+  // Work for the thread pool, which outlives the recorder if need be.
+  struct Work;
+
+  uv_loop_t *loop;
+  std::string directory;
+  uint64_t session;
+  int64_t started_ns;
+  size_t segment_size;
+
+  // The segment that we are writing, and how much of it is in use.
+  Segment current;
+  size_t used;
+
+  // The next segment, once the thread pool has prepared it.
+  Segment next;
+  Work *preparing;
+
+  // Ticks in the current segment since the latest index record.
+  struct IndexEntry {
+    uint64_t tick;
+    int64_t received_ns;
+    uint64_t offset;
+  };
+  std::vector<IndexEntry> index;
+  uint64_t last_index;
+
+  uint64_t ticks;
+
+  // Has Rotate been called since we last rotated?
+  bool rotate;
+
+  // Value of `rotations` when we last rotated.
+  unsigned rotation;
+  static std::atomic<unsigned> rotations;
+
+  // Start preparing the segment after the current one.
+  void PrepareNext();
+
+  void WriteIndex();
+
+  // Update the header fields that change as we write.
+  void UpdateHeader();
+
+  std::string Pathname(uint64_t sequence) const;
+
+  // Create, size and map a segment file, on any thread.
+  static bool CreateSegment(Segment &segment, uint64_t session,
+    int64_t started_ns);
+
+  // Trim a segment file to what was used and unmap it, on any thread.
+  static void RetireSegment(const Segment &segment, size_t used);
+
+  static void OnPrepare(uv_work_t *request);
+  static void OnPrepared(uv_work_t *request, int status);
+  static void OnRetire(uv_work_t *request);
+  static void OnRetired(uv_work_t *request, int status);
+};
+
+#endif /* FLIGHT_RECORDER_H */
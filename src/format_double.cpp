@@ -0,0 +1,349 @@
+#include "format_double.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// The digit generation works with scaled values whose binary exponents are
+// in [ALPHA, GAMMA], so that the integral part fits in 32 bits.
+const int ALPHA = -60;
+const int GAMMA = -32;
+
+// Write exponents outside this range, and numbers with more integral digits
+// than this, in scientific notation.
+const int MIN_FIXED_EXPONENT = -4;
+const int MAX_FIXED_EXPONENT = 15;
+
+namespace {
+
+// A floating point number f * 2^e, with a 64 bit significand.
+struct DiyFp {
+  uint64_t f;
+  int e;
+};
+
+DiyFp Subtract(const DiyFp &x, const DiyFp &y) {
+  DiyFp result = { x.f - y.f, x.e };
+  return result;
+}
+
+// The product rounded to 64 bits.
+DiyFp Multiply(const DiyFp &x, const DiyFp &y) {
+  uint64_t x_lo = x.f & 0xFFFFFFFFu;
+  uint64_t x_hi = x.f >> 32;
+  uint64_t y_lo = y.f & 0xFFFFFFFFu;
+  uint64_t y_hi = y.f >> 32;
+
+  uint64_t p0 = x_lo * y_lo;
+  uint64_t p1 = x_lo * y_hi;
+  uint64_t p2 = x_hi * y_lo;
+  uint64_t p3 = x_hi * y_hi;
+
+  uint64_t middle = (p0 >> 32) + (p1 & 0xFFFFFFFFu) + (p2 & 0xFFFFFFFFu);
+  middle += uint64_t(1) << 31;
+  DiyFp result = {
+    p3 + (p1 >> 32) + (p2 >> 32) + (middle >> 32), x.e + y.e + 64 };
+  return result;
+}
+
+DiyFp Normalize(DiyFp x) {
+  while ((x.f >> 63) == 0) {
+    x.f <<= 1;
+    --x.e;
+  }
+  return x;
+}
+
+DiyFp NormalizeTo(const DiyFp &x, int e) {
+  DiyFp result = { x.f << (x.e - e), e };
+  return result;
+}
+
+// Cached powers of ten, c = f * 2^e ~= 10^k, for every eighth k.
+struct CachedPower {
+  uint64_t f;
+  int e;
+  int k;
+};
+
+const int CACHED_POWERS_MIN_K = -300;
+const int CACHED_POWERS_K_STEP = 8;
+
+const CachedPower CACHED_POWERS[] = {
+  { 0xAB70FE17C79AC6CAull, -1060, -300 },
+  { 0xFF77B1FCBEBCDC4Full, -1034, -292 },
+  { 0xBE5691EF416BD60Cull, -1007, -284 },
+  { 0x8DD01FAD907FFC3Cull,  -980, -276 },
+  { 0xD3515C2831559A83ull,  -954, -268 },
+  { 0x9D71AC8FADA6C9B5ull,  -927, -260 },
+  { 0xEA9C227723EE8BCBull,  -901, -252 },
+  { 0xAECC49914078536Dull,  -874, -244 },
+  { 0x823C12795DB6CE57ull,  -847, -236 },
+  { 0xC21094364DFB5637ull,  -821, -228 },
+  { 0x9096EA6F3848984Full,  -794, -220 },
+  { 0xD77485CB25823AC7ull,  -768, -212 },
+  { 0xA086CFCD97BF97F4ull,  -741, -204 },
+  { 0xEF340A98172AACE5ull,  -715, -196 },
+  { 0xB23867FB2A35B28Eull,  -688, -188 },
+  { 0x84C8D4DFD2C63F3Bull,  -661, -180 },
+  { 0xC5DD44271AD3CDBAull,  -635, -172 },
+  { 0x936B9FCEBB25C996ull,  -608, -164 },
+  { 0xDBAC6C247D62A584ull,  -582, -156 },
+  { 0xA3AB66580D5FDAF6ull,  -555, -148 },
+  { 0xF3E2F893DEC3F126ull,  -529, -140 },
+  { 0xB5B5ADA8AAFF80B8ull,  -502, -132 },
+  { 0x87625F056C7C4A8Bull,  -475, -124 },
+  { 0xC9BCFF6034C13053ull,  -449, -116 },
+  { 0x964E858C91BA2655ull,  -422, -108 },
+  { 0xDFF9772470297EBDull,  -396, -100 },
+  { 0xA6DFBD9FB8E5B88Full,  -369,  -92 },
+  { 0xF8A95FCF88747D94ull,  -343,  -84 },
+  { 0xB94470938FA89BCFull,  -316,  -76 },
+  { 0x8A08F0F8BF0F156Bull,  -289,  -68 },
+  { 0xCDB02555653131B6ull,  -263,  -60 },
+  { 0x993FE2C6D07B7FACull,  -236,  -52 },
+  { 0xE45C10C42A2B3B06ull,  -210,  -44 },
+  { 0xAA242499697392D3ull,  -183,  -36 },
+  { 0xFD87B5F28300CA0Eull,  -157,  -28 },
+  { 0xBCE5086492111AEBull,  -130,  -20 },
+  { 0x8CBCCC096F5088CCull,  -103,  -12 },
+  { 0xD1B71758E219652Cull,   -77,   -4 },
+  { 0x9C40000000000000ull,   -50,    4 },
+  { 0xE8D4A51000000000ull,   -24,   12 },
+  { 0xAD78EBC5AC620000ull,     3,   20 },
+  { 0x813F3978F8940984ull,    30,   28 },
+  { 0xC097CE7BC90715B3ull,    56,   36 },
+  { 0x8F7E32CE7BEA5C70ull,    83,   44 },
+  { 0xD5D238A4ABE98068ull,   109,   52 },
+  { 0x9F4F2726179A2245ull,   136,   60 },
+  { 0xED63A231D4C4FB27ull,   162,   68 },
+  { 0xB0DE65388CC8ADA8ull,   189,   76 },
+  { 0x83C7088E1AAB65DBull,   216,   84 },
+  { 0xC45D1DF942711D9Aull,   242,   92 },
+  { 0x924D692CA61BE758ull,   269,  100 },
+  { 0xDA01EE641A708DEAull,   295,  108 },
+  { 0xA26DA3999AEF774Aull,   322,  116 },
+  { 0xF209787BB47D6B85ull,   348,  124 },
+  { 0xB454E4A179DD1877ull,   375,  132 },
+  { 0x865B86925B9BC5C2ull,   402,  140 },
+  { 0xC83553C5C8965D3Dull,   428,  148 },
+  { 0x952AB45CFA97A0B3ull,   455,  156 },
+  { 0xDE469FBD99A05FE3ull,   481,  164 },
+  { 0xA59BC234DB398C25ull,   508,  172 },
+  { 0xF6C69A72A3989F5Cull,   534,  180 },
+  { 0xB7DCBF5354E9BECEull,   561,  188 },
+  { 0x88FCF317F22241E2ull,   588,  196 },
+  { 0xCC20CE9BD35C78A5ull,   614,  204 },
+  { 0x98165AF37B2153DFull,   641,  212 },
+  { 0xE2A0B5DC971F303Aull,   667,  220 },
+  { 0xA8D9D1535CE3B396ull,   694,  228 },
+  { 0xFB9B7CD9A4A7443Cull,   720,  236 },
+  { 0xBB764C4CA7A44410ull,   747,  244 },
+  { 0x8BAB8EEFB6409C1Aull,   774,  252 },
+  { 0xD01FEF10A657842Cull,   800,  260 },
+  { 0x9B10A4E5E9913129ull,   827,  268 },
+  { 0xE7109BFBA19C0C9Dull,   853,  276 },
+  { 0xAC2820D9623BF429ull,   880,  284 },
+  { 0x80444B5E7AA7CF85ull,   907,  292 },
+  { 0xBF21E44003ACDD2Dull,   933,  300 },
+  { 0x8E679C2F5E44FF8Full,   960,  308 },
+  { 0xD433179D9C8CB841ull,   986,  316 },
+  { 0x9E19DB92B4E31BA9ull,  1013,  324 },
+};
+
+// Find a cached power of ten c such that the exponent of the product of c
+// and a number with binary exponent e is in [ALPHA, GAMMA].
+const CachedPower &CachedPowerFor(int e) {
+  // k = ceil((ALPHA - e - 1) * log10(2)); 78913 / 2^18 ~= log10(2).
+  int f = ALPHA - e - 1;
+  int k = (f * 78913) / (1 << 18) + (f > 0);
+  int index = (k - CACHED_POWERS_MIN_K + CACHED_POWERS_K_STEP - 1) /
+    CACHED_POWERS_K_STEP;
+  return CACHED_POWERS[index];
+}
+
+// Largest power of ten that is at most n, and its number of digits.
+int LargestPowerOfTen(uint32_t n, uint32_t &power) {
+  int digits = 10;
+  power = 1000000000;
+  while (digits > 1 && n < power) {
+    power /= 10;
+    --digits;
+  }
+  return digits;
+}
+
+// Move the last digit towards w while the result stays in the rounding
+// interval and gets closer.
+void Round(char *digits, int length, uint64_t distance, uint64_t delta,
+  uint64_t rest, uint64_t ten_k)
+{
+  while (rest < distance && delta - rest >= ten_k &&
+    (rest + ten_k < distance || distance - rest > rest + ten_k - distance)) {
+    --digits[length - 1];
+    rest += ten_k;
+  }
+}
+
+// Generate the shortest digits in the interval (low, high), which contains
+// w. The exponents of all three must be the same, and in [ALPHA, GAMMA].
+void GenerateDigits(char *digits, int &length, int &exponent,
+  const DiyFp &low, const DiyFp &w, const DiyFp &high)
+{
+  uint64_t delta = Subtract(high, low).f;
+  uint64_t distance = Subtract(high, w).f;
+
+  // Split high into integral and fractional parts.
+  DiyFp one = { uint64_t(1) << -high.e, high.e };
+  uint32_t integral = uint32_t(high.f >> -one.e);
+  uint64_t fraction = high.f & (one.f - 1);
+
+  uint32_t power;
+  int n = LargestPowerOfTen(integral, power);
+  while (n > 0) {
+    digits[length++] = char('0' + integral / power);
+    integral %= power;
+    --n;
+
+    uint64_t rest = (uint64_t(integral) << -one.e) + fraction;
+    if (rest <= delta) {
+      exponent += n;
+      Round(digits, length, distance, delta, rest,
+        uint64_t(power) << -one.e);
+      return;
+    }
+    power /= 10;
+  }
+
+  int m = 0;
+  for (;;) {
+    fraction *= 10;
+    digits[length++] = char('0' + (fraction >> -one.e));
+    fraction &= one.f - 1;
+    ++m;
+    delta *= 10;
+    distance *= 10;
+    if (fraction <= delta) break;
+  }
+  exponent -= m;
+  Round(digits, length, distance, delta, fraction, one.f);
+}
+
+// Write the shortest digits of a positive, finite double, so that it is
+// digits * 10^exponent.
+void Grisu2(char *digits, int &length, int &exponent, double value) {
+  const int SIGNIFICAND_BITS = 52;
+  const int EXPONENT_BIAS = 1023 + SIGNIFICAND_BITS;
+  const uint64_t HIDDEN_BIT = uint64_t(1) << SIGNIFICAND_BITS;
+
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint64_t biased_exponent = bits >> SIGNIFICAND_BITS;
+  uint64_t significand = bits & (HIDDEN_BIT - 1);
+
+  DiyFp v;
+  if (biased_exponent == 0) {
+    v.f = significand;
+    v.e = 1 - EXPONENT_BIAS;
+  } else {
+    v.f = significand + HIDDEN_BIT;
+    v.e = int(biased_exponent) - EXPONENT_BIAS;
+  }
+
+  // The boundaries halfway to the neighbouring doubles; the lower one is
+  // closer at powers of two.
+  bool lower_is_closer = significand == 0 && biased_exponent > 1;
+  DiyFp plus = { 2 * v.f + 1, v.e - 1 };
+  DiyFp minus = lower_is_closer ?
+    DiyFp{ 4 * v.f - 1, v.e - 2 } : DiyFp{ 2 * v.f - 1, v.e - 1 };
+  plus = Normalize(plus);
+  minus = NormalizeTo(minus, plus.e);
+  v = Normalize(v);
+
+  // Scale into [ALPHA, GAMMA], and shrink the interval by one unit at each
+  // end to allow for the rounding errors in the multiplication.
+  const CachedPower &cached = CachedPowerFor(plus.e);
+  DiyFp c = { cached.f, cached.e };
+  DiyFp w = Multiply(v, c);
+  DiyFp low = Multiply(minus, c);
+  DiyFp high = Multiply(plus, c);
+  ++low.f;
+  --high.f;
+
+  length = 0;
+  exponent = -cached.k;
+  GenerateDigits(digits, length, exponent, low, w, high);
+}
+
+char *WriteExponent(char *buffer, int exponent) {
+  if (exponent < 0) {
+    *buffer++ = '-';
+    exponent = -exponent;
+  } else {
+    *buffer++ = '+';
+  }
+  if (exponent >= 100) {
+    *buffer++ = char('0' + exponent / 100);
+    exponent %= 100;
+  }
+  *buffer++ = char('0' + exponent / 10);
+  *buffer++ = char('0' + exponent % 10);
+  return buffer;
+}
+
+// Lay out the digits, which are at the start of the buffer, with a decimal
+// point and exponent as needed.
+char *Format(char *buffer, int length, int exponent) {
+  // The number is 0.digits * 10^point.
+  int point = length + exponent;
+
+  if (length <= point && point <= MAX_FIXED_EXPONENT) {
+    // digits000.0
+    memset(buffer + length, '0', point - length);
+    buffer[point] = '.';
+    buffer[point + 1] = '0';
+    return buffer + point + 2;
+  }
+  if (0 < point && point <= MAX_FIXED_EXPONENT) {
+    // dig.its
+    memmove(buffer + point + 1, buffer + point, length - point);
+    buffer[point] = '.';
+    return buffer + length + 1;
+  }
+  if (MIN_FIXED_EXPONENT < point && point <= 0) {
+    // 0.000digits
+    memmove(buffer + 2 - point, buffer, length);
+    buffer[0] = '0';
+    buffer[1] = '.';
+    memset(buffer + 2, '0', -point);
+    return buffer + 2 - point + length;
+  }
+
+  // d.igitse+123
+  if (length > 1) {
+    memmove(buffer + 2, buffer + 1, length - 1);
+    buffer[1] = '.';
+    buffer += length + 1;
+  } else {
+    buffer += 1;
+  }
+  *buffer++ = 'e';
+  return WriteExponent(buffer, point - 1);
+}
+
+} // namespace
+
+char *FormatDouble(char *buffer, double value) {
+  if (std::signbit(value)) {
+    *buffer++ = '-';
+    value = -value;
+  }
+  if (value == 0) {
+    memcpy(buffer, "0.0", 3);
+    return buffer + 3;
+  }
+
+  int length, exponent;
+  Grisu2(buffer, length, exponent, value);
+  return Format(buffer, length, exponent);
+}
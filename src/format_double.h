@@ -0,0 +1,23 @@
+#ifndef FORMAT_DOUBLE_H
+#define FORMAT_DOUBLE_H
+
+#include <cstddef>
+
+// Space that FormatDouble may need, including the sign.
+const size_t FORMAT_DOUBLE_BUFFER_SIZE = 32;
+
+/**
+ * Write a finite double as a JSON number with the fewest digits that read
+ * back as the same double, using the Grisu2 algorithm (Loitsch, "Printing
+ * Floating-Point Numbers Quickly and Accurately with Integers", 2010). It
+ * does not allocate, depend on the locale or write a terminator.
+ *
+ * Numbers are written like the JSON library does, e.g. "1.0", "-0.25" and
+ * "1.5e+20".
+ *
+ * @param buffer with room for FORMAT_DOUBLE_BUFFER_SIZE characters
+ * @return the end of the number in the buffer
+ */
+char *FormatDouble(char *buffer, double value);
+
+#endif /* FORMAT_DOUBLE_H */
@@ -0,0 +1,42 @@
+#ifndef HORNER_H
+#define HORNER_H
+
+/**
+ * Evaluate polynomials with the Horner scheme, unrolled at compile time.
+ *
+ * Horner<I, Remaining>::Value evaluates
+ *
+ *   c[I] + x * (c[I + 1] + x * (... + x * c[I + Remaining]))
+ *
+ * so Horner<0, Degree>::Value(c, x) is the whole polynomial, and
+ * Horner<0, Degree - 1>::Slope(c, x) is its derivative. The coefficients can
+ * be any indexable type of doubles, and x can be a double or an AD type.
+ */
+template <int I, int Remaining>
+struct Horner {
+  template <typename Coefficients, typename T>
+  static T Value(const Coefficients &c, const T &x) {
+    return c[I] + x * Horner<I + 1, Remaining - 1>::Value(c, x);
+  }
+
+  template <typename Coefficients, typename T>
+  static T Slope(const Coefficients &c, const T &x) {
+    return (I + 1) * c[I + 1] +
+      x * Horner<I + 1, Remaining - 1>::Slope(c, x);
+  }
+};
+
+template <int I>
+struct Horner<I, 0> {
+  template <typename Coefficients, typename T>
+  static T Value(const Coefficients &c, const T &) {
+    return T(c[I]);
+  }
+
+  template <typename Coefficients, typename T>
+  static T Slope(const Coefficients &c, const T &) {
+    return T((I + 1) * c[I + 1]);
+  }
+};
+
+#endif /* HORNER_H */
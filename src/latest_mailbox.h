@@ -0,0 +1,77 @@
+#ifndef LATEST_MAILBOX_H
+#define LATEST_MAILBOX_H
+
+#include <atomic>
+
+/**
+ * A lock-free, single-slot mailbox between one writer thread and one reader
+ * thread, in which the latest message wins: a message that has not been
+ * taken by the time the next one is published is dropped.
+ *
+ * It is a triple buffer: the writer fills its own slot in place and then
+ * swaps it with the shared middle slot, and the reader swaps its own slot
+ * with the middle slot when there is something new there. Neither side ever
+ * waits for the other, and messages are never copied.
+ */
+template <typename T>
+class LatestMailbox {
+public:
+  LatestMailbox() : writer_slot(0), middle(1), reader_slot(2) { }
+
+  /**
+   * The slot for the writer to fill in before calling Publish. It may hold
+   * an old message.
+   */
+  T &writable() { return slots[writer_slot]; }
+
+  /**
+   * Make the writable slot the latest message. Returns true if this dropped
+   * a message that the reader had not taken.
+   */
+  bool Publish() {
+    int previous = middle.exchange(writer_slot | FRESH,
+      std::memory_order_acq_rel);
+    writer_slot = previous & INDEX;
+    return (previous & FRESH) != 0;
+  }
+
+  /**
+   * Is there a message that the reader has not taken?
+   */
+  bool fresh() const {
+    return (middle.load(std::memory_order_acquire) & FRESH) != 0;
+  }
+
+  /**
+   * Take the latest message, if there is a new one, into the readable slot.
+   * Returns false if there is nothing new.
+   */
+  bool Take() {
+    if (!fresh()) return false;
+    int previous = middle.exchange(reader_slot, std::memory_order_acq_rel);
+    reader_slot = previous & INDEX;
+    return true;
+  }
+
+  /**
+   * The message that the reader took most recently.
+   */
+  T &readable() { return slots[reader_slot]; }
+
+private:
+  // The middle slot's index, with a flag for whether it is new.
+  static const int INDEX = 3;
+  static const int FRESH = 4;
+
+  T slots[3];
+
+  // Only the writer uses this.
+  int writer_slot;
+
+  std::atomic<int> middle;
+
+  // Only the reader uses this.
+  int reader_slot;
+};
+
+#endif /* LATEST_MAILBOX_H */
@@ -0,0 +1,146 @@
+#include "long_horizon_planner.h"
+
+#include <chrono>
+#include <cmath>
+
+#include "solver_threads.h"
+
+// Number of time steps and timestep for the long plan; together, these give
+// a lookahead of 3.6s.
+const size_t LONG_N = 25;
+const double LONG_DT = 0.15;
+
+const double DEFAULT_PERIOD = 0.25; // s
+const double DEFAULT_TRACKING_TIME = 1.5; // s
+const size_t DEFAULT_TRACKING_N = 10;
+
+LongHorizonPlanner::LongHorizonPlanner() :
+  period(DEFAULT_PERIOD),
+  tracking_time(DEFAULT_TRACKING_TIME),
+  tracking_n(DEFAULT_TRACKING_N),
+  problem(reference),
+  mpc(reference, problem),
+  running(false),
+  has_telemetry(false)
+{
+  mpc.SetHorizon(LONG_N, LONG_DT);
+}
+
+LongHorizonPlanner::~LongHorizonPlanner() {
+  Stop();
+}
+
+void LongHorizonPlanner::CopySettings(const MPC &source) {
+  reference = source.reference;
+  mpc.CopySettings(source);
+  mpc.SetHorizon(LONG_N, LONG_DT);
+}
+
+void LongHorizonPlanner::SetTrack(const TrackMap *track) {
+  reference.track = track;
+}
+
+void LongHorizonPlanner::Start() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (running) return;
+  running = true;
+  thread = std::thread(&LongHorizonPlanner::Run, this);
+}
+
+void LongHorizonPlanner::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!running) return;
+    running = false;
+  }
+  condition.notify_one();
+  thread.join();
+}
+
+void LongHorizonPlanner::Submit(
+  const std::vector<double> &ptsx_vector,
+  const std::vector<double> &ptsy_vector,
+  double px, double py, double psi, double speed_mph)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    telemetry.ptsx = ptsx_vector;
+    telemetry.ptsy = ptsy_vector;
+    telemetry.px = px;
+    telemetry.py = py;
+    telemetry.psi = psi;
+    telemetry.speed_mph = speed_mph;
+    has_telemetry = true;
+  }
+  condition.notify_one();
+}
+
+bool LongHorizonPlanner::GetWaypoints(
+  std::vector<double> &ptsx, std::vector<double> &ptsy)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (plan_x.empty()) return false;
+  ptsx = plan_x;
+  ptsy = plan_y;
+  return true;
+}
+
+void LongHorizonPlanner::Run() {
+  RegisterSolverThread();
+
+  auto period_duration = std::chrono::duration_cast<
+    std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(period));
+  auto next_plan = std::chrono::steady_clock::now();
+
+  std::unique_lock<std::mutex> lock(mutex);
+  while (running) {
+    condition.wait(lock, [this] {
+      return !running || has_telemetry;
+    });
+    if (!running) break;
+
+    // Don't plan more often than once per period; keep collecting the latest
+    // telemetry in the meantime.
+    if (std::chrono::steady_clock::now() < next_plan) {
+      condition.wait_until(lock, next_plan, [this] { return !running; });
+      continue;
+    }
+    next_plan = std::chrono::steady_clock::now() + period_duration;
+
+    Telemetry input = telemetry;
+    has_telemetry = false;
+
+    lock.unlock();
+    Plan(input);
+    lock.lock();
+  }
+
+  UnregisterSolverThread();
+}
+
+void LongHorizonPlanner::Plan(const Telemetry &input) {
+  reference.Update(input.ptsx, input.ptsy, input.px, input.py, input.psi);
+
+  // Plan from the current state; the tracker compensates for latency.
+  double speed = input.speed_mph * MPH_TO_METERS_PER_SECOND;
+  mpc.Solve(0, 0, 0, speed);
+
+  // Transform the start of the plan back into world coordinates.
+  std::vector<double> xs = mpc.x_values();
+  std::vector<double> ys = mpc.y_values();
+  size_t count = std::min(xs.size(),
+    (size_t)std::floor(tracking_time / problem.dt) + 1);
+  std::vector<double> world_x(count);
+  std::vector<double> world_y(count);
+  double cos_psi = cos(input.psi);
+  double sin_psi = sin(input.psi);
+  for (size_t i = 0; i < count; ++i) {
+    world_x[i] = input.px + xs[i] * cos_psi - ys[i] * sin_psi;
+    world_y[i] = input.py + xs[i] * sin_psi + ys[i] * cos_psi;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  plan_x.swap(world_x);
+  plan_y.swap(world_y);
+}
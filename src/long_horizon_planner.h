@@ -0,0 +1,108 @@
+#ifndef LONG_HORIZON_PLANNER_H
+#define LONG_HORIZON_PLANNER_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "MPC.h"
+#include "problem.h"
+#include "reference_polynomial.h"
+
+/**
+ * Plan a long way ahead (several seconds) at a low rate on a background
+ * thread.
+ *
+ * The MPC that runs on every telemetry message can then use a short, cheap
+ * horizon to track the long plan, rather than the waypoints. The long plan is
+ * handed over as a set of waypoints in world coordinates, so the tracker's
+ * ReferencePolynomial fades between successive plans just as it does between
+ * successive sets of waypoints from the simulator.
+ */
+class LongHorizonPlanner {
+public:
+  LongHorizonPlanner();
+
+  virtual ~LongHorizonPlanner();
+
+  // Minimum time between plans, in seconds.
+  double period;
+
+  // How far ahead of the plan's start to hand over to the tracker, in
+  // seconds. The tracker fits a cubic to these points, so this should not be
+  // too much longer than the tracker's own horizon.
+  double tracking_time;
+
+  // Number of time steps for the tracking MPC.
+  size_t tracking_n;
+
+  /**
+   * Copy the controller settings (reference model, problem weights, solver
+   * options and so on) from the given MPC to the planner's MPC, keeping the
+   * long horizon. Call this before SetTrack and Start.
+   */
+  void CopySettings(const MPC &source);
+
+  /**
+   * Plan along a map of the track rather than the telemetry waypoints. Call
+   * this before Start.
+   */
+  void SetTrack(const TrackMap *track);
+
+  /**
+   * Start the background thread.
+   */
+  void Start();
+
+  /**
+   * Stop the background thread and wait for it to finish.
+   */
+  void Stop();
+
+  /**
+   * Hand the latest telemetry to the planner. The planner only ever plans
+   * from the latest telemetry it has received.
+   */
+  void Submit(
+    const std::vector<double> &ptsx_vector,
+    const std::vector<double> &ptsy_vector,
+    double px, double py, double psi, double speed_mph);
+
+  /**
+   * Get the start of the latest plan, in world coordinates, as waypoints for
+   * the tracker. Returns false if there is no plan yet.
+   */
+  bool GetWaypoints(std::vector<double> &ptsx, std::vector<double> &ptsy);
+
+private:
+  struct Telemetry {
+    std::vector<double> ptsx;
+    std::vector<double> ptsy;
+    double px;
+    double py;
+    double psi;
+    double speed_mph;
+  };
+
+  ReferencePolynomial reference;
+  Problem problem;
+  MPC mpc;
+
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable condition;
+
+  // The following are protected by the mutex.
+  bool running;
+  bool has_telemetry;
+  Telemetry telemetry;
+  std::vector<double> plan_x;
+  std::vector<double> plan_y;
+
+  void Run();
+
+  void Plan(const Telemetry &input);
+};
+
+#endif /* LONG_HORIZON_PLANNER_H */
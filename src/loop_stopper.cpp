@@ -0,0 +1,29 @@
+#include "loop_stopper.h"
+
+LoopStopper::LoopStopper() : stopped(false) { }
+
+LoopStopper::~LoopStopper() { }
+
+void LoopStopper::Add(uv_loop_t *loop, StopFunction stop) {
+  Handle *handle = new Handle;
+  handle->stop = stop;
+  uv_async_init(loop, &handle->async, OnAsync);
+  handle->async.data = handle;
+  uv_unref((uv_handle_t *)&handle->async);
+  handles.push_back(handle);
+}
+
+void LoopStopper::Stop() {
+  if (stopped.exchange(true)) return;
+  for (size_t i = 0; i < handles.size(); ++i) {
+    uv_async_send(&handles[i]->async);
+  }
+}
+
+void LoopStopper::OnAsync(uv_async_t *async) {
+  Handle *handle = (Handle *)async->data;
+  handle->stop();
+  uv_close((uv_handle_t *)async, [](uv_handle_t *closed) {
+    delete (Handle *)closed->data;
+  });
+}
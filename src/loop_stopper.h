@@ -0,0 +1,58 @@
+#ifndef LOOP_STOPPER_H
+#define LOOP_STOPPER_H
+
+#include <atomic>
+#include <functional>
+#include <uv.h>
+#include <vector>
+
+/**
+ * Stops serving on several libuv loops from any thread, e.g. a worker hub's
+ * thread when the last session ends, or the daemon's control channel thread
+ * when stdin closes.
+ *
+ * Each loop gets a uv_async_t that runs its stop function on the loop's own
+ * thread, e.g. to close a hub's group, which stops listening and closes its
+ * sockets. The loop then runs until the sessions that were open have ended,
+ * and returns once it has nothing left to do. The handles don't keep the
+ * loops running by themselves.
+ */
+class LoopStopper {
+public:
+  typedef std::function<void()> StopFunction;
+
+  LoopStopper();
+
+  virtual ~LoopStopper();
+
+  /**
+   * Call the given function on the given loop's thread when stopping. Call
+   * this on that thread (or before the loop runs), and before Stop.
+   */
+  void Add(uv_loop_t *loop, StopFunction stop);
+
+  /**
+   * Stop each of the loops, from any thread. Only the first call does
+   * anything.
+   */
+  void Stop();
+
+  // Has Stop been called?
+  bool stopping() const { return stopped; }
+
+private:
+  // Heap allocated, because libuv may still use it for a loop iteration
+  // after we close it.
+  struct Handle {
+    uv_async_t async;
+    StopFunction stop;
+  };
+
+  std::vector<Handle *> handles;
+
+  std::atomic<bool> stopped;
+
+  static void OnAsync(uv_async_t *async);
+};
+
+#endif /* LOOP_STOPPER_H */
@@ -1,35 +1,30 @@
 #include <uWS/uWS.h>
-#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
 #include <sysexits.h>
 #include <thread>
+#include <utility>
 #include <vector>
 #include "MPC.h"
-#include "json.hpp"
-
-// for convenience
-using json = nlohmann::json;
-
-// Use this code when closing the socket after we detect that the car has
-// crashed; this lets the server know that it was closed intentionally, rather
-// than due to a network / simulator crashing problem.
-const int CAR_CRASHED_CODE = 2000;
-const int MAX_RUNTIME_CODE = 2001;
-
-// Checks if the SocketIO event has JSON data.
-// If there is data the JSON object in string format will be returned,
-// else the empty string "" will be returned.
-string hasData(string s) {
-  auto found_null = s.find("null");
-  auto b1 = s.find_first_of("[");
-  auto b2 = s.rfind("}]");
-  if (found_null != string::npos) {
-    return "";
-  } else if (b1 != string::npos && b2 != string::npos) {
-    return s.substr(b1, b2 - b1 + 2);
-  }
-  return "";
-}
+#include "loop_stopper.h"
+#include "session.h"
+#include "shm_server.h"
+#include "solver_threads.h"
+#include "tool_support.h"
+#include "track_map.h"
+
+// Close code for connections beyond --max-sessions ("try again later").
+const int SERVER_BUSY_CODE = 1013;
 
 std::ostream &operator<<(std::ostream &os, const std::vector<double> v) {
   for (auto it = v.begin(); it != v.end(); ++it) {
@@ -38,130 +33,415 @@ std::ostream &operator<<(std::ostream &os, const std::vector<double> v) {
   return os;
 }
 
+// Set the tuning parameters from the positional arguments, if there are the
+// right number of them: max runtime, dt, reference speed and the weights.
+bool ApplyTuningArguments(const std::vector<std::string> &arguments,
+  SessionSettings &settings)
+{
+  if (arguments.size() != 10) return false;
+  Problem &problem = settings.problem;
+  MPC &mpc = settings.mpc;
+  mpc.tuning = true;
+  settings.max_runtime = atof(arguments[0].c_str());
+  mpc.SetHorizon(problem.n, atof(arguments[1].c_str()));
+  problem.ref_v = atof(arguments[2].c_str());
+  problem.cte_weight = atof(arguments[3].c_str());
+  problem.epsi_weight = atof(arguments[4].c_str());
+  problem.v_weight = atof(arguments[5].c_str());
+  problem.delta_weight = atof(arguments[6].c_str());
+  problem.throttle_weight = atof(arguments[7].c_str());
+  problem.delta_gap_weight = atof(arguments[8].c_str());
+  problem.throttle_gap_weight = atof(arguments[9].c_str());
+  return true;
+}
+
+// Keeps the daemon's lines of JSON on stdout from interleaving.
+std::mutex daemon_output_mutex;
+
+// The daemon's control channel: read tuning parameters for the following
+// sessions from stdin, one set per line, in the same order as on the command
+// line, and acknowledge each line once the parameters are in place, so that
+// the caller knows when it can start the simulator. Stop serving when stdin
+// closes, e.g. because the tuning script has exited.
+void ReadControlChannel(SessionSettings &settings, LoopStopper &stopper) {
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    std::istringstream words(line);
+    std::vector<std::string> arguments;
+    std::string word;
+    while (words >> word) arguments.push_back(word);
+    if (arguments.empty()) continue;
+
+    bool applied;
+    {
+      std::lock_guard<std::mutex> lock(settings.mutex);
+      applied = ApplyTuningArguments(arguments, settings);
+    }
+    if (!applied) {
+      std::cerr << "Expected 10 tuning parameters: " << line << std::endl;
+    }
+
+    std::lock_guard<std::mutex> lock(daemon_output_mutex);
+    std::cout << "{\"configured\":" << (applied ? "true" : "false") << "}" <<
+      std::endl;
+  }
+  stopper.Stop();
+}
+
+// What the hubs' threads share about the sessions.
+struct Sessions {
+  Sessions() : count(0), status(EX_OK) { }
+
+  // Number of sessions in progress.
+  std::atomic<size_t> count;
+
+  // The exit status: that of the first session to fail, if any.
+  std::atomic<int> status;
+
+  // Stops the hubs once we are done serving.
+  LoopStopper stopper;
+};
+
+// Write the results of a session as a line of JSON, for the daemon.
+void ReportSession(const Session &session, int code) {
+  const char *result = "disconnected";
+  if (code == CAR_CRASHED_CODE) result = "crashed";
+  if (code == MAX_RUNTIME_CODE) result = "finished";
+
+  std::ostringstream line;
+  line << "{\"session\":" << session.id() << ", \"result\":\"" << result <<
+    "\", \"stats\":" << session.controller() << "}" << std::endl;
+
+  std::lock_guard<std::mutex> lock(daemon_output_mutex);
+  std::cout << line.str() << std::flush;
+}
+
+// Create a session for a newly connected simulator, on the thread that runs
+// the given event loop.
+Session *StartSession(std::unique_ptr<SessionLink> link, uv_loop_t *loop,
+  const SessionSettings &settings)
+{
+  static std::atomic<size_t> next_id(1);
+  return new Session(settings, next_id++, loop, std::move(link));
+}
+
+void StartSession(uWS::WebSocket<uWS::SERVER> ws, uv_loop_t *loop,
+  const SessionSettings &settings)
+{
+  ws.setUserData(StartSession(
+    std::unique_ptr<SessionLink>(new WebSocketLink(ws)), loop, settings));
+}
+
+// The exit status for a session that ended with the given close code.
+int SessionStatus(int code, const std::string &message) {
+  switch (code) {
+    case CAR_CRASHED_CODE:
+      // The car crashed; let the caller know.
+      return 1;
+    case MAX_RUNTIME_CODE:
+      // The simulator ran until our deadline; that's a success.
+      return EX_OK;
+    default:
+      // If the simulator exits, we seem to get code 1006 or 0.
+      std::cerr << "Disconnected: code=" << code << ":" << message <<
+        std::endl;
+      return EX_UNAVAILABLE;
+  }
+}
+
+// End a session whose simulator has disconnected with the given code, and
+// delete it once its solver threads have stopped.
+void EndSession(Session *session, int code, const std::string &message,
+  const SessionSettings &settings, Sessions &sessions)
+{
+  session->OnDisconnection([=, &settings, &sessions]() {
+    session->ReportStats();
+    if (settings.daemon) ReportSession(*session, code);
+    delete session;
+
+    // The daemon keeps serving until its control channel closes. Otherwise,
+    // the first session to fail sets the exit status, and we stop serving
+    // once the last session has ended.
+    if (!settings.daemon) {
+      int status = SessionStatus(code, message);
+      int ok = EX_OK;
+      if (status != EX_OK) {
+        sessions.status.compare_exchange_strong(ok, status);
+      }
+    }
+    if (--sessions.count == 0 && !settings.daemon) sessions.stopper.Stop();
+  });
+}
+
+// Pass messages from the group's sockets to their sessions, and end each
+// session when its socket disconnects.
+void ServeSessions(uWS::Group<uWS::SERVER> &group,
+  const SessionSettings &settings, Sessions &sessions)
+{
+  group.onMessage([](uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length, uWS::OpCode opCode) {
+    Session *session = (Session *)ws.getUserData();
+    if (!session) return;
+    if (opCode == uWS::OpCode::BINARY) {
+      session->OnBinaryMessage(data, length);
+    } else {
+      session->OnMessage(data, length);
+    }
+  });
+
+  group.onDisconnection([&settings, &sessions](uWS::WebSocket<uWS::SERVER> ws, int code, char *message, size_t length) {
+    // Sockets that we turned away have no session.
+    Session *session = (Session *)ws.getUserData();
+    if (!session) return;
+    ws.setUserData(nullptr);
+    EndSession(session, code, std::string(message, length), settings,
+      sessions);
+  });
+}
+
 int main(int argc, char **argv) {
   uWS::Hub h;
 
-  ReferencePolynomial reference;
-  Problem problem(reference);
-  MPC mpc(reference, problem);
-
-  double max_runtime = 24 * 3600;
-
-  if (argc == 11) {
-    mpc.tuning = true;
-    max_runtime = atof(argv[1]);
-    problem.dt = atof(argv[2]);
-    problem.ref_v = atof(argv[3]);
-    problem.cte_weight = atof(argv[4]);
-    problem.epsi_weight = atof(argv[5]);
-    problem.v_weight = atof(argv[6]);
-    problem.delta_weight = atof(argv[7]);
-    problem.throttle_weight = atof(argv[8]);
-    problem.delta_gap_weight = atof(argv[9]);
-    problem.throttle_gap_weight = atof(argv[10]);
-  }
-
-  h.onMessage([&mpc, max_runtime](uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length, uWS::OpCode opCode) {
-    // "42" at the start of the message means there's a websocket message event.
-    // The 4 signifies a websocket message
-    // The 2 signifies a websocket event
-    string sdata = string(data).substr(0, length);
-    // cout << sdata << endl;
-    if (sdata.size() > 2 && sdata[0] == '4' && sdata[1] == '2') {
-      string s = hasData(sdata);
-      if (s != "") {
-        auto j = json::parse(s);
-        string event = j[0].get<string>();
-        if (event == "telemetry") {
-          // j[1] is the data JSON object
-          mpc.Update(
-            j[1]["ptsx"],
-            j[1]["ptsy"],
-            j[1]["x"],
-            j[1]["y"],
-            j[1]["psi"],
-            j[1]["speed"],
-            j[1]["steering_angle"],
-            j[1]["throttle"]
-          );
-
-          if (mpc.tuning && mpc.crashed) {
-            std::cout << mpc << std::endl;
-            ws.close(CAR_CRASHED_CODE);
-            return;
-          }
-
-          // If we've run all the way to the deadline, stop.
-          if (mpc.tuning && mpc.runtime > max_runtime) {
-            std::cout << mpc << std::endl;
-            ws.close(MAX_RUNTIME_CODE);
-            return;
-          }
-
-          // std::cout << "x =" << mpc.x_values() << std::endl;
-          // std::cout << "y =" << mpc.y_values() << std::endl;
-          // std::cout << "psi =" << mpc.psi_values() << std::endl;
-          // std::cout << "v =" << mpc.v_values() << std::endl;
-
-          // std::cout << "cte =" << mpc.cte_values() << std::endl;
-          // std::cout << "epsi =" << mpc.epsi_values() << std::endl;
-
-          // std::cout << "delta =" << mpc.delta_values() << std::endl;
-          // std::cout << "throttle =" << mpc.throttle_values() << std::endl;
-
-          /*
-          * Calculate steeering angle and throttle using MPC.
-          *
-          * Both are in between [-1, 1].
-          */
-          // steer right: angle positive
-          // steer left: angle negative
-          json msgJson;
-          msgJson["steering_angle"] = mpc.steer();
-          msgJson["throttle"] = mpc.throttle();
-
-          // Display the MPC predicted trajectory.
-          // The points are in reference to the vehicle's coordinate system.
-          // The points in the simulator are connected by a Green line.
-          msgJson["mpc_x"] = mpc.x_values();
-          msgJson["mpc_y"] = mpc.y_values();
-
-          //Display the waypoints/reference line
-          vector<double> next_x_vals;
-          vector<double> next_y_vals;
-
-          //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
-          // the points in the simulator are connected by a Yellow line
-          for (size_t i = 0; i < mpc.reference.vehicle_ptsx.size(); ++i) {
-            next_x_vals.push_back(mpc.reference.vehicle_ptsx(i));
-            next_y_vals.push_back(
-              mpc.reference.Evaluate(mpc.reference.vehicle_ptsx(i)));
-          }
-
-          msgJson["next_x"] = next_x_vals;
-          msgJson["next_y"] = next_y_vals;
-
-          auto msg = "42[\"steer\"," + msgJson.dump() + "]";
-          // std::cout << msg << std::endl;
-          // Latency
-          // The purpose is to mimic real driving conditions where
-          // the car does actuate the commands instantly.
-          //
-          // Feel free to play around with this value but should be to drive
-          // around the track with 100ms latency.
-          //
-          // NOTE: REMEMBER TO SET THIS TO 100 MILLISECONDS BEFORE
-          // SUBMITTING.
-          this_thread::sleep_for(chrono::milliseconds(100));
-          ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
-        }
-      } else {
-        // Manual driving
-        std::string msg = "42[\"manual\",{}]";
-        ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
+  // Each session copies its settings from these.
+  SessionSettings settings;
+  ReferencePolynomial &reference = settings.reference;
+  Problem &problem = settings.problem;
+  MPC &mpc = settings.mpc;
+
+  std::map<std::string, std::string> options;
+  std::vector<std::string> arguments;
+  ParseArguments(argc, argv, options, arguments);
+
+  ApplyTuningArguments(arguments, settings);
+
+  // Choose N and dt on each tick to fit a solve time budget, in seconds.
+  if (options.count("adaptive-horizon")) {
+    mpc.adaptive = true;
+  }
+  if (options.count("solve-budget")) {
+    mpc.adaptive_horizon.solve_budget =
+      atof(options["solve-budget"].c_str());
+  }
+  if (options.count("lookahead")) {
+    mpc.adaptive_horizon.lookahead = atof(options["lookahead"].c_str());
+  }
+
+  // Take the reference from a map of the whole track, e.g.
+  // lake_track_waypoints.csv, rather than the waypoints in the telemetry.
+  TrackMap track;
+  if (options.count("track")) {
+    if (!track.Load(options["track"])) {
+      std::cerr << "Failed to load track from " << options["track"] <<
+        std::endl;
+      return EX_NOINPUT;
+    }
+  }
+
+  // Fit a smoothing spline or a piecewise cubic to the waypoints rather than
+  // a single cubic.
+  if (options.count("spline-reference")) {
+    reference.model = REFERENCE_SPLINE;
+  }
+  if (options.count("piecewise-reference")) {
+    reference.model = REFERENCE_PIECEWISE;
+  }
+
+  // Fall back on a pure pursuit controller during warmup, and when a solve
+  // fails or takes longer than the deadline, in seconds.
+  if (options.count("fallback")) {
+    mpc.use_fallback = true;
+  }
+  if (options.count("solve-deadline")) {
+    mpc.solve_deadline = atof(options["solve-deadline"].c_str());
+  }
+
+  // Limit each solve to this much CPU time, in seconds.
+  if (options.count("max-cpu-time")) {
+    mpc.max_cpu_time = atof(options["max-cpu-time"].c_str());
+  }
+
+  // Use an Ipopt linear solver other than the default (MUMPS). Only say that
+  // it is thread safe if it is, e.g. ma27.
+  if (options.count("linear-solver")) {
+    SetLinearSolver(options["linear-solver"],
+      options.count("thread-safe-linear-solver") > 0);
+  }
+
+  // Plan a long way ahead in the background, and track that plan with a short
+  // horizon on each message.
+  if (options.count("hierarchical")) {
+    settings.hierarchical = true;
+  }
+
+  // If we have a plan to track, the track map is for the planner.
+  if (!track.empty()) {
+    settings.track = &track;
+  }
+
+  // Track the map in Frenet coordinates (arc length, lateral offset and
+  // heading error) rather than following a polynomial. This only applies to
+  // the plain MPC, which must have the map.
+  if (options.count("frenet")) {
+    if (track.empty()) {
+      std::cerr << "--frenet requires --track" << std::endl;
+      return EX_USAGE;
+    }
+    const char *incompatible[] = {
+      "hierarchical", "speculative", "latency-hypotheses"
+    };
+    for (const char *option : incompatible) {
+      if (options.count(option)) {
+        std::cerr << "--frenet does not support --" << option << std::endl;
+        return EX_USAGE;
       }
     }
-  });
+    problem.frenet = true;
+  }
+
+  // Use the actuation delay to solve the next update's problem in the
+  // background, and use that solution as the next initial guess.
+  if (options.count("speculative")) {
+    settings.speculative = true;
+  }
+
+  // Latency
+  // The purpose is to mimic real driving conditions where
+  // the car does actuate the commands instantly.
+  //
+  // Feel free to play around with this value but should be to drive
+  // around the track with 100ms latency.
+  //
+  // NOTE: REMEMBER TO SET THIS TO 100 MILLISECONDS BEFORE
+  // SUBMITTING.
+  if (options.count("latency-ms")) {
+    settings.actuation_delay = atof(options["latency-ms"].c_str()) / 1000;
+  }
+
+  // Run each session on a simulated clock that follows the simulator's own
+  // time, on which the actuation delay takes no real time, so that a
+  // simulator that steps as soon as it has the actuations (e.g.
+  // shm_simulator --fast) runs as fast as we can solve.
+  if (options.count("simulated-clock")) {
+    settings.simulated_clock = true;
+  }
+
+  // Solve for the 10th, 50th and 90th percentiles of the latency in parallel,
+  // and choose between them just before sending. The solves only overlap if
+  // the linear solver is thread safe; otherwise, they take turns.
+  if (options.count("latency-hypotheses")) {
+    settings.latency_quantiles = { 0.1, 0.5, 0.9 };
+    if (!LinearSolverThreadSafe()) {
+      std::cerr << "Warning: --latency-hypotheses solves one hypothesis at a "
+        "time without --thread-safe-linear-solver" << std::endl;
+    }
+  }
+
+  // Pin the solver threads to this CPU.
+  if (options.count("solver-cpu")) {
+    settings.solver_cpu = atoi(options["solver-cpu"].c_str());
+  }
+
+  // Keep serving after each session ends, reporting its results as a line
+  // of JSON on stdout, and read the tuning parameters for later sessions
+  // from stdin, so a tuning script doesn't have to start a process per run.
+  // The control channel starts once the loops are ready to stop.
+  if (options.count("daemon")) {
+    settings.daemon = true;
+  }
+
+  // Record every tick of every session to memory-mapped segment files in
+  // this directory, rotating on SIGHUP or when a segment is full.
+  if (options.count("flight-recorder")) {
+    settings.flight_directory = options["flight-recorder"].empty() ?
+      "flight" : options["flight-recorder"];
+    if (mkdir(settings.flight_directory.c_str(), 0755) != 0 &&
+      errno != EEXIST) {
+      std::cerr << "Failed to create " << settings.flight_directory << ": " <<
+        strerror(errno) << std::endl;
+      return EX_CANTCREAT;
+    }
+  }
+  if (options.count("flight-segment-mb")) {
+    settings.flight_segment_size =
+      (size_t)atoi(options["flight-segment-mb"].c_str()) << 20;
+  }
+  uv_signal_t rotate_signal;
+  if (!settings.flight_directory.empty()) {
+    uv_signal_init(h.getLoop(), &rotate_signal);
+    uv_signal_start(&rotate_signal, [](uv_signal_t *, int) {
+      FlightRecorder::RequestRotation();
+    }, SIGHUP);
+    uv_unref((uv_handle_t *)&rotate_signal);
+  }
+
+  // Serve this many simulators at once, sharing the connections out between
+  // this many worker threads, each with its own event loop. With one worker,
+  // the main thread's event loop serves the sessions itself.
+  size_t workers = 1;
+  if (options.count("workers")) {
+    workers = std::max(1, atoi(options["workers"].c_str()));
+  }
+  size_t max_sessions = workers;
+  if (options.count("max-sessions")) {
+    max_sessions = std::max(1, atoi(options["max-sessions"].c_str()));
+  }
+
+  // Every session's solver threads need their own CppAD thread numbers; the
+  // main thread (number 0) does not solve.
+  SetUpSolverThreads(1 + max_sessions * settings.solver_threads());
+
+  Sessions sessions;
+
+  // Serve a simulator on this host over shared memory with the given name,
+  // rather than over the WebSocket.
+  if (options.count("shm")) {
+    std::string name = options["shm"].empty() ?
+      DEFAULT_SHM_NAME : options["shm"];
+    uv_loop_t *loop = h.getLoop();
+    ShmServer server(loop,
+      [&settings, &sessions, loop](std::unique_ptr<SessionLink> link) {
+        ++sessions.count;
+        return StartSession(std::move(link), loop, settings);
+      },
+      [&settings, &sessions](Session *session, int code) {
+        EndSession(session, code, "", settings, sessions);
+      });
+    if (!server.Listen(name)) return EX_OSERR;
+    if (!mpc.tuning) {
+      std::cout << "Listening on shared memory " << name << std::endl;
+    }
+    sessions.stopper.Add(loop, [&server, &settings, &rotate_signal]() {
+      server.Close();
+      if (!settings.flight_directory.empty()) {
+        uv_close((uv_handle_t *)&rotate_signal, nullptr);
+      }
+    });
+    if (settings.daemon) {
+      std::thread(ReadControlChannel, std::ref(settings),
+        std::ref(sessions.stopper)).detach();
+    }
+    h.run();
+    return sessions.status;
+  }
+
+  std::vector<std::unique_ptr<uWS::Hub>> worker_hubs;
+  if (workers > 1) {
+    for (size_t i = 0; i < workers; ++i) {
+      worker_hubs.emplace_back(new uWS::Hub);
+      uv_loop_t *loop = worker_hubs.back()->getLoop();
+      uWS::Group<uWS::SERVER> &group =
+        worker_hubs.back()->getDefaultGroup<uWS::SERVER>();
+      ServeSessions(group, settings, sessions);
+      sessions.stopper.Add(loop, [&group]() { group.close(); });
+      group.onTransfer([&settings, loop](uWS::WebSocket<uWS::SERVER> ws) {
+        StartSession(ws, loop, settings);
+      });
+
+      // Let the main thread transfer sockets to this group.
+      group.addAsync();
+    }
+  } else {
+    ServeSessions(h.getDefaultGroup<uWS::SERVER>(), settings, sessions);
+  }
 
   // We don't need this since we're not using HTTP but if it's removed the
   // program
@@ -177,26 +457,28 @@ int main(int argc, char **argv) {
     }
   });
 
-  h.onConnection([&h, &mpc](uWS::WebSocket<uWS::SERVER> ws, uWS::HttpRequest req) {
-    if (!mpc.tuning) {
+  size_t next_worker = 0;
+  h.onConnection([&h, &settings, &sessions, &worker_hubs, &next_worker, max_sessions](uWS::WebSocket<uWS::SERVER> ws, uWS::HttpRequest req) {
+    if (sessions.count >= max_sessions) {
+      std::cerr << "Turned away a connection: all " << max_sessions <<
+        " sessions are in use" << std::endl;
+      ws.close(SERVER_BUSY_CODE);
+      return;
+    }
+    ++sessions.count;
+
+    std::unique_lock<std::mutex> lock(settings.mutex);
+    if (!settings.mpc.tuning) {
       std::cout << "Connected!!!" << std::endl;
     }
-    mpc.Reset();
-  });
+    lock.unlock();
 
-  h.onDisconnection([](uWS::WebSocket<uWS::SERVER> ws, int code, char *message, size_t length) {
-    switch (code) {
-      case CAR_CRASHED_CODE:
-        // The car crashed; let the caller know.
-        exit(1);
-      case MAX_RUNTIME_CODE:
-        // The simulator ran until our deadline; that's a success.
-        exit(EX_OK);
-      default:
-        // If the simulator exits, we seem to get code 1006 or 0.
-        std::cerr << "Disconnected: code=" << code << ":" <<
-          std::string(message, length) << std::endl;
-        exit(EX_UNAVAILABLE);
+    if (worker_hubs.empty()) {
+      StartSession(ws, h.getLoop(), settings);
+    } else {
+      // The worker starts the session when the socket arrives.
+      uWS::Hub &worker = *worker_hubs[next_worker++ % worker_hubs.size()];
+      ws.transfer(&worker.getDefaultGroup<uWS::SERVER>());
     }
   });
 
@@ -209,5 +491,31 @@ int main(int argc, char **argv) {
     std::cerr << "Failed to listen to port" << std::endl;
     return -1;
   }
+
+  // Closing the main hub's group stops listening, and closes the sessions'
+  // sockets if it serves them itself.
+  sessions.stopper.Add(h.getLoop(), [&h, &settings, &rotate_signal]() {
+    h.getDefaultGroup<uWS::SERVER>().close();
+    if (!settings.flight_directory.empty()) {
+      uv_close((uv_handle_t *)&rotate_signal, nullptr);
+    }
+  });
+
+  if (settings.daemon) {
+    std::thread(ReadControlChannel, std::ref(settings),
+      std::ref(sessions.stopper)).detach();
+  }
+
+  std::vector<std::thread> worker_threads;
+  for (size_t i = 0; i < worker_hubs.size(); ++i) {
+    uWS::Hub *worker = worker_hubs[i].get();
+    worker_threads.emplace_back([worker]() { worker->run(); });
+  }
   h.run();
+
+  // Each hub's run returns once it has stopped and its sessions have ended.
+  for (size_t i = 0; i < worker_threads.size(); ++i) {
+    worker_threads[i].join();
+  }
+  return sessions.status;
 }
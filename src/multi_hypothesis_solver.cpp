@@ -0,0 +1,162 @@
+#include "multi_hypothesis_solver.h"
+
+#include <cmath>
+
+#include "solver_threads.h"
+
+// Smoothing factor for the exponential moving average of the downstream
+// latency.
+const double DOWNSTREAM_SMOOTH = 0.1;
+
+MultiHypothesisSolver::Hypothesis::Hypothesis(
+  ReferencePolynomial &reference, double quantile) :
+  quantile(quantile),
+  problem(reference),
+  mpc(reference, problem),
+  ok(false)
+{ }
+
+MultiHypothesisSolver::MultiHypothesisSolver(ReferencePolynomial &reference,
+  const std::vector<double> &quantiles) :
+  downstream_latency(0),
+  running(false),
+  generation(0),
+  finished(0),
+  px(0),
+  py(0),
+  psi(0),
+  speed_mph(0),
+  delta(0),
+  throttle(0),
+  chosen_elapsed(-1)
+{
+  for (size_t i = 0; i < quantiles.size(); ++i) {
+    hypotheses.push_back(std::unique_ptr<Hypothesis>(
+      new Hypothesis(reference, quantiles[i])));
+  }
+}
+
+MultiHypothesisSolver::~MultiHypothesisSolver() {
+  Stop();
+}
+
+void MultiHypothesisSolver::Start() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (running) return;
+  running = true;
+  for (size_t i = 0; i < hypotheses.size(); ++i) {
+    Hypothesis *hypothesis = hypotheses[i].get();
+    hypothesis->thread = std::thread(
+      &MultiHypothesisSolver::Run, this, hypothesis);
+  }
+}
+
+void MultiHypothesisSolver::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!running) return;
+    running = false;
+  }
+  condition.notify_all();
+  for (size_t i = 0; i < hypotheses.size(); ++i) {
+    hypotheses[i]->thread.join();
+  }
+}
+
+size_t MultiHypothesisSolver::size() const {
+  return hypotheses.size();
+}
+
+void MultiHypothesisSolver::CopySettings(const MPC &source) {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (size_t i = 0; i < hypotheses.size(); ++i) {
+    hypotheses[i]->mpc.CopySettings(source);
+  }
+}
+
+void MultiHypothesisSolver::Solve(const MPC &source, double px, double py,
+  double psi, double speed_mph, double delta, double throttle)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+
+  // The time from telemetry to telemetry that we just observed is the time
+  // we took to send the previous actuations plus the downstream latency.
+  if (chosen_elapsed >= 0) {
+    double downstream = source.latest_latency - chosen_elapsed;
+    downstream_latency = downstream * DOWNSTREAM_SMOOTH +
+      downstream_latency * (1 - DOWNSTREAM_SMOOTH);
+    chosen_elapsed = -1;
+  }
+
+  // Each hypothesis compensates for its own latency, but shares the source's
+  // timing for the warmup. The source's reference stays put until we return,
+  // so the hypotheses read it in place rather than from a copy.
+  for (size_t i = 0; i < hypotheses.size(); ++i) {
+    MPC &mpc = hypotheses[i]->mpc;
+    mpc.latency = source.LatencyQuantile(hypotheses[i]->quantile);
+    mpc.latest_latency = source.latest_latency;
+    mpc.t_init = source.t_init;
+    mpc.t = source.t;
+  }
+  this->px = px;
+  this->py = py;
+  this->psi = psi;
+  this->speed_mph = speed_mph;
+  this->delta = delta;
+  this->throttle = throttle;
+
+  finished = 0;
+  ++generation;
+  condition.notify_all();
+  condition.wait(lock, [this] { return finished == hypotheses.size(); });
+
+  if (!source.tuning) {
+    for (size_t i = 0; i < hypotheses.size(); ++i) {
+      hypotheses[i]->mpc.Trace(hypotheses[i]->ok);
+    }
+  }
+}
+
+const MPC &MultiHypothesisSolver::Choose(double elapsed) {
+  std::lock_guard<std::mutex> lock(mutex);
+  chosen_elapsed = elapsed;
+
+  double predicted = elapsed + downstream_latency;
+  size_t best = 0;
+  for (size_t i = 1; i < hypotheses.size(); ++i) {
+    if (fabs(hypotheses[i]->mpc.latency - predicted) <
+      fabs(hypotheses[best]->mpc.latency - predicted)) {
+      best = i;
+    }
+  }
+  return hypotheses[best]->mpc;
+}
+
+void MultiHypothesisSolver::Run(Hypothesis *hypothesis) {
+  RegisterSolverThread();
+
+  std::unique_lock<std::mutex> lock(mutex);
+  size_t solved_generation = generation;
+  while (running) {
+    condition.wait(lock, [this, solved_generation] {
+      return !running || generation != solved_generation;
+    });
+    if (!running) break;
+    solved_generation = generation;
+
+    // Solve doesn't change the inputs until all the hypotheses have
+    // finished, so we can read them without the lock.
+    lock.unlock();
+    MPC &mpc = hypothesis->mpc;
+    bool ok = mpc.Control(mpc.latency, px, py, psi, speed_mph, delta,
+      throttle);
+    lock.lock();
+
+    hypothesis->ok = ok;
+
+    ++finished;
+    condition.notify_all();
+  }
+
+  UnregisterSolverThread();
+}
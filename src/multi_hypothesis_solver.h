@@ -0,0 +1,110 @@
+#ifndef MULTI_HYPOTHESIS_SOLVER_H
+#define MULTI_HYPOTHESIS_SOLVER_H
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "MPC.h"
+#include "problem.h"
+#include "reference_polynomial.h"
+
+/**
+ * Solve for several hypotheses about the latency in parallel, and choose
+ * between the plans as late as possible.
+ *
+ * The hypotheses are quantiles of the recently observed latencies. Just
+ * before sending the actuations, we know how long we have taken since the
+ * telemetry arrived, so we can choose the plan whose latency best matches
+ * that elapsed time plus our estimate of the time it takes the actuations to
+ * reach the car after we send them.
+ */
+class MultiHypothesisSolver {
+public:
+  /**
+   * One hypothesis (and worker thread) per quantile of the latency. The
+   * hypotheses solve against the given reference, which must be the one
+   * that the MPC passed to Solve observes.
+   */
+  MultiHypothesisSolver(ReferencePolynomial &reference,
+    const std::vector<double> &quantiles);
+
+  virtual ~MultiHypothesisSolver();
+
+  /**
+   * Start the worker threads.
+   */
+  void Start();
+
+  /**
+   * Stop the worker threads and wait for them to finish.
+   */
+  void Stop();
+
+  /**
+   * Number of worker threads that Start will create.
+   */
+  size_t size() const;
+
+  /**
+   * Copy the controller settings (fallback, adaptive horizon, problem and so
+   * on) from the given MPC to each hypothesis. Call this before Start.
+   */
+  void CopySettings(const MPC &source);
+
+  /**
+   * Update each hypothesis from the given MPC's latencies, solve them against
+   * the shared reference, and wait for them all to finish. Each goes through the same horizon and
+   * fallback decisions as MPC::Update. Call this after MPC::Observe.
+   */
+  void Solve(const MPC &source, double px, double py, double psi,
+    double speed_mph, double delta, double throttle);
+
+  /**
+   * Choose the plan for the hypothesis that best matches the given time
+   * since the telemetry arrived, in seconds.
+   */
+  const MPC &Choose(double elapsed);
+
+  // Estimate of the time from sending the actuations to the arrival of the
+  // next telemetry, in seconds.
+  double downstream_latency;
+
+private:
+  struct Hypothesis {
+    Hypothesis(ReferencePolynomial &reference, double quantile);
+
+    double quantile;
+    Problem problem;
+    MPC mpc;
+    std::thread thread;
+
+    // Did the latest solve succeed?
+    bool ok;
+  };
+
+  std::vector<std::unique_ptr<Hypothesis> > hypotheses;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+
+  // The following are protected by the mutex.
+  bool running;
+  size_t generation;
+  size_t finished;
+  double px;
+  double py;
+  double psi;
+  double speed_mph;
+  double delta;
+  double throttle;
+
+  // The elapsed time passed to the latest Choose, if any.
+  double chosen_elapsed;
+
+  void Run(Hypothesis *hypothesis);
+};
+
+#endif /* MULTI_HYPOTHESIS_SOLVER_H */
@@ -0,0 +1,283 @@
+#include "piecewise_reference.h"
+
+#include <cmath>
+#include "Eigen-3.3/Eigen/Cholesky"
+#include "wrap_angle.h"
+
+// Stop refining the vehicle x coordinate when it is this close, in meters.
+const double X_TOLERANCE = 1e-9;
+const int MAX_NEWTON_ITERATIONS = 5;
+
+// Give up on Newton's method if the reference is this close to vertical in
+// vehicle coordinates.
+const double MIN_DERIVATIVE = 1e-6;
+
+// Cubic Hermite basis functions, and their first and second derivatives, at
+// t in [0, 1], for the start value, start slope, end value and end slope of a
+// segment of the given length.
+static Eigen::Vector4d HermiteBasis(double t, double length) {
+  double t2 = t * t;
+  double t3 = t2 * t;
+  return Eigen::Vector4d(
+    2 * t3 - 3 * t2 + 1,
+    length * (t3 - 2 * t2 + t),
+    -2 * t3 + 3 * t2,
+    length * (t3 - t2));
+}
+
+static Eigen::Vector4d HermiteSlopeBasis(double t, double length) {
+  double t2 = t * t;
+  return Eigen::Vector4d(
+    (6 * t2 - 6 * t) / length,
+    3 * t2 - 4 * t + 1,
+    (-6 * t2 + 6 * t) / length,
+    3 * t2 - 2 * t);
+}
+
+static Eigen::Vector4d HermiteSecondBasis(double t, double length) {
+  return Eigen::Vector4d(
+    (12 * t - 6) / (length * length),
+    (6 * t - 4) / length,
+    (-12 * t + 6) / (length * length),
+    (6 * t - 2) / length);
+}
+
+PiecewiseReference::PiecewiseReference(double segment_length,
+  double smoothing, double max_anchor_angle) :
+  touched_segments(0),
+  segment_length(segment_length),
+  smoothing(smoothing),
+  max_anchor_angle(max_anchor_angle)
+{
+  Clear();
+}
+
+void PiecewiseReference::Clear() {
+  anchored = false;
+  anchor_x = anchor_y = anchor_psi = 0;
+  car_x = car_y = car_psi = 0;
+  segments.clear();
+  known.clear();
+  known_removed = 0;
+  updates = 0;
+  first_segment = 0;
+  knots.resize(0);
+}
+
+PiecewiseReference::Point PiecewiseReference::ToAnchor(
+  double x, double y, double weight) const
+{
+  double dx = x - anchor_x;
+  double dy = y - anchor_y;
+  Point point;
+  point.x = dx * cos(anchor_psi) + dy * sin(anchor_psi);
+  point.y = -dx * sin(anchor_psi) + dy * cos(anchor_psi);
+  point.weight = weight;
+  point.segment = (int)std::floor(point.x / segment_length);
+  return point;
+}
+
+void PiecewiseReference::Accumulate(const Point &point, double weight) {
+  std::map<int, Segment>::iterator it = segments.find(point.segment);
+  if (it == segments.end()) {
+    Segment segment;
+    segment.ata.setZero();
+    segment.aty.setZero();
+    segment.count = 0;
+    segment.touched = 0;
+    it = segments.insert(std::make_pair(point.segment, segment)).first;
+  }
+  Segment &segment = it->second;
+
+  double t = point.x / segment_length - point.segment;
+  Eigen::Vector4d a = HermiteBasis(t, segment_length);
+  segment.ata.noalias() += weight * a * a.transpose();
+  segment.aty.noalias() += (weight * point.y) * a;
+  if (segment.touched != updates) {
+    segment.touched = updates;
+    ++touched_segments;
+  }
+}
+
+void PiecewiseReference::Anchor(const WaypointBuffer &points) {
+  anchored = true;
+  anchor_x = car_x;
+  anchor_y = car_y;
+  anchor_psi = car_psi;
+
+  segments.clear();
+  known.clear();
+  known_removed = points.removed();
+  for (size_t i = 0; i < points.size(); ++i) {
+    known.push_back(ToAnchor(points.x(i), points.y(i), points.weight(i)));
+    Accumulate(known.back(), known.back().weight);
+    ++segments[known.back().segment].count;
+  }
+}
+
+void PiecewiseReference::Update(
+  const WaypointBuffer &points, double px, double py, double psi)
+{
+  car_x = px;
+  car_y = py;
+  car_psi = psi;
+  ++updates;
+  touched_segments = 0;
+
+  if (!anchored || points.removed() < known_removed ||
+    fabs(WrapAngle(psi - anchor_psi)) > max_anchor_angle) {
+    Anchor(points);
+    Solve();
+    return;
+  }
+
+  // Take out the points that have been removed from the buffer.
+  while (known_removed < points.removed() && !known.empty()) {
+    const Point &point = known.front();
+    Accumulate(point, -point.weight);
+    std::map<int, Segment>::iterator it = segments.find(point.segment);
+    if (--it->second.count == 0) segments.erase(it);
+    known.pop_front();
+    ++known_removed;
+  }
+  known_removed = points.removed();
+
+  // Reweight the points we know about, and add the new ones.
+  for (size_t i = 0; i < points.size(); ++i) {
+    if (i < known.size()) {
+      Point &point = known[i];
+      double change = points.weight(i) - point.weight;
+      if (change != 0) {
+        Accumulate(point, change);
+        point.weight = points.weight(i);
+      }
+    } else {
+      Point point = ToAnchor(points.x(i), points.y(i), points.weight(i));
+
+      // If the track has turned back on itself in the anchor frame, start
+      // again from the car's pose.
+      if (!known.empty() && point.x <= known.back().x) {
+        Anchor(points);
+        break;
+      }
+
+      known.push_back(point);
+      Accumulate(point, point.weight);
+      ++segments[point.segment].count;
+    }
+  }
+
+  Solve();
+}
+
+void PiecewiseReference::Solve() {
+  if (segments.empty()) {
+    knots.resize(0);
+    return;
+  }
+
+  // One value and one slope at each end of each segment, including any empty
+  // segments between the first and last ones.
+  first_segment = segments.begin()->first;
+  int num_segments = segments.rbegin()->first - first_segment + 1;
+  int size = 2 * (num_segments + 1);
+  Eigen::MatrixXd ata = Eigen::MatrixXd::Zero(size, size);
+  Eigen::VectorXd aty = Eigen::VectorXd::Zero(size);
+
+  double total_weight = 0;
+  for (std::deque<Point>::const_iterator it = known.begin();
+    it != known.end(); ++it) {
+    total_weight += it->weight;
+  }
+
+  // Bending energy, the integral of the squared second derivative, over
+  // each segment.
+  double l = segment_length;
+  Eigen::Matrix4d bending;
+  bending <<
+    12, 6 * l, -12, 6 * l,
+    6 * l, 4 * l * l, -6 * l, 2 * l * l,
+    -12, -6 * l, 12, -6 * l,
+    6 * l, 2 * l * l, -6 * l, 4 * l * l;
+  bending *= smoothing * total_weight / (l * l * l);
+  for (int k = 0; k < num_segments; ++k) {
+    ata.block<4, 4>(2 * k, 2 * k) += bending;
+  }
+
+  for (std::map<int, Segment>::const_iterator it = segments.begin();
+    it != segments.end(); ++it) {
+    int offset = 2 * (it->first - first_segment);
+    ata.block<4, 4>(offset, offset) += it->second.ata;
+    aty.segment<4>(offset) += it->second.aty;
+  }
+
+  knots = ata.ldlt().solve(aty);
+}
+
+void PiecewiseReference::EvaluateAnchor(
+  double x, double &value, double &slope, double &second) const
+{
+  if (knots.size() == 0) {
+    value = slope = second = 0;
+    return;
+  }
+
+  // Extend the ends along their tangents.
+  int num_segments = knots.size() / 2 - 1;
+  double start = first_segment * segment_length;
+  double end = start + num_segments * segment_length;
+  if (x < start || x > end) {
+    int k = x < start ? 0 : num_segments;
+    double x0 = x < start ? start : end;
+    slope = knots(2 * k + 1);
+    value = knots(2 * k) + slope * (x - x0);
+    second = 0;
+    return;
+  }
+
+  int k = std::min((int)std::floor((x - start) / segment_length),
+    num_segments - 1);
+  double t = (x - start) / segment_length - k;
+  Eigen::Vector4d coefficients = knots.segment<4>(2 * k);
+  value = HermiteBasis(t, segment_length).dot(coefficients);
+  slope = HermiteSlopeBasis(t, segment_length).dot(coefficients);
+  second = HermiteSecondBasis(t, segment_length).dot(coefficients);
+}
+
+void PiecewiseReference::Evaluate(
+  double x, double &value, double &slope, double &second) const
+{
+  // Rotation from the anchor frame to the vehicle frame, and the anchor's
+  // position in the vehicle frame.
+  double theta = anchor_psi - car_psi;
+  double cos_theta = cos(theta);
+  double sin_theta = sin(theta);
+  double dx = anchor_x - car_x;
+  double dy = anchor_y - car_y;
+  double origin_x = dx * cos(car_psi) + dy * sin(car_psi);
+  double origin_y = -dx * sin(car_psi) + dy * cos(car_psi);
+
+  // Find the anchor x whose point on the reference has the given vehicle x
+  // with Newton's method, starting from the point on the vehicle's x axis.
+  double anchor = (x - origin_x) * cos_theta + (0 - origin_y) * sin_theta;
+  double anchor_value, anchor_slope, anchor_second;
+  for (int i = 0; i < MAX_NEWTON_ITERATIONS; ++i) {
+    EvaluateAnchor(anchor, anchor_value, anchor_slope, anchor_second);
+    double error =
+      origin_x + anchor * cos_theta - anchor_value * sin_theta - x;
+    double derivative = cos_theta - anchor_slope * sin_theta;
+    if (fabs(error) < X_TOLERANCE || fabs(derivative) < MIN_DERIVATIVE) break;
+    anchor -= error / derivative;
+  }
+  EvaluateAnchor(anchor, anchor_value, anchor_slope, anchor_second);
+
+  // Rotate the point and tangent into the vehicle frame; the curvature does
+  // not change.
+  value = origin_y + anchor * sin_theta + anchor_value * cos_theta;
+  double tangent_x = cos_theta - anchor_slope * sin_theta;
+  double tangent_y = sin_theta + anchor_slope * cos_theta;
+  slope = tangent_y / tangent_x;
+  double curvature = anchor_second /
+    pow(1 + anchor_slope * anchor_slope, 1.5);
+  second = curvature * pow(1 + slope * slope, 1.5);
+}
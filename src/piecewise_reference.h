@@ -0,0 +1,128 @@
+#ifndef PIECEWISE_REFERENCE_H
+#define PIECEWISE_REFERENCE_H
+
+#include <deque>
+#include <map>
+#include "Eigen-3.3/Eigen/Core"
+#include "waypoint_buffer.h"
+
+/**
+ * A piecewise cubic reference with continuous value and slope, fitted to the
+ * weighted waypoints by least squares, with a small penalty on bending.
+ *
+ * Each piece is a cubic Hermite segment, parameterized by the value and slope
+ * at its ends, which are shared with its neighbours. The segments are a fixed
+ * length along the x axis of an "anchor" frame: the car's pose when we last
+ * anchored. The waypoints don't move in the anchor frame as the car moves, so
+ * each segment keeps its own normal equations, and an update only changes the
+ * segments with waypoints that were added, removed or reweighted. Solving
+ * for the values and slopes from the segments' normal equations is then a
+ * small, banded problem. We re-anchor, and refit all segments, when the
+ * car's heading has turned too far from the anchor's.
+ *
+ * Evaluate works in the car's current vehicle coordinates.
+ */
+class PiecewiseReference {
+public:
+  /**
+   * @param segment_length along the anchor frame's x axis, in meters
+   * @param smoothing weight of the bending penalty, relative to the total
+   *        weight of the points
+   * @param max_anchor_angle re-anchor when the car's heading differs from
+   *        the anchor's by more than this, in radians
+   */
+  PiecewiseReference(double segment_length, double smoothing,
+    double max_anchor_angle);
+
+  /**
+   * Forget all points for a new run.
+   */
+  void Clear();
+
+  /**
+   * Update the fit from the known points (in world coordinates), with the
+   * car at the given pose.
+   */
+  void Update(const WaypointBuffer &points, double px, double py, double psi);
+
+  /**
+   * Evaluate the reference and its first and second derivatives at the given
+   * x coordinate, in vehicle coordinates.
+   */
+  void Evaluate(double x, double &value, double &slope, double &second)
+    const;
+
+  // Number of segments whose normal equations changed in the latest update.
+  size_t touched_segments;
+
+  // Number of segments in the latest fit.
+  size_t num_segments() const { return segments.size(); }
+
+private:
+  typedef Eigen::Matrix<double, 4, 4, Eigen::DontAlign> Matrix4;
+  typedef Eigen::Matrix<double, 4, 1, Eigen::DontAlign> Vector4;
+
+  // Normal equations for the value and slope at the start and end of a
+  // segment, from the points in it.
+  struct Segment {
+    Matrix4 ata;
+    Vector4 aty;
+    size_t count;
+    size_t touched;
+  };
+
+  // A known point in the anchor frame, with the weight it was fitted with.
+  struct Point {
+    double x;
+    double y;
+    double weight;
+    int segment;
+  };
+
+  double segment_length;
+  double smoothing;
+  double max_anchor_angle;
+
+  bool anchored;
+  double anchor_x;
+  double anchor_y;
+  double anchor_psi;
+
+  // The car's pose, for converting to vehicle coordinates.
+  double car_x;
+  double car_y;
+  double car_psi;
+
+  // Segments with points in them, by index along the anchor frame's x axis.
+  std::map<int, Segment> segments;
+
+  // The known points, in the same order as in the WaypointBuffer.
+  std::deque<Point> known;
+
+  // Value of WaypointBuffer::removed() for the front of `known`.
+  size_t known_removed;
+
+  // Number of updates, for marking touched segments.
+  size_t updates;
+
+  // Solution: the value and slope at the start of each segment from
+  // first_segment to the end of the last segment.
+  int first_segment;
+  Eigen::VectorXd knots;
+
+  void Anchor(const WaypointBuffer &points);
+
+  Point ToAnchor(double x, double y, double weight) const;
+
+  // Add a point to its segment's normal equations with the given weight,
+  // which is negative to remove it.
+  void Accumulate(const Point &point, double weight);
+
+  void Solve();
+
+  // Evaluate in the anchor frame.
+  void EvaluateAnchor(double x, double &value, double &slope,
+    double &second) const;
+};
+
+#endif /* PIECEWISE_REFERENCE_H */
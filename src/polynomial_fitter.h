@@ -0,0 +1,77 @@
+#ifndef POLYNOMIAL_FITTER_H
+#define POLYNOMIAL_FITTER_H
+
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/Cholesky"
+
+/**
+ * Weighted least squares fit of a polynomial of the given degree, via the
+ * normal equations.
+ *
+ * All of the matrices have fixed sizes, so fitting does not allocate. Points
+ * can only be added: each is a rank-one update of the normal equations,
+ * which costs O(Degree^2). The points move with the car, so a fit starts
+ * from a clear fitter and adds all of its points again. Solving costs
+ * O(Degree^3), which is independent of the number of points.
+ *
+ * Squaring the design matrix squares its condition number, so the x values
+ * are scaled down by `x_scale` internally; it should be about the same size
+ * as the largest x values.
+ */
+template <int Degree>
+class PolynomialFitter {
+public:
+  typedef Eigen::Matrix<double, Degree + 1, 1> Vector;
+  typedef Eigen::Matrix<double, Degree + 1, Degree + 1> Matrix;
+
+  explicit PolynomialFitter(double x_scale) : x_scale(x_scale) {
+    Clear();
+  }
+
+  /**
+   * Remove all points.
+   */
+  void Clear() {
+    ata.setZero();
+    aty.setZero();
+  }
+
+  /**
+   * Add a point with the given weight.
+   */
+  void Add(double x, double y, double weight) {
+    Vector a = Powers(x / x_scale);
+    ata.noalias() += weight * a * a.transpose();
+    aty.noalias() += (weight * y) * a;
+  }
+
+  /**
+   * Solve for the coefficients, starting with the constant term.
+   */
+  Vector Solve() const {
+    Vector scaled_coeffs = ata.ldlt().solve(aty);
+    Vector coeffs;
+    double scale = 1;
+    for (int i = 0; i <= Degree; ++i) {
+      coeffs(i) = scaled_coeffs(i) / scale;
+      scale *= x_scale;
+    }
+    return coeffs;
+  }
+
+private:
+  double x_scale;
+  Matrix ata;
+  Vector aty;
+
+  static Vector Powers(double x) {
+    Vector a;
+    a(0) = 1;
+    for (int i = 1; i <= Degree; ++i) {
+      a(i) = a(i - 1) * x;
+    }
+    return a;
+  }
+};
+
+#endif /* POLYNOMIAL_FITTER_H */
@@ -2,29 +2,7 @@
 
 using CppAD::AD;
 
-const size_t N = 20;
-const size_t N_VARS = N * 4 + (N - 1) * 2;
-const size_t N_CONSTRAINTS = N * 4;
-
-const size_t x_start = 0;
-const size_t y_start = x_start + N;
-const size_t psi_start = y_start + N;
-const size_t v_start = psi_start + N;
-const size_t delta_start = v_start + N;
-const size_t throttle_start = delta_start + N - 1;
-
-// This value assumes the model presented in the classroom is used.
-//
-// It was obtained by measuring the radius formed by running the vehicle in the
-// simulator around in a circle with a constant steering angle and velocity on a
-// flat terrain.
-//
-// Lf was tuned until the the radius formed by the simulating the model
-// presented in the classroom matched the previous radius.
-//
-const double Lf = 2.67;
-
-const double MPH_TO_METERS_PER_SECOND = (1609.34 / 3600.0);
+const size_t DEFAULT_N = 20;
 
 const double DEFAULT_DT = 0.05;
 const double DEFAULT_REF_V = 50; // mph
@@ -47,8 +25,39 @@ Problem::Problem(const ReferencePolynomial &reference) :
   delta_weight(DEFAULT_DELTA_WEIGHT),
   throttle_weight(DEFAULT_A_WEIGHT),
   delta_gap_weight(DEFAULT_DELTA_GAP_WEIGHT),
-  throttle_gap_weight(DEFAULT_THROTTLE_GAP_WEIGHT)
-{ }
+  throttle_gap_weight(DEFAULT_THROTTLE_GAP_WEIGHT),
+  frenet(false)
+{
+  SetHorizon(DEFAULT_N);
+}
+
+void Problem::SetHorizon(size_t new_n) {
+  n = new_n;
+  n_vars = n * 4 + (n - 1) * 2;
+  n_constraints = n * 4;
+
+  x_start = 0;
+  y_start = x_start + n;
+  psi_start = y_start + n;
+  v_start = psi_start + n;
+  delta_start = v_start + n;
+  throttle_start = delta_start + n - 1;
+
+  curvatures.assign(n, 0);
+}
+
+void Problem::CopySettings(const Problem &other) {
+  dt = other.dt;
+  ref_v = other.ref_v;
+  cte_weight = other.cte_weight;
+  epsi_weight = other.epsi_weight;
+  v_weight = other.v_weight;
+  delta_weight = other.delta_weight;
+  throttle_weight = other.throttle_weight;
+  delta_gap_weight = other.delta_gap_weight;
+  throttle_gap_weight = other.throttle_gap_weight;
+  frenet = other.frenet;
+}
 
 // `fg` is a vector containing the cost and constraints.
 // `vars` is a vector containing the variable values (state & actuators).
@@ -66,7 +75,7 @@ void Problem::operator()(ADvector& fg, const ADvector& vars) {
   fg[1 + psi_start] = vars[psi_start];
   fg[1 + v_start] = vars[v_start];
 
-  for (int i = 0; i < N - 1; i++) {
+  for (size_t i = 0; i < n - 1; i++) {
     // The state at time t.
     const AD<double> &x0 = vars[x_start + i];
     const AD<double> &y0 = vars[y_start + i];
@@ -89,40 +98,61 @@ void Problem::operator()(ADvector& fg, const ADvector& vars) {
     // Each of these expressions is constrained to be zero.
     //
 
-    fg[2 + x_start + i] = x1 - (x0 + v0 * CppAD::cos(psi0) * dt);
-    fg[2 + y_start + i] = y1 - (y0 + v0 * CppAD::sin(psi0) * dt);
-    fg[2 + psi_start + i] = psi1 - (psi0 + v0 * delta0 / Lf * dt);
-    fg[2 + v_start + i] = v1 - (v0 + a0 * dt);
-
-    //
-    // Objective
-    //
-
-    // Steering angle error: The reference angle comes from the derivative of
-    // the reference polynomial, which here is written with the Horner scheme.
-    const AD<double> &reference_slope =
-      reference.coeffs[1] + x0 * (
-        2 * reference.coeffs[2] + x0 * (
-          3 * reference.coeffs[3]
-        )
-      );
-    const AD<double> &psides0 = CppAD::atan(reference_slope);
-    const AD<double> &epsi0 = (psi0 - psides0) + v0 * delta0 / Lf * dt;
-    fg[0] += epsi_weight * CppAD::pow(epsi0, 2);
-
-    // Cross track error: We just use the y coordinate of the reference
-    // polynomial to find the CTE. This is approximately right when both the
-    // car's steering angle (psi) and the reference slope are not too steep.
-    const AD<double> &reference_y =
-      reference.coeffs[0] + x0 * (
-        reference.coeffs[1] + x0 * (
-          reference.coeffs[2] + x0 * (
-            reference.coeffs[3]
-          )
-        )
-      );
-    const AD<double> &cte0 = (reference_y - y0) + v0 * CppAD::sin(epsi0) * dt;
-    fg[0] += cte_weight * CppAD::pow(cte0, 2);
+    if (frenet) {
+      // Here x is the arc length, s, y is the lateral offset, d, and psi is
+      // the heading error relative to the track. The curvature comes from
+      // the track map, so there is no need for the polynomial.
+      const double curvature = curvatures[i];
+      const AD<double> &s_dot = v0 * CppAD::cos(psi0) / (1 - y0 * curvature);
+      fg[2 + x_start + i] = x1 - (x0 + s_dot * dt);
+      fg[2 + y_start + i] = y1 - (y0 + v0 * CppAD::sin(psi0) * dt);
+      fg[2 + psi_start + i] =
+        psi1 - (psi0 + (v0 * delta0 / Lf - curvature * s_dot) * dt);
+      fg[2 + v_start + i] = v1 - (v0 + a0 * dt);
+
+      // The errors are just the state at the end of the step, and the
+      // lateral offset is the exact CTE.
+      fg[0] += epsi_weight * CppAD::pow(psi1, 2);
+      fg[0] += cte_weight * CppAD::pow(y1, 2);
+    } else {
+      fg[2 + x_start + i] = x1 - (x0 + v0 * CppAD::cos(psi0) * dt);
+      fg[2 + y_start + i] = y1 - (y0 + v0 * CppAD::sin(psi0) * dt);
+      fg[2 + psi_start + i] = psi1 - (psi0 + v0 * delta0 / Lf * dt);
+      fg[2 + v_start + i] = v1 - (v0 + a0 * dt);
+
+      //
+      // Objective
+      //
+
+      // The reference and its slope at x0: either from the reference
+      // polynomial, of whatever degree, or from a quadratic approximation to
+      // the spline or piecewise reference around where we expect the car to
+      // be; the table comes from the piece that the car is expected to be on.
+      AD<double> reference_y;
+      AD<double> reference_slope;
+      if (reference.tabulated()) {
+        const AD<double> &dx = x0 - reference_table.x[i];
+        const double slope = reference_table.slope[i];
+        const double second = reference_table.second[i];
+        reference_y = reference_table.y[i] + dx * (slope + dx * second / 2);
+        reference_slope = slope + dx * second;
+      } else {
+        reference_y = reference.Polynomial(x0);
+        reference_slope = reference.PolynomialSlope(x0);
+      }
+
+      // Steering angle error: The reference angle comes from the slope of the
+      // reference.
+      const AD<double> &psides0 = CppAD::atan(reference_slope);
+      const AD<double> &epsi0 = (psi0 - psides0) + v0 * delta0 / Lf * dt;
+      fg[0] += epsi_weight * CppAD::pow(epsi0, 2);
+
+      // Cross track error: We just use the y coordinate of the reference
+      // to find the CTE. This is approximately right when both the car's
+      // steering angle (psi) and the reference slope are not too steep.
+      const AD<double> &cte0 = (reference_y - y0) + v0 * CppAD::sin(epsi0) * dt;
+      fg[0] += cte_weight * CppAD::pow(cte0, 2);
+    }
 
     // Speed: Just have to be careful of the units.
     fg[0] += v_weight * CppAD::pow(vars[v_start + i] -
@@ -134,7 +164,7 @@ void Problem::operator()(ADvector& fg, const ADvector& vars) {
 
     // Actuator smoothness: Minimize the value gap between sequential
     // actuations.
-    if (i < N - 2) {
+    if (i < n - 2) {
       fg[0] += delta_gap_weight *
         CppAD::pow(vars[delta_start + i + 1] - delta0, 2);
       fg[0] += throttle_gap_weight *
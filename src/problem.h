@@ -1,50 +1,13 @@
 #ifndef PROBLEM_H
 #define PROBLEM_H
 
+#include <vector>
 #include <cppad/cppad.hpp>
 #include "reference_polynomial.h"
+#include "vehicle_model.h"
 
-// Number of time steps in the receding horizon problem.
-extern const size_t N;
-
-// Number of variables (N timesteps => N - 1 actuations).
-extern const size_t N_VARS;
-
-// Number of constraints.
-extern const size_t N_CONSTRAINTS;
-
-// The solver takes all the state variables and actuator
-// variables in a singular vector. Thus, we should to establish
-// when one variable starts and another ends to make our lifes easier.
-extern const size_t x_start;
-extern const size_t y_start;
-extern const size_t psi_start;
-extern const size_t v_start;
-extern const size_t cte_start;
-extern const size_t epsi_start;
-extern const size_t delta_start;
-extern const size_t throttle_start;
-
-// Length from front to CoG that has a similar radius.
-extern const double Lf;
-
-// 1609.34m / mile * 1h / 3600s = x (m / s) / (miles / h).
-extern const double MPH_TO_METERS_PER_SECOND;
-
-/**
- * Convert a throttle value to an acceleration, based on current speed. This
- * is an empirical formula based on recording the speed under full throttle
- * at the start with no steering (before the vehicle crashes); see
- * data/acceleration_estimate.xlsx for details.
- *
- * @param  throttle in [-1, 1]
- * @param  speed in m/s
- * @return in m/s^2
- */
-template <typename T>
-T throttle_to_acceleration(T throttle, T speed) {
-  return throttle * (5.1886 - 0.0923 * speed);
-}
+// Default number of time steps in the receding horizon problem.
+extern const size_t DEFAULT_N;
 
 /**
  * Functor to calculate the objective function and set up the the dynamic
@@ -54,6 +17,26 @@ struct Problem {
   typedef CPPAD_TESTVECTOR(CppAD::AD<double>) ADvector;
 
   const ReferencePolynomial &reference;
+
+  // Number of time steps in the receding horizon problem.
+  size_t n;
+
+  // Number of variables (n timesteps => n - 1 actuations).
+  size_t n_vars;
+
+  // Number of constraints.
+  size_t n_constraints;
+
+  // The solver takes all the state variables and actuator
+  // variables in a singular vector. Thus, we should to establish
+  // when one variable starts and another ends to make our lifes easier.
+  size_t x_start;
+  size_t y_start;
+  size_t psi_start;
+  size_t v_start;
+  size_t delta_start;
+  size_t throttle_start;
+
   double dt;
   double ref_v;
   double cte_weight;
@@ -64,8 +47,33 @@ struct Problem {
   double delta_gap_weight;
   double throttle_gap_weight;
 
+  // Use the Frenet formulation? If so, the x, y and psi variables hold the
+  // arc length along the track (relative to the car), the lateral offset
+  // from the track (positive to the left) and the heading error, and the
+  // reference polynomial is not used.
+  bool frenet;
+
+  // Frenet formulation: curvature of the track at each time step, in 1/m,
+  // looked up from the track map before each solve.
+  std::vector<double> curvatures;
+
+  // The reference around each time step, when the reference is a spline or
+  // piecewise, tabulated before each solve.
+  ReferenceTable reference_table;
+
   Problem(const ReferencePolynomial &reference);
 
+  /**
+   * Set the number of time steps and recompute the variable layout.
+   */
+  void SetHorizon(size_t new_n);
+
+  /**
+   * Copy the timestep, reference speed and weights (but not the horizon or
+   * reference) from another problem.
+   */
+  void CopySettings(const Problem &other);
+
   // `fg` is a vector containing the cost and constraints.
   // `vars` is a vector containing the variable values (state & actuators).
   void operator()(ADvector& fg, const ADvector& vars);
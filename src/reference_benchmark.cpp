@@ -0,0 +1,113 @@
+//
+// Benchmark fitting and evaluating the reference trajectory with polynomials
+// of degree 2, 3 and 5, the smoothing spline and the piecewise reference,
+// driving along the center of a mapped track. Usage:
+//
+//   ./reference_benchmark [track.csv] [laps]
+//
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sysexits.h>
+#include <vector>
+
+#include "reference_polynomial.h"
+#include "track_map.h"
+
+// Horizon to tabulate and check, as in the default MPC settings.
+const size_t N = 20;
+const double DT = 0.05;
+
+// Speed of the car, in m/s (about 50 mph), and time between updates, in s.
+const double SPEED = 22;
+const double PERIOD = 0.1;
+
+typedef std::chrono::steady_clock Clock;
+
+static double Seconds(Clock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+template <int Degree>
+static void Benchmark(const TrackMap &track, int laps,
+  ReferenceModel model, const char *name)
+{
+  // The telemetry waypoints are ignored when there is a track map.
+  std::vector<double> no_points;
+
+  BasicReferencePolynomial<Degree> reference;
+  reference.track = &track;
+  reference.model = model;
+  ReferenceTable table;
+  Eigen::ArrayXd display_y;
+
+  size_t updates = 0;
+  double fit_time = 0;
+  double evaluate_time = 0;
+  double total_squared_error = 0;
+  double max_error = 0;
+  size_t errors = 0;
+
+  for (double s = 0; s < laps * track.length(); s += SPEED * PERIOD) {
+    double px, py;
+    track.Position(s, px, py);
+    double psi = track.Heading(s);
+
+    Clock::time_point t0 = Clock::now();
+    reference.Update(no_points, no_points, px, py, psi);
+    Clock::time_point t1 = Clock::now();
+    reference.Tabulate(0, SPEED * DT, N, table);
+    reference.Evaluate(reference.vehicle_ptsx.array(), display_y);
+    Clock::time_point t2 = Clock::now();
+
+    fit_time += Seconds(t1 - t0);
+    evaluate_time += Seconds(t2 - t1);
+    ++updates;
+
+    // Compare the reference with the center of the track over the
+    // horizon, in vehicle coordinates.
+    for (size_t i = 0; i < N; ++i) {
+      double x, y;
+      track.Position(s + SPEED * DT * i, x, y);
+      x -= px;
+      y -= py;
+      double vehicle_x = x * cos(psi) + y * sin(psi);
+      double vehicle_y = -x * sin(psi) + y * cos(psi);
+      double error = fabs(reference.Evaluate(vehicle_x) - vehicle_y);
+      total_squared_error += error * error;
+      max_error = std::max(max_error, error);
+      ++errors;
+    }
+
+    // Keep the display evaluations from being optimized away.
+    if (std::isnan(display_y.sum())) std::cerr << "NaN" << std::endl;
+  }
+
+  std::cout << std::setw(10) << name <<
+    ": updates=" << updates <<
+    " fit_us=" << 1e6 * fit_time / updates <<
+    " evaluate_us=" << 1e6 * evaluate_time / updates <<
+    " rms_error=" << sqrt(total_squared_error / errors) <<
+    " max_error=" << max_error << std::endl;
+}
+
+int main(int argc, char **argv) {
+  std::string pathname = argc > 1 ? argv[1] : "../lake_track_waypoints.csv";
+  int laps = argc > 2 ? atoi(argv[2]) : 10;
+
+  TrackMap track;
+  if (!track.Load(pathname)) {
+    std::cerr << "Failed to load track from " << pathname << std::endl;
+    return EX_NOINPUT;
+  }
+
+  Benchmark<2>(track, laps, REFERENCE_POLYNOMIAL, "degree 2");
+  Benchmark<3>(track, laps, REFERENCE_POLYNOMIAL, "degree 3");
+  Benchmark<5>(track, laps, REFERENCE_POLYNOMIAL, "degree 5");
+  Benchmark<REFERENCE_DEGREE>(track, laps, REFERENCE_SPLINE, "spline");
+  Benchmark<REFERENCE_DEGREE>(track, laps, REFERENCE_PIECEWISE, "piecewise");
+
+  return EX_OK;
+}
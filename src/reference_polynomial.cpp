@@ -1,163 +1,190 @@
 #include "reference_polynomial.h"
 
 #include <algorithm>
-#include "Eigen-3.3/Eigen/Dense"
-#include "Eigen-3.3/Eigen/QR"
-
-const int DEGREE = 3;
-
-// Evaluate a polynomial.
-double polyeval(const Eigen::VectorXd &coeffs, double x) {
-  double result = 0.0;
-  for (int i = 0; i < coeffs.size(); i++) {
-    result += coeffs[i] * pow(x, i);
-  }
-  return result;
-}
-
-// Fit a polynomial.
-// Adapted from
-// https://github.com/JuliaMath/Polynomials.jl/blob/master/src/Polynomials.jl#L676-L716
-Eigen::VectorXd polyfit(
-  const Eigen::VectorXd &xvals, const Eigen::VectorXd &yvals,
-  const Eigen::VectorXd &weights, int order)
+#include <cassert>
+#include "polynomial_fitter.h"
+
+// Typical size of the x coordinates of the waypoints in vehicle coordinates,
+// in meters, for scaling the fit.
+const double X_SCALE = 50;
+
+// Window of waypoints to take from the track map, in meters along the track.
+const double TRACK_BEHIND = 10;
+const double TRACK_AHEAD = 60;
+const double TRACK_SPACING = 5;
+
+// Number of pieces in the smoothing spline, and the weight of its smoothness
+// penalty relative to the total weight of the points.
+const int SPLINE_SEGMENTS = 6;
+const double SPLINE_SMOOTHING = 0.001;
+
+// Length of each piece of the piecewise reference, in meters, the weight of
+// its bending penalty relative to the total weight of the points, and how far
+// the car can turn before we refit all of the pieces, in radians.
+const double PIECEWISE_SEGMENT_LENGTH = 12;
+const double PIECEWISE_SMOOTHING = 1e-4;
+const double PIECEWISE_MAX_ANCHOR_ANGLE = 30.0 / 180 * M_PI;
+
+// Evaluate a polynomial at many points at once with the Horner scheme. Each
+// step is an array expression, which Eigen vectorizes.
+template <typename Coefficients>
+static void polyeval(const Coefficients &coeffs, const Eigen::ArrayXd &xs,
+  Eigen::ArrayXd &ys)
 {
-  assert(xvals.size() == yvals.size());
-  assert(order >= 1 && order <= xvals.size() - 1);
-  Eigen::MatrixXd A(xvals.size(), order + 1);
-
-  for (int i = 0; i < xvals.size(); i++) {
-    A(i, 0) = 1.0;
+  ys.setConstant(xs.size(), coeffs[coeffs.size() - 1]);
+  for (int i = coeffs.size() - 2; i >= 0; --i) {
+    ys = ys * xs + coeffs[i];
   }
-
-  for (int j = 0; j < xvals.size(); j++) {
-    for (int i = 0; i < order; i++) {
-      A(j, i + 1) = A(j, i) * xvals(j);
-    }
-  }
-
-  Eigen::MatrixXd W = weights.array().sqrt().matrix().asDiagonal();
-
-  auto Q = (W * A).householderQr();
-  auto result = Q.solve(W * yvals);
-  return result;
 }
 
-ReferencePolynomial::ReferencePolynomial() : coeffs(DEGREE + 1) { }
-
-void ReferencePolynomial::Reset() {
-  points.clear();
-  point_weights.resize(0);
+template <int Degree>
+BasicReferencePolynomial<Degree>::BasicReferencePolynomial() :
+  track(nullptr),
+  model(REFERENCE_POLYNOMIAL),
+  coeffs(Coefficients::Zero()),
+  spline(SPLINE_SEGMENTS, SPLINE_SMOOTHING),
+  piecewise(PIECEWISE_SEGMENT_LENGTH, PIECEWISE_SMOOTHING,
+    PIECEWISE_MAX_ANCHOR_ANGLE)
+{ }
+
+template <int Degree>
+void BasicReferencePolynomial<Degree>::Reset() {
+  points.Clear();
+  piecewise.Clear();
 }
 
-void ReferencePolynomial::Update(
+template <int Degree>
+void BasicReferencePolynomial<Degree>::Update(
   const std::vector<double> &ptsx_vector,
   const std::vector<double> &ptsy_vector,
   double px, double py, double psi)
 {
-  UpdateKnownPoints(ptsx_vector, ptsy_vector);
+  // Amount to increase or decrease the weight of a point by, per time step.
+  const double DELTA = 0.1;
+
+  //
+  // Implement gradual up-weighting of new points and down-weight of old
+  // points, to provide input weights for a for weighted least square fit.
+  // Note that this has to preserve the order of the points, so the simulator
+  // can display the reference line based on the transformed points.
+  //
+  if (track) {
+    track->LocalWaypoints(px, py, TRACK_BEHIND, TRACK_AHEAD, TRACK_SPACING,
+      track_ptsx, track_ptsy);
+    points.Update(track_ptsx, track_ptsy, DELTA);
+  } else {
+    points.Update(ptsx_vector, ptsy_vector, DELTA);
+  }
   TransformKnownPoints(px, py, psi);
-  coeffs = polyfit(vehicle_ptsx, vehicle_ptsy, point_weights, DEGREE);
+
+  // The vehicle coordinates of all of the points change whenever the car
+  // moves, so we have to fit from scratch. Points with zero weight have
+  // already been removed.
+  assert(vehicle_ptsx.size() > Degree);
+  PolynomialFitter<Degree> fitter(X_SCALE);
+  for (int i = 0; i < vehicle_ptsx.size(); ++i) {
+    fitter.Add(vehicle_ptsx(i), vehicle_ptsy(i), points.weight(i));
+  }
+  coeffs = fitter.Solve();
+
+  if (model == REFERENCE_SPLINE) {
+    weights.resize(vehicle_ptsx.size());
+    for (int i = 0; i < vehicle_ptsx.size(); ++i) {
+      weights(i) = points.weight(i);
+    }
+    spline.Fit(vehicle_ptsx, vehicle_ptsy, weights);
+  } else if (model == REFERENCE_PIECEWISE) {
+    piecewise.Update(points, px, py, psi);
+  }
 }
 
-double ReferencePolynomial::Evaluate(double x) const {
-  return polyeval(coeffs, x);
+template <int Degree>
+double BasicReferencePolynomial<Degree>::Evaluate(double x) const {
+  if (model == REFERENCE_POLYNOMIAL) return Polynomial(x);
+  double value, slope, second;
+  Evaluate(x, value, slope, second);
+  return value;
 }
 
-void PopFrontVectorXd(Eigen::VectorXd &v) {
-  if (v.size() == 0) return;
-  for (size_t i = 1; i < v.size(); ++i) v(i - 1) = v(i);
-  v.conservativeResize(v.size() - 1);
+template <int Degree>
+void BasicReferencePolynomial<Degree>::Evaluate(
+  const Eigen::ArrayXd &xs, Eigen::ArrayXd &ys) const
+{
+  if (model != REFERENCE_POLYNOMIAL) {
+    ys.resize(xs.size());
+    for (int i = 0; i < xs.size(); ++i) ys(i) = Evaluate(xs(i));
+    return;
+  }
+  polyeval(coeffs, xs, ys);
 }
 
-void PushBackVectorXd(Eigen::VectorXd &v, double value) {
-  v.conservativeResize(v.size() + 1);
-  v(v.size() - 1) = value;
+template <int Degree>
+double BasicReferencePolynomial<Degree>::EvaluateSlope(double x) const {
+  double value, slope, second;
+  Evaluate(x, value, slope, second);
+  return slope;
 }
 
-//
-// Implement gradual up-weighting of new points and down-weight of old points,
-// to provide input weights for a for weighted least square fit. Note that
-// this has to preserve the order of the points, so the simulator can display
-// the reference line based on the transformed points. This means we can't use
-// a datastructure like a set, but the number of waypoints is quite small
-// anyway (typically 6), so it would probably not be worth it anyway.
-//
-void ReferencePolynomial::UpdateKnownPoints(
-  const std::vector<double> &ptsx_vector,
-  const std::vector<double> &ptsy_vector)
+template <int Degree>
+void BasicReferencePolynomial<Degree>::Evaluate(
+  double x, double &value, double &slope, double &second) const
 {
-  // Amount to increase or decrease the weight of a point by, per time step.
-  const double DELTA = 0.1;
-
-  // Numerical tolerance for comparisons to the 0 (no weight) and 1 (full
-  // weight) boundaries.
-  const double EPSILON = 1e-6;
-
-  // Find whether old points are present in the set of new points. If they are
-  // present, and they are not already at full weight (1), then up-weight them
-  // by DELTA. If they are not present, down-weight them by DELTA.
-  for (size_t i = 0; i < points.size(); ++i) {
-    if (PointIsPresent(points[i], ptsx_vector, ptsy_vector)) {
-      if (point_weights(i) < 1.0 - EPSILON) {
-        point_weights(i) += DELTA;
-      } else {
-        point_weights(i) = 1.0;
-      }
-    } else {
-      point_weights(i) -= DELTA;
-    }
+  if (model == REFERENCE_SPLINE) {
+    spline.Evaluate(x, value, slope, second);
+    return;
   }
-
-  // Remove points with zero weight. We assume that these are the ones at the
-  // start of the array, since that is where old points seem to disappear from.
-  while (!points.empty() && point_weights(0) < 0 + EPSILON) {
-    points.erase(points.begin());
-    PopFrontVectorXd(point_weights);
+  if (model == REFERENCE_PIECEWISE) {
+    piecewise.Evaluate(x, value, slope, second);
+    return;
   }
-
-  // If any new points were added, append them with a small weight; we'll
-  // increase the weight gradually.
-  for (size_t i = 0; i < ptsx_vector.size(); ++i) {
-    Point point(ptsx_vector[i], ptsy_vector[i]);
-    if (!PointIsKnown(point)) {
-      points.push_back(point);
-      PushBackVectorXd(point_weights, DELTA);
-    }
+  value = Polynomial(x);
+  slope = PolynomialSlope(x);
+  second = Degree * (Degree - 1) * coeffs[Degree];
+  for (int i = Degree - 1; i >= 2; --i) {
+    second = second * x + i * (i - 1) * coeffs[i];
   }
 }
 
-bool ReferencePolynomial::PointIsPresent(const Point& point,
-  const std::vector<double> &ptsx_vector,
-  const std::vector<double> &ptsy_vector) {
-  for (size_t i = 0; i < ptsx_vector.size(); ++i) {
-    Point new_point(ptsx_vector[i], ptsy_vector[i]);
-    if (point == new_point) {
-      return true;
-    }
+template <int Degree>
+void BasicReferencePolynomial<Degree>::Tabulate(
+  double x0, double step, size_t n, ReferenceTable &table) const
+{
+  table.x.resize(n);
+  table.y.resize(n);
+  table.slope.resize(n);
+  table.second.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    table.x[i] = x0 + step * i;
+    Evaluate(table.x[i], table.y[i], table.slope[i], table.second[i]);
   }
-  return false;
-}
-
-bool ReferencePolynomial::PointIsKnown(const Point& point) {
-  return std::find(points.begin(), points.end(), point) != points.end();
 }
 
 //
 // Transform the waypoints into vehicle coordinates, where the car is
 // at (0, 0) pointing along the x axis (psi = 0).
 //
-void ReferencePolynomial::TransformKnownPoints(double px, double py, double psi)
+template <int Degree>
+void BasicReferencePolynomial<Degree>::TransformKnownPoints(
+  double px, double py, double psi)
 {
+  // Gather the points out of the ring buffer, relative to the car.
   size_t num_points = points.size();
-  vehicle_ptsx.resize(num_points);
-  vehicle_ptsy.resize(num_points);
+  world_x.resize(num_points);
+  world_y.resize(num_points);
   for (size_t i = 0; i < num_points; ++i) {
-    double x = points[i].first - px;
-    double y = points[i].second - py;
-    double rx = x * cos(-psi) - y * sin(-psi);
-    double ry = x * sin(-psi) + y * cos(-psi);
-    vehicle_ptsx(i) = rx;
-    vehicle_ptsy(i) = ry;
+    world_x(i) = points.x(i) - px;
+    world_y(i) = points.y(i) - py;
   }
+
+  // Rotate them all at once by -psi.
+  double cos_psi = cos(psi);
+  double sin_psi = sin(psi);
+  vehicle_ptsx = (world_x * cos_psi + world_y * sin_psi).matrix();
+  vehicle_ptsy = (world_y * cos_psi - world_x * sin_psi).matrix();
 }
+
+// The available degrees; REFERENCE_DEGREE must be one of them.
+template struct BasicReferencePolynomial<2>;
+template struct BasicReferencePolynomial<3>;
+template struct BasicReferencePolynomial<4>;
+template struct BasicReferencePolynomial<5>;
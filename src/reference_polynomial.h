@@ -1,9 +1,39 @@
 #ifndef REFERENCE_POLYNOMIAL_H
 #define REFERENCE_POLYNOMIAL_H
 
-#include <map>
 #include <vector>
 #include "Eigen-3.3/Eigen/Core"
+#include "horner.h"
+#include "piecewise_reference.h"
+#include "smoothing_spline.h"
+#include "track_map.h"
+#include "waypoint_buffer.h"
+
+// Degree of the reference polynomial; set it with cmake -DREFERENCE_DEGREE=n.
+#ifndef REFERENCE_DEGREE
+#define REFERENCE_DEGREE 3
+#endif
+
+// What the reference is: the polynomial, a smoothing spline or a piecewise
+// cubic.
+enum ReferenceModel {
+  REFERENCE_POLYNOMIAL,
+  REFERENCE_SPLINE,
+  REFERENCE_PIECEWISE
+};
+
+/**
+ * The reference's value and first and second derivatives at the x positions
+ * where we expect the car to be at each time step, so the optimization
+ * problem can use a local quadratic approximation to the reference rather
+ * than evaluating it in full.
+ */
+struct ReferenceTable {
+  std::vector<double> x;
+  std::vector<double> y;
+  std::vector<double> slope;
+  std::vector<double> second;
+};
 
 /**
  * Maintain an estimate of the reference polynomial based on the waypoints.
@@ -14,17 +44,46 @@
  * squares to gradually increase the weight of new points and gradually decrease
  * the weight of old points. This avoids large changes in the reference
  * trajectory.
+ *
+ * If there is a track map, we take the waypoints from the map around the car
+ * instead of from the telemetry. The map's points are closer together and
+ * move smoothly along with the car, rather than in blocks.
+ *
+ * Optionally, we also fit a smoothing spline or a piecewise cubic to the same
+ * weighted points, and the reference is then that rather than the
+ * polynomial, apart from the coefficients, which are always from the
+ * polynomial.
+ *
+ * The degree of the polynomial is a template parameter, so the evaluation is
+ * unrolled at compile time, and the optimization problem can evaluate the
+ * polynomial on AD types with Polynomial and PolynomialSlope.
  */
-struct ReferencePolynomial {
-  ReferencePolynomial();
+template <int Degree>
+struct BasicReferencePolynomial {
+  typedef Eigen::Matrix<double, Degree + 1, 1, Eigen::DontAlign>
+    Coefficients;
+
+  BasicReferencePolynomial();
 
   /**
    * Forget known waypoints for a new run.
    */
   void Reset();
 
+  // Map of the whole track, if any, to use instead of the telemetry
+  // waypoints. It is not owned.
+  const TrackMap *track;
+
+  // What to use for Evaluate, EvaluateSlope and Tabulate.
+  ReferenceModel model;
+
+  // Should the optimization problem use the table from Tabulate, rather than
+  // the polynomial?
+  bool tabulated() const { return model != REFERENCE_POLYNOMIAL; }
+
   /**
-   * Compute new coefficients and transformed points.
+   * Compute new coefficients and transformed points. The telemetry waypoints
+   * are ignored if we have a track map.
    */
   void Update(
     const std::vector<double> &ptsx_vector,
@@ -32,35 +91,80 @@ struct ReferencePolynomial {
     double px, double py, double psi);
 
   /**
-   * Evaluate the polynomial at the given x coordinate.
+   * Evaluate the polynomial, with the current coefficients, at x.
+   */
+  template <typename T>
+  T Polynomial(const T &x) const {
+    return Horner<0, Degree>::Value(coeffs, x);
+  }
+
+  /**
+   * Evaluate the slope of the polynomial, with the current coefficients, at
+   * x.
+   */
+  template <typename T>
+  T PolynomialSlope(const T &x) const {
+    return Horner<0, Degree - 1>::Slope(coeffs, x);
+  }
+
+  /**
+   * Evaluate the reference at the given x coordinate.
    */
   double Evaluate(double x) const;
 
-  // Coefficients of the estimated polynomial.
-  Eigen::VectorXd coeffs;
+  /**
+   * Evaluate the slope of the reference at the given x coordinate.
+   */
+  double EvaluateSlope(double x) const;
+
+  /**
+   * Evaluate the reference at each of the given x coordinates.
+   */
+  void Evaluate(const Eigen::ArrayXd &xs, Eigen::ArrayXd &ys) const;
+
+  /**
+   * Tabulate the reference at x0, x0 + step, ..., for n time steps.
+   */
+  void Tabulate(double x0, double step, size_t n, ReferenceTable &table)
+    const;
+
+  // Coefficients of the estimated polynomial, starting with the constant
+  // term.
+  Coefficients coeffs;
 
   // The latest set of waypoints, transformed into vehicle coordinates.
   Eigen::VectorXd vehicle_ptsx;
   Eigen::VectorXd vehicle_ptsy;
 
 private:
-  typedef std::pair<double, double> Point;
-  typedef std::vector<Point> PointVector;
+  WaypointBuffer points;
 
-  PointVector points;
-  Eigen::VectorXd point_weights;
+  // Waypoints from the track map; kept here to reuse their storage.
+  std::vector<double> track_ptsx;
+  std::vector<double> track_ptsy;
 
-  void UpdateKnownPoints(
-    const std::vector<double> &ptsx_vector,
-    const std::vector<double> &ptsy_vector);
+  // Known points relative to the car, before rotation; kept here to reuse
+  // their storage.
+  Eigen::ArrayXd world_x;
+  Eigen::ArrayXd world_y;
 
-  void TransformKnownPoints(double px, double py, double psi);
+  // Weights of the transformed points, for the spline fit.
+  Eigen::VectorXd weights;
 
-  bool PointIsPresent(const Point& point,
-    const std::vector<double> &ptsx_vector,
-    const std::vector<double> &ptsy_vector);
+  SmoothingSpline spline;
+
+  PiecewiseReference piecewise;
 
-  bool PointIsKnown(const Point& point);
+  void Evaluate(double x, double &value, double &slope, double &second)
+    const;
+
+  void TransformKnownPoints(double px, double py, double psi);
 };
 
+// The degrees of polynomial that are available; see reference_polynomial.cpp.
+static_assert(REFERENCE_DEGREE >= 2 && REFERENCE_DEGREE <= 5,
+  "REFERENCE_DEGREE must be from 2 to 5");
+
+typedef BasicReferencePolynomial<REFERENCE_DEGREE> ReferencePolynomial;
+
 #endif /* REFERENCE_POLYNOMIAL_H */
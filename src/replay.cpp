@@ -0,0 +1,165 @@
+//
+// Replay the telemetry from flight recorder segments through the controller,
+// without the simulator or uWS, and compare what it does with what was
+// recorded. The controller's clock is set from the recorded solve start times,
+// so the latency estimate (and so the latency compensation) and the tuning
+// stats come out as they did in the recorded run. Usage:
+//
+//   ./replay [options] flight/mpc-*.flight > replay.csv
+//
+// The options are the ones that configure the controller in mpc, e.g.
+// --track, --spline-reference, --piecewise-reference, --frenet, --fallback
+// and --adaptive-horizon, and should match those of the recorded run. Only
+// the plain MPC is replayed, not the planner or the background solvers.
+//
+// Prints a row per recorded solve with the solve time and the differences
+// from the recording, and a summary on stderr. With --tolerance=x, the exit status is
+// 1 if any steering angle or throttle differs from the recording by more
+// than x, so a run on a known log can serve as a regression test.
+//
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <sysexits.h>
+#include <vector>
+
+#include "clock.h"
+#include "controller_options.h"
+#include "flight_log.h"
+#include "MPC.h"
+#include "tool_support.h"
+#include "track_map.h"
+
+static Clock::time_point TimePoint(int64_t nanoseconds) {
+  return Clock::time_point(std::chrono::duration_cast<Clock::duration>(
+    std::chrono::nanoseconds(nanoseconds)));
+}
+
+// Largest distance between corresponding points of the plan and the recorded
+// plan, in meters, over the steps that both have.
+static double PlanDifference(const MPC &mpc, const FlightTick &tick) {
+  size_t n = std::min(mpc.problem.n, tick.mpc_x.size());
+  double difference = 0;
+  for (size_t i = 0; i < n; ++i) {
+    double x, y;
+    mpc.PlanPoint(i, x, y);
+    difference = std::max(difference,
+      std::hypot(x - tick.mpc_x[i], y - tick.mpc_y[i]));
+  }
+  return difference;
+}
+
+int main(int argc, char **argv) {
+  std::map<std::string, std::string> options;
+  std::vector<std::string> arguments;
+  ParseArguments(argc, argv, options, arguments);
+  if (arguments.empty()) {
+    std::cerr << "usage: " << argv[0] << " [options] segment..." << std::endl;
+    return EX_USAGE;
+  }
+
+  TrackMap track;
+  ReferencePolynomial reference;
+  Problem problem(reference);
+  MPC mpc(reference, problem);
+
+  // Keep the solver's tracing out of the CSV; this also turns on the tuning
+  // stats, for the summary.
+  mpc.tuning = true;
+
+  ManualClock clock;
+  mpc.SetClock(&clock);
+
+  int status = ConfigureController(options, track, reference, problem, mpc);
+  if (status != EX_OK) return status;
+
+  double tolerance = -1;
+  if (options.count("tolerance")) {
+    tolerance = atof(options["tolerance"].c_str());
+  }
+
+  std::cout << "session,tick,solve_us,recorded_solve_us,latency,"
+    "recorded_latency,cost,recorded_cost,fallback_reason,"
+    "recorded_fallback_reason,steer_diff,throttle_diff,plan_diff" << std::endl;
+  std::cout.precision(9);
+
+  std::vector<double> solve_times;
+  double max_steer_diff = 0;
+  double max_throttle_diff = 0;
+  double max_plan_diff = 0;
+  size_t fallback_mismatches = 0;
+
+  bool started = false;
+  uint64_t session = 0;
+  FlightLogReader reader;
+  FlightTick tick;
+  for (size_t i = 0; i < arguments.size(); ++i) {
+    if (!reader.Open(arguments[i])) {
+      std::cerr << "Not a flight log: " << arguments[i] << std::endl;
+      status = EX_DATAERR;
+      continue;
+    }
+    while (reader.Next(tick)) {
+      // Start afresh for each session, as it did when it connected (or when
+      // its first message arrived, for a log that doesn't say when that was).
+      const FlightSegmentHeader &header = reader.header();
+      if (!started || header.session != session) {
+        started = true;
+        session = header.session;
+        clock.Set(TimePoint(header.session_start_ns ?
+          header.session_start_ns : tick.received_ns));
+        mpc.Reset();
+      }
+
+      // Only replay the recorded solves: the controller never saw the
+      // telemetry that was dropped, and we don't know how far it got with
+      // any that was abandoned when the simulator disconnected.
+      if (tick.outcome != FLIGHT_SENT && tick.outcome != FLIGHT_CLOSED) {
+        continue;
+      }
+
+      clock.Set(TimePoint(tick.solve_start_ns));
+      const Telemetry &telemetry = tick.telemetry;
+      mpc.Update(telemetry.ptsx, telemetry.ptsy, telemetry.x, telemetry.y,
+        telemetry.psi, telemetry.speed, telemetry.steering_angle,
+        telemetry.throttle);
+
+      double steer_diff = std::fabs(mpc.steer() - tick.steering_angle);
+      double throttle_diff = std::fabs(mpc.throttle() - tick.throttle);
+      double plan_diff = PlanDifference(mpc, tick);
+      solve_times.push_back(mpc.solve_time);
+      max_steer_diff = std::max(max_steer_diff, steer_diff);
+      max_throttle_diff = std::max(max_throttle_diff, throttle_diff);
+      max_plan_diff = std::max(max_plan_diff, plan_diff);
+      if ((uint32_t)mpc.fallback_reason != tick.fallback_reason) {
+        ++fallback_mismatches;
+      }
+
+      std::cout << session << "," << tick.tick << "," <<
+        mpc.solve_time * 1e6 << "," << tick.solve_time * 1e6 << "," <<
+        mpc.latency << "," << tick.latency << "," <<
+        mpc.cost << "," << tick.cost << "," <<
+        mpc.fallback_reason << "," << tick.fallback_reason << "," <<
+        steer_diff << "," << throttle_diff << "," << plan_diff << std::endl;
+    }
+  }
+
+  std::cerr << "ticks=" << solve_times.size() <<
+    " solve_p50_us=" << Percentile(solve_times, 0.5) * 1e6 <<
+    " solve_p99_us=" << Percentile(solve_times, 0.99) * 1e6 <<
+    " max_steer_diff=" << max_steer_diff <<
+    " max_throttle_diff=" << max_throttle_diff <<
+    " max_plan_diff=" << max_plan_diff <<
+    " fallback_mismatches=" << fallback_mismatches << std::endl;
+  std::cerr << mpc << std::endl;
+
+  if (status == EX_OK && tolerance >= 0 &&
+    (max_steer_diff > tolerance || max_throttle_diff > tolerance)) {
+    status = 1;
+  }
+  return status;
+}
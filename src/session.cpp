@@ -0,0 +1,528 @@
+#include "session.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "binary_protocol.h"
+#include "steer_encoder.h"
+#include "telemetry.h"
+
+// Build the steer message with the actuations and plan from the given MPC,
+// with a SteerEncoder or a BinaryEncoder.
+template <typename Encoder>
+static void EncodeSteer(Encoder &encoder, const MPC &plan) {
+  static thread_local Eigen::ArrayXd next_y;
+
+  /*
+  * Calculate steeering angle and throttle using MPC.
+  *
+  * Both are in between [-1, 1].
+  */
+  // steer right: angle positive
+  // steer left: angle negative
+  encoder.Begin(plan.steer(), plan.throttle());
+
+  // Display the MPC predicted trajectory.
+  // The points are in reference to the vehicle's coordinate system.
+  // The points in the simulator are connected by a Green line.
+  double x, y;
+  encoder.BeginArray("mpc_x");
+  for (size_t i = 0; i < plan.problem.n; ++i) {
+    plan.PlanPoint(i, x, y);
+    encoder.Add(x);
+  }
+  encoder.EndArray();
+  encoder.BeginArray("mpc_y");
+  for (size_t i = 0; i < plan.problem.n; ++i) {
+    plan.PlanPoint(i, x, y);
+    encoder.Add(y);
+  }
+  encoder.EndArray();
+
+  //Display the waypoints/reference line
+  //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
+  // the points in the simulator are connected by a Yellow line
+  const Eigen::VectorXd &next_x = plan.reference.vehicle_ptsx;
+  plan.reference.Evaluate(next_x.array(), next_y);
+  encoder.BeginArray("next_x");
+  for (int i = 0; i < next_x.size(); ++i) encoder.Add(next_x(i));
+  encoder.EndArray();
+  encoder.BeginArray("next_y");
+  for (int i = 0; i < next_y.size(); ++i) encoder.Add(next_y(i));
+  encoder.EndArray();
+
+  encoder.End();
+}
+
+// Encoders for this thread, which are reused from message to message.
+static thread_local SteerEncoder text_encoder;
+static thread_local BinaryEncoder binary_encoder;
+
+WebSocketLink::WebSocketLink(uWS::WebSocket<uWS::SERVER> ws) :
+  ws(ws), binary_version(0)
+{ }
+
+void WebSocketLink::UseBinary(uint16_t version) {
+  binary_encoder.Hello(version);
+  ws.send(binary_encoder.data(), binary_encoder.length(),
+    uWS::OpCode::BINARY);
+  binary_version = version;
+}
+
+void WebSocketLink::SendManual() {
+  if (binary_version) {
+    binary_encoder.version = binary_version;
+    binary_encoder.Manual();
+    ws.send(binary_encoder.data(), binary_encoder.length(),
+      uWS::OpCode::BINARY);
+    return;
+  }
+
+  // Manual driving
+  std::string msg = "42[\"manual\",{}]";
+  ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
+}
+
+void WebSocketLink::SendActuations(const MPC &plan, uint64_t) {
+  if (binary_version) {
+    binary_encoder.version = binary_version;
+    EncodeSteer(binary_encoder, plan);
+    ws.send(binary_encoder.data(), binary_encoder.length(),
+      uWS::OpCode::BINARY);
+    return;
+  }
+
+  EncodeSteer(text_encoder, plan);
+  // std::cout << std::string(text_encoder.data(), text_encoder.length()) <<
+  //   std::endl;
+  ws.send(text_encoder.data(), text_encoder.length(), uWS::OpCode::TEXT);
+}
+
+void WebSocketLink::Close(int code) {
+  ws.close(code);
+}
+
+SessionSettings::SessionSettings() :
+  problem(reference),
+  mpc(reference, problem),
+  max_runtime(24 * 3600),
+  daemon(false),
+  track(nullptr),
+  hierarchical(false),
+  speculative(false),
+  actuation_delay(0.1),
+  simulated_clock(false),
+  solver_cpu(-1),
+  flight_segment_size(64 << 20)
+{ }
+
+size_t SessionSettings::solver_threads() const {
+  return 1 + (hierarchical ? 1 : 0) + (speculative ? 1 : 0) +
+    latency_quantiles.size();
+}
+
+Session::Session(const SessionSettings &settings, size_t id,
+  uv_loop_t *loop, std::unique_ptr<SessionLink> link) :
+  settings(settings),
+  session_id(id),
+  loop(loop),
+  warned_sim_time(false),
+  clock(settings.simulated_clock ? &simulated_clock : &Clock::steady()),
+  problem(reference),
+  mpc(reference, problem),
+  link(std::move(link)),
+  binary_version(0),
+  connected(true),
+  sequence(0),
+  actuation(loop, *clock, [this]() { SendActuations(); }),
+  first_tick(0),
+  num_ticks(0),
+  solver(loop,
+    [this](Telemetry &telemetry) { return Solve(telemetry); },
+    [this](int code) { Done(code); })
+{
+  {
+    std::lock_guard<std::mutex> lock(settings.mutex);
+    max_runtime = settings.max_runtime;
+    reference = settings.reference;
+    mpc.CopySettings(settings.mpc);
+  }
+
+  // A simulated clock starts at the real time, so that its times are close
+  // to those of sessions on the real clock, e.g. in the flight recorder.
+  if (settings.simulated_clock) {
+    simulated_start = Clock::steady().now();
+    simulated_clock.Set(simulated_start);
+    mpc.SetClock(clock);
+  }
+
+  if (settings.hierarchical) {
+    planner.reset(new LongHorizonPlanner);
+    planner->CopySettings(mpc);
+    mpc.SetHorizon(planner->tracking_n, problem.dt);
+  }
+
+  // If we have a plan to track, the track map is for the planner.
+  if (settings.track) {
+    if (planner) {
+      planner->SetTrack(settings.track);
+    } else {
+      reference.track = settings.track;
+    }
+  }
+
+  if (settings.speculative) {
+    speculative.reset(new SpeculativeSolver);
+  }
+
+  if (!settings.latency_quantiles.empty()) {
+    hypotheses.reset(new MultiHypothesisSolver(reference,
+      settings.latency_quantiles));
+    hypotheses->CopySettings(mpc);
+  }
+
+  if (!settings.flight_directory.empty()) {
+    recorder.reset(new FlightRecorder(loop, settings.flight_directory, id,
+      mpc.t_init, settings.flight_segment_size));
+    ticks.resize(4);
+  }
+
+  if (planner) planner->Start();
+  if (speculative) speculative->Start();
+  if (hypotheses) hypotheses->Start();
+  solver.Start(settings.solver_cpu);
+}
+
+Session::~Session() {
+  // Stop solving before the controller goes away.
+  solver.Stop();
+}
+
+void Session::OnMessage(const char *data, size_t length) {
+  // "42" at the start of the message means there's a websocket message event.
+  // Parse it straight into the solver's mailbox, which drops any telemetry
+  // that the solver has not started on yet.
+  Telemetry &telemetry = writable();
+  TelemetryEvent event = ParseTelemetry(data, length, telemetry);
+  if (event == TELEMETRY_INVALID) {
+    std::cerr << "Invalid telemetry: " << std::string(data, length) <<
+      std::endl;
+  } else if (event == TELEMETRY_MANUAL) {
+    OnManual();
+  } else if (event == TELEMETRY_OK) {
+    OnTelemetry();
+  }
+}
+
+void Session::OnBinaryMessage(const char *data, size_t length) {
+  BinaryHeader header;
+  bool valid = ParseBinaryHeader(data, length, header);
+  if (valid && header.type == BINARY_HELLO) {
+    // Agree on the newest version that we both speak, if any.
+    uint16_t version = std::min(header.version, BINARY_PROTOCOL_VERSION);
+    if (version < MIN_BINARY_PROTOCOL_VERSION) version = 0;
+    binary_version = version;
+    link->UseBinary(version);
+    return;
+  }
+
+  // Only take binary telemetry in the version that we agreed on.
+  TelemetryEvent event = TELEMETRY_INVALID;
+  if (valid && binary_version && header.version == binary_version) {
+    Telemetry &telemetry = writable();
+    event = ParseBinaryTelemetry(data, length, telemetry);
+  }
+  if (event == TELEMETRY_INVALID || event == TELEMETRY_NONE) {
+    std::cerr << "Invalid binary telemetry: " << length << " bytes" <<
+      std::endl;
+  } else if (event == TELEMETRY_MANUAL) {
+    OnManual();
+  } else if (event == TELEMETRY_OK) {
+    OnTelemetry();
+  }
+}
+
+Telemetry &Session::writable() {
+  Telemetry &telemetry = solver.writable();
+  telemetry.received = clock->now();
+  return telemetry;
+}
+
+// Nanoseconds since the steady clock's epoch, for the flight recorder.
+static int64_t Nanoseconds(std::chrono::steady_clock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    time.time_since_epoch()).count();
+}
+
+void Session::OnTelemetry() {
+  Telemetry &telemetry = solver.writable();
+  if (settings.simulated_clock) {
+    // The message arrived when the simulator sent it, in its own time.
+    if (telemetry.sim_time >= 0) {
+      Clock::time_point time = simulated_start +
+        std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(telemetry.sim_time));
+      if (time > simulated_clock.now()) simulated_clock.Set(time);
+    } else if (!warned_sim_time) {
+      std::cerr << "No simulator time in the telemetry; the simulated clock "
+        "will not move" << std::endl;
+      warned_sim_time = true;
+    }
+    telemetry.received = clock->now();
+  }
+  telemetry.posted = clock->now();
+  if (recorder) {
+    FlightTick &tick = ReceiveTick(telemetry.received).tick;
+    tick.posted_ns = Nanoseconds(telemetry.posted);
+    tick.telemetry = telemetry;
+  }
+
+  if (solver.Post() && recorder) {
+    // The dropped telemetry is the newest that we haven't finished with,
+    // before this one.
+    for (size_t i = num_ticks - 1; i-- > 0; ) {
+      PendingTick &pending = ticks[(first_tick + i) % ticks.size()];
+      if (!pending.finished) {
+        FinishTick(pending, FLIGHT_DROPPED);
+        break;
+      }
+    }
+  }
+}
+
+void Session::OnManual() {
+  if (recorder) {
+    PendingTick &pending = ReceiveTick(clock->now());
+    pending.tick.telemetry = Telemetry();
+    FinishTick(pending, FLIGHT_MANUAL);
+  }
+  link->SendManual();
+}
+
+void Session::OnDisconnection(std::function<void()> stopped) {
+  // Don't send to the simulator, which has gone.
+  connected = false;
+  actuation.Stop();
+
+  // Record the ticks that we hadn't finished with, which we never will.
+  if (recorder) {
+    while (PendingTick *pending = SolvingTick()) {
+      FinishTick(*pending, FLIGHT_ABANDONED);
+    }
+  }
+
+  this->stopped = stopped;
+  stopping.data = this;
+  uv_queue_work(loop, &stopping, OnStop, OnStopped);
+}
+
+void Session::OnStop(uv_work_t *request) {
+  // Stop the solver thread first, since it drives the others.
+  Session *session = (Session *)request->data;
+  session->solver.Stop();
+  if (session->planner) session->planner->Stop();
+  if (session->speculative) session->speculative->Stop();
+  if (session->hypotheses) session->hypotheses->Stop();
+}
+
+void Session::OnStopped(uv_work_t *request, int) {
+  // The callback may delete the session, so don't run it from there.
+  Session *session = (Session *)request->data;
+  std::function<void()> stopped = std::move(session->stopped);
+  stopped();
+}
+
+void Session::ReportStats() const {
+  if (solver.dropped > 0) {
+    std::cerr << "Dropped stale telemetry: " << solver.dropped << std::endl;
+  }
+  if (recorder && recorder->dropped > 0) {
+    std::cerr << "Ticks not recorded: " << recorder->dropped << std::endl;
+  }
+  if (speculative) {
+    std::cerr << "Speculative solves: hits=" << speculative->hits <<
+      " misses=" << speculative->misses << std::endl;
+  }
+}
+
+int Session::Solve(Telemetry &telemetry) {
+  arrival = clock->now();
+  received = telemetry.received;
+  sequence = telemetry.sequence;
+
+  std::vector<double> &ptsx = telemetry.ptsx;
+  std::vector<double> &ptsy = telemetry.ptsy;
+  double px = telemetry.x;
+  double py = telemetry.y;
+  double psi = telemetry.psi;
+  double speed = telemetry.speed;
+  double delta = telemetry.steering_angle;
+  double throttle = telemetry.throttle;
+
+  if (planner) {
+    // Track the long plan instead of the waypoints, once we have one.
+    planner->Submit(ptsx, ptsy, px, py, psi, speed);
+    planner->GetWaypoints(ptsx, ptsy);
+  }
+
+  if (speculative) {
+    speculative->Apply(mpc, px, py, psi);
+  }
+
+  if (hypotheses) {
+    mpc.Observe(ptsx, ptsy, px, py, psi, speed);
+    hypotheses->Solve(mpc, px, py, psi, speed, delta, throttle);
+  } else {
+    mpc.Update(ptsx, ptsy, px, py, psi, speed, delta, throttle);
+  }
+
+  // Stop if the car has crashed, or if we've run all the way to the
+  // deadline. The daemon reports the stats when the session ends.
+  int code = SEND_ACTUATIONS;
+  if (mpc.tuning && mpc.crashed) {
+    code = CLOSE_CRASHED;
+  } else if (mpc.tuning && mpc.runtime > max_runtime) {
+    code = CLOSE_FINISHED;
+  }
+  if (code != SEND_ACTUATIONS) {
+    if (!settings.daemon) std::cout << mpc << std::endl;
+    solved = clock->now();
+    return code;
+  }
+
+  // std::cout << "x =" << mpc.x_values() << std::endl;
+  // std::cout << "y =" << mpc.y_values() << std::endl;
+  // std::cout << "psi =" << mpc.psi_values() << std::endl;
+  // std::cout << "v =" << mpc.v_values() << std::endl;
+
+  // std::cout << "cte =" << mpc.cte_values() << std::endl;
+  // std::cout << "epsi =" << mpc.epsi_values() << std::endl;
+
+  // std::cout << "delta =" << mpc.delta_values() << std::endl;
+  // std::cout << "throttle =" << mpc.throttle_values() << std::endl;
+
+  if (speculative && !hypotheses) {
+    speculative->Speculate(mpc, px, py, psi);
+  }
+  solved = clock->now();
+  return SEND_ACTUATIONS;
+}
+
+void Session::Done(int code) {
+  if (!connected) {
+    // The simulator went away while we were solving.
+    solver.Release();
+  } else if (code != SEND_ACTUATIONS) {
+    if (recorder) {
+      RecordSolve(mpc, FLIGHT_CLOSED, std::chrono::steady_clock::time_point(),
+        std::chrono::steady_clock::time_point());
+    }
+    solver.Release();
+    link->Close(code == CLOSE_CRASHED ? CAR_CRASHED_CODE : MAX_RUNTIME_CODE);
+  } else if (settings.actuation_delay > 0) {
+    // Send the actuations once the actuation delay is up, leaving the event
+    // loop free in the meantime.
+    actuation.Start(settings.actuation_delay);
+  } else {
+    SendActuations();
+  }
+}
+
+void Session::SendActuations() {
+  // Choose between the latency hypotheses as late as possible, when we know
+  // how long we have taken since the telemetry arrived, including the time it
+  // waited for the solver.
+  const MPC *plan = &mpc;
+  if (hypotheses) {
+    std::chrono::duration<double> elapsed = clock->now() - received;
+    plan = &hypotheses->Choose(elapsed.count());
+  }
+
+  std::chrono::steady_clock::time_point send_start = clock->now();
+  link->SendActuations(*plan, sequence);
+  if (recorder) RecordSolve(*plan, FLIGHT_SENT, send_start, clock->now());
+
+  // We are done with the plan, so the solver can start on the newest
+  // telemetry.
+  solver.Release();
+}
+
+Session::PendingTick &Session::ReceiveTick(
+  std::chrono::steady_clock::time_point received)
+{
+  if (num_ticks == ticks.size()) {
+    // Make room, keeping the ticks in order.
+    std::rotate(ticks.begin(), ticks.begin() + first_tick, ticks.end());
+    first_tick = 0;
+    ticks.resize(2 * ticks.size());
+  }
+
+  PendingTick &pending = ticks[(first_tick + num_ticks++) % ticks.size()];
+  pending.finished = false;
+  FlightTick &tick = pending.tick;
+  tick.received_ns = Nanoseconds(received);
+  tick.posted_ns = 0;
+  tick.solve_start_ns = 0;
+  tick.solve_end_ns = 0;
+  tick.send_start_ns = 0;
+  tick.send_end_ns = 0;
+  tick.steering_angle = 0;
+  tick.throttle = 0;
+  tick.solve_time = 0;
+  tick.cost = 0;
+  tick.latency = 0;
+  tick.fallback_reason = 0;
+  tick.mpc_x.clear();
+  tick.mpc_y.clear();
+  return pending;
+}
+
+Session::PendingTick *Session::SolvingTick() {
+  for (size_t i = 0; i < num_ticks; ++i) {
+    PendingTick &pending = ticks[(first_tick + i) % ticks.size()];
+    if (!pending.finished) return &pending;
+  }
+  return nullptr;
+}
+
+void Session::RecordSolve(const MPC &plan, FlightOutcome outcome,
+  std::chrono::steady_clock::time_point send_start,
+  std::chrono::steady_clock::time_point send_end)
+{
+  PendingTick *pending = SolvingTick();
+  if (!pending) return;
+
+  FlightTick &tick = pending->tick;
+  tick.solve_start_ns = Nanoseconds(arrival);
+  tick.solve_end_ns = Nanoseconds(solved);
+  tick.send_start_ns = Nanoseconds(send_start);
+  tick.send_end_ns = Nanoseconds(send_end);
+
+  tick.steering_angle = plan.steer();
+  tick.throttle = plan.throttle();
+  tick.solve_time = plan.solve_time;
+  tick.cost = plan.cost;
+  tick.latency = plan.latency;
+  tick.fallback_reason = plan.fallback_reason;
+
+  tick.mpc_x.resize(plan.problem.n);
+  tick.mpc_y.resize(plan.problem.n);
+  for (size_t i = 0; i < plan.problem.n; ++i) {
+    plan.PlanPoint(i, tick.mpc_x[i], tick.mpc_y[i]);
+  }
+
+  FinishTick(*pending, outcome);
+}
+
+void Session::FinishTick(PendingTick &pending, FlightOutcome outcome) {
+  pending.tick.outcome = outcome;
+  pending.finished = true;
+  while (num_ticks > 0 && ticks[first_tick].finished) {
+    recorder->Record(ticks[first_tick].tick);
+    first_tick = (first_tick + 1) % ticks.size();
+    --num_ticks;
+  }
+}
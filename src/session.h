@@ -0,0 +1,301 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <uWS/uWS.h>
+#include <vector>
+
+#include "MPC.h"
+#include "actuation_delay.h"
+#include "clock.h"
+#include "close_codes.h"
+#include "dedicated_solver.h"
+#include "flight_recorder.h"
+#include "long_horizon_planner.h"
+#include "multi_hypothesis_solver.h"
+#include "problem.h"
+#include "reference_polynomial.h"
+#include "speculative_solver.h"
+#include "track_map.h"
+
+/**
+ * How to set up the controller for each session, from the command line.
+ *
+ * The prototype MPC (with its problem and reference) holds the settings that
+ * each session copies into its own controller.
+ */
+struct SessionSettings {
+  SessionSettings();
+
+  // Protects the prototype and max_runtime, which the daemon's control
+  // channel may change while sessions are starting on other threads.
+  mutable std::mutex mutex;
+
+  ReferencePolynomial reference;
+  Problem problem;
+  MPC mpc;
+
+  // When tuning, stop after this long, in seconds.
+  double max_runtime;
+
+  // Keep serving after each session, and report the results of each session
+  // as a line of JSON, rather than exiting.
+  bool daemon;
+
+  // Map of the whole track, if any.
+  const TrackMap *track;
+
+  // Plan a long way ahead in the background, and track that plan with a
+  // short horizon on each message.
+  bool hierarchical;
+
+  // Use the actuation delay to solve the next update's problem in the
+  // background, and use that solution as the next initial guess.
+  bool speculative;
+
+  // Solve for these quantiles of the latency in parallel, if any, and choose
+  // between them just before sending.
+  std::vector<double> latency_quantiles;
+
+  // Delay before sending the actuations, in seconds.
+  double actuation_delay;
+
+  // Run each session on its own simulated clock, which follows the
+  // simulator's time in the telemetry, so a simulator that steps as soon as
+  // it has the actuations can run faster than real time.
+  bool simulated_clock;
+
+  // Pin each session's solver thread to this CPU, if it is not negative.
+  int solver_cpu;
+
+  // Record every tick to segments of this size in this directory, if it is
+  // not empty.
+  std::string flight_directory;
+  size_t flight_segment_size;
+
+  /**
+   * Number of threads that each session solves on, for SetUpSolverThreads.
+   */
+  size_t solver_threads() const;
+};
+
+/**
+ * How a session talks back to its simulator, whatever the transport.
+ */
+class SessionLink {
+public:
+  virtual ~SessionLink() { }
+
+  /**
+   * Tell the simulator that we are not driving, because it is in manual
+   * mode.
+   */
+  virtual void SendManual() = 0;
+
+  /**
+   * Send the actuations from the given MPC, with its plan and reference for
+   * display, in reply to the telemetry with the given sequence number.
+   */
+  virtual void SendActuations(const MPC &plan, uint64_t sequence) = 0;
+
+  /**
+   * Reply to the simulator's binary HELLO with the version of the binary
+   * protocol that we will use, or 0 if there is none, and then send in that
+   * version. Only the WebSocket has a choice of protocols.
+   */
+  virtual void UseBinary(uint16_t) { }
+
+  /**
+   * End the session with one of the codes above. The transport reports the
+   * disconnection later, as if the simulator had closed it.
+   */
+  virtual void Close(int code) = 0;
+};
+
+/**
+ * Talks to the simulator with socket.io messages over a WebSocket.
+ */
+class WebSocketLink : public SessionLink {
+public:
+  explicit WebSocketLink(uWS::WebSocket<uWS::SERVER> ws);
+
+  virtual void SendManual();
+  virtual void SendActuations(const MPC &plan, uint64_t sequence);
+  virtual void UseBinary(uint16_t version);
+  virtual void Close(int code);
+
+private:
+  uWS::WebSocket<uWS::SERVER> ws;
+
+  // Version of the binary protocol, or 0 for socket.io text messages.
+  uint16_t binary_version;
+};
+
+/**
+ * A controller for one simulator connection, with its own MPC and solver
+ * threads, driven by the event loop of the thread that owns the connection.
+ * Create it when the simulator connects, on that thread, and delete it when
+ * the simulator disconnects.
+ */
+class Session {
+public:
+  Session(const SessionSettings &settings, size_t id, uv_loop_t *loop,
+    std::unique_ptr<SessionLink> link);
+
+  virtual ~Session();
+
+  /**
+   * Handle a socket.io message from the simulator.
+   */
+  void OnMessage(const char *data, size_t length);
+
+  /**
+   * Handle a binary frame from the simulator, in the protocol in
+   * binary_protocol.h.
+   */
+  void OnBinaryMessage(const char *data, size_t length);
+
+  /**
+   * The telemetry for a transport without socket.io messages to fill in
+   * before calling OnTelemetry. This marks it as received now.
+   */
+  Telemetry &writable();
+
+  /**
+   * Solve for the writable telemetry.
+   */
+  void OnTelemetry();
+
+  /**
+   * Handle a message from the simulator in manual mode.
+   */
+  void OnManual();
+
+  /**
+   * Stop sending to the simulator, which has gone, and stop solving. The
+   * solver threads are joined on the loop's thread pool, so that a solve in
+   * progress doesn't hold up the other sessions on the loop, and then
+   * `stopped` runs on the loop, where it can report the stats and delete the
+   * session.
+   */
+  void OnDisconnection(std::function<void()> stopped);
+
+  /**
+   * Print the session's stats to stderr.
+   */
+  void ReportStats() const;
+
+  // Identifies the session in reports.
+  size_t id() const { return session_id; }
+
+  // The controller, for its stats. Only use this once the session has
+  // stopped.
+  const MPC &controller() const { return mpc; }
+
+private:
+  // Codes from the solver thread to the loop.
+  enum { SEND_ACTUATIONS, CLOSE_CRASHED, CLOSE_FINISHED };
+
+  const SessionSettings &settings;
+
+  size_t session_id;
+
+  uv_loop_t *loop;
+
+  // Copied from the settings when the session starts.
+  double max_runtime;
+
+  // The session's own clock, if it runs on a simulated clock. Only the loop
+  // sets it, from the simulator's time in each telemetry message, counting
+  // from when the session started.
+  ManualClock simulated_clock;
+  Clock::time_point simulated_start;
+  bool warned_sim_time;
+
+  // Where the session and its controller get the time.
+  Clock *clock;
+
+  ReferencePolynomial reference;
+  Problem problem;
+  MPC mpc;
+
+  std::unique_ptr<LongHorizonPlanner> planner;
+  std::unique_ptr<SpeculativeSolver> speculative;
+  std::unique_ptr<MultiHypothesisSolver> hypotheses;
+
+  std::unique_ptr<SessionLink> link;
+
+  // Version of the binary protocol that we agreed on, if any.
+  uint16_t binary_version;
+
+  bool connected;
+
+  // When the latest solve's telemetry was received, when the solve started
+  // and ended, and the sequence number of its telemetry; the solver thread
+  // writes these before handing the result to the loop.
+  std::chrono::steady_clock::time_point received;
+  std::chrono::steady_clock::time_point arrival;
+  std::chrono::steady_clock::time_point solved;
+  uint64_t sequence;
+
+  ActuationDelay actuation;
+
+  // Records each message, if enabled. The loop fills in a tick when the
+  // message arrives, and the solve and actuations if they happen. The ticks
+  // wait here, in the order they arrived, until we know what became of each
+  // of them, so that they are recorded in that order. This is a ring buffer
+  // whose ticks are reused, so that their vectors keep their capacity.
+  std::unique_ptr<FlightRecorder> recorder;
+  struct PendingTick {
+    PendingTick() : finished(false) { }
+    FlightTick tick;
+    bool finished;
+  };
+  std::vector<PendingTick> ticks;
+  size_t first_tick;
+  size_t num_ticks;
+
+  // Last, so that its thread stops before the rest is destroyed.
+  DedicatedSolver solver;
+
+  // Joins the solver threads after a disconnection, and then calls stopped.
+  uv_work_t stopping;
+  std::function<void()> stopped;
+
+  // Solve for the newest telemetry, on the solver thread.
+  int Solve(Telemetry &telemetry);
+
+  // Handle a result from the solver thread, on the loop.
+  void Done(int code);
+
+  void SendActuations();
+
+  // Add a tick for a message that arrived at the given time.
+  PendingTick &ReceiveTick(std::chrono::steady_clock::time_point received);
+
+  // The oldest tick that we haven't finished with, which is the one that the
+  // solver is on (if any), or null if there is none.
+  PendingTick *SolvingTick();
+
+  // Fill in the latest solve and the actuations from the given plan, for the
+  // oldest unfinished tick, and finish it. The send times are zero if we
+  // didn't send the actuations.
+  void RecordSolve(const MPC &plan, FlightOutcome outcome,
+    std::chrono::steady_clock::time_point send_start,
+    std::chrono::steady_clock::time_point send_end);
+
+  // Set what became of a tick's message, and record the ticks that are
+  // ready.
+  void FinishTick(PendingTick &pending, FlightOutcome outcome);
+
+  static void OnStop(uv_work_t *request);
+  static void OnStopped(uv_work_t *request, int status);
+};
+
+#endif /* SESSION_H */
@@ -0,0 +1,176 @@
+#include "shm_channel.h"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+const char *const DEFAULT_SHM_NAME = "/mpc";
+
+// Identifies a segment whose rings are ready; the version is in the low bits,
+// and changes whenever the layout does.
+const uint32_t SHM_MAGIC = 0x4d504302;
+
+// Without futexes, check for new records this often, in milliseconds.
+const int POLL_INTERVAL_MS = 1;
+
+struct ShmChannel::Segment {
+  std::atomic<uint32_t> magic;
+  ShmRing<ShmTelemetry> telemetry;
+  ShmRing<ShmSteer> steer;
+};
+
+// The rings are shared between processes, so their atomics must not need
+// any state outside the segment.
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+  "atomics in shared memory must be plain words");
+
+#ifdef __linux__
+// Not FUTEX_PRIVATE_FLAG, because the other process waits on the same word.
+static void FutexWait(std::atomic<uint32_t> &word, uint32_t value,
+  int timeout_ms)
+{
+  struct timespec timeout;
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+  syscall(SYS_futex, (uint32_t *)&word, FUTEX_WAIT, value, &timeout,
+    nullptr, 0);
+}
+
+static void FutexWake(std::atomic<uint32_t> &word) {
+  syscall(SYS_futex, (uint32_t *)&word, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+}
+#else
+static void FutexWait(std::atomic<uint32_t> &word, uint32_t value,
+  int timeout_ms)
+{
+  if (word.load() != value) return;
+  int sleep_ms = timeout_ms < POLL_INTERVAL_MS ? timeout_ms : POLL_INTERVAL_MS;
+  usleep(sleep_ms * 1000);
+}
+
+static void FutexWake(std::atomic<uint32_t> &word) { }
+#endif
+
+template <typename Record>
+void ShmRing<Record>::Publish() {
+  head.store(head.load(std::memory_order_relaxed) + 1);
+  if (waiting.exchange(0)) FutexWake(head);
+}
+
+template <typename Record>
+bool ShmRing<Record>::Wait(uint32_t seen, int timeout_ms) {
+  // Say that we are waiting before checking the head one last time, so that
+  // either the writer sees the flag or we see its record.
+  waiting.store(1);
+  if (head.load() != seen) return true;
+  FutexWait(head, seen, timeout_ms);
+  return head.load() != seen;
+}
+
+template <typename Record>
+void ShmRing<Record>::Wake() {
+  FutexWake(head);
+}
+
+template class ShmRing<ShmTelemetry>;
+template class ShmRing<ShmSteer>;
+
+ShmChannel::ShmChannel() : owner(false), segment(nullptr) { }
+
+ShmChannel::~ShmChannel() {
+  Close();
+}
+
+bool ShmChannel::Create(const std::string &name) {
+  Close();
+
+  // Remove any segment left behind by a controller that did not exit
+  // cleanly, so a simulator can't attach to its stale rings.
+  shm_unlink(name.c_str());
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    std::cerr << "Failed to create shared memory " << name << ": " <<
+      strerror(errno) << std::endl;
+    return false;
+  }
+
+  void *memory = MAP_FAILED;
+  if (ftruncate(fd, sizeof(Segment)) == 0) {
+    memory = mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE,
+      MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (memory == MAP_FAILED) {
+    std::cerr << "Failed to map shared memory " << name << ": " <<
+      strerror(errno) << std::endl;
+    shm_unlink(name.c_str());
+    return false;
+  }
+
+  this->name = name;
+  owner = true;
+  segment = new (memory) Segment;
+  segment->magic.store(SHM_MAGIC);
+  return true;
+}
+
+bool ShmChannel::Open(const std::string &name) {
+  Close();
+
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0) return false;
+
+  struct stat status;
+  void *memory = MAP_FAILED;
+  if (fstat(fd, &status) == 0 && status.st_size == sizeof(Segment)) {
+    memory = mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE,
+      MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (memory == MAP_FAILED) return false;
+
+  Segment *opened = (Segment *)memory;
+  if (opened->magic.load() != SHM_MAGIC) {
+    munmap(memory, sizeof(Segment));
+    return false;
+  }
+
+  this->name = name;
+  owner = false;
+  segment = opened;
+  return true;
+}
+
+void ShmChannel::Close() {
+  if (!segment) return;
+  if (owner) {
+    segment->magic.store(0);
+    shm_unlink(name.c_str());
+  }
+  munmap(segment, sizeof(Segment));
+  segment = nullptr;
+  owner = false;
+}
+
+bool ShmChannel::live() const {
+  return segment && segment->magic.load() == SHM_MAGIC;
+}
+
+ShmRing<ShmTelemetry> &ShmChannel::telemetry() {
+  return segment->telemetry;
+}
+
+ShmRing<ShmSteer> &ShmChannel::steer() {
+  return segment->steer;
+}
@@ -0,0 +1,213 @@
+#ifndef SHM_CHANNEL_H
+#define SHM_CHANNEL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Most points that a record carries in each array; any more are dropped.
+const size_t SHM_MAX_POINTS = 256;
+
+// Number of records in each ring.
+const uint32_t SHM_RING_SIZE = 8;
+
+// Name of the segment when none is given.
+extern const char *const DEFAULT_SHM_NAME;
+
+enum ShmMessageType {
+  // Simulator to controller: a simulator has attached, with its pid.
+  SHM_CONNECT = 1,
+  // Simulator to controller: the car's state.
+  SHM_TELEMETRY,
+  // Simulator to controller: the simulator is in manual mode. The controller
+  // replies in kind.
+  SHM_MANUAL,
+  // Simulator to controller: the simulator has detached, with a close code.
+  SHM_DISCONNECT,
+  // Controller to simulator: the actuations and the plan.
+  SHM_STEER,
+  // Controller to simulator: end the session with the given code. The
+  // simulator replies with SHM_DISCONNECT and the same code.
+  SHM_CLOSE
+};
+
+/**
+ * A fixed layout record from the simulator, with the same fields as the
+ * telemetry message.
+ */
+struct ShmTelemetry {
+  uint32_t type;
+  int32_t code;
+  int32_t pid;
+  uint32_t num_points;
+
+  // Numbers the records that the simulator sends, from 1.
+  uint64_t sequence;
+
+  double x;
+  double y;
+  double psi;
+  double speed;
+  double steering_angle;
+  double throttle;
+
+  // The simulator's time in seconds since it started, or negative if it
+  // doesn't keep its own time (see Telemetry::sim_time).
+  double sim_time;
+
+  double ptsx[SHM_MAX_POINTS];
+  double ptsy[SHM_MAX_POINTS];
+};
+
+/**
+ * A fixed layout record from the controller, with the same fields as the
+ * steer message.
+ */
+struct ShmSteer {
+  uint32_t type;
+  int32_t code;
+  uint32_t num_plan;
+  uint32_t num_reference;
+
+  // The sequence number of the telemetry that this answers, so that the
+  // simulator can skip a late reply to telemetry that it gave up on. Other
+  // replies carry the sequence number of the latest record received.
+  uint64_t sequence;
+
+  double steering_angle;
+  double throttle;
+
+  double mpc_x[SHM_MAX_POINTS];
+  double mpc_y[SHM_MAX_POINTS];
+  double next_x[SHM_MAX_POINTS];
+  double next_y[SHM_MAX_POINTS];
+};
+
+/**
+ * A lock-free ring of records from one writer process to one reader process,
+ * in shared memory.
+ *
+ * The head and tail count the records written and read, and the reader
+ * sleeps on the head with a futex when the ring is empty. The writer only
+ * makes the wake up call when the reader has said that it is waiting, so a
+ * busy channel costs no system calls.
+ */
+template <typename Record>
+class ShmRing {
+public:
+  ShmRing() : head(0), tail(0), waiting(0) { }
+
+  /**
+   * The record for the writer to fill in before calling Publish, or null if
+   * the ring is full.
+   */
+  Record *writable() {
+    uint32_t next = head.load(std::memory_order_relaxed);
+    if (next - tail.load(std::memory_order_acquire) >= SHM_RING_SIZE) {
+      return nullptr;
+    }
+    return &records[next % SHM_RING_SIZE];
+  }
+
+  /**
+   * Hand the writable record to the reader, and wake it if it is waiting.
+   */
+  void Publish();
+
+  /**
+   * The oldest record that the reader has not consumed, or null if there is
+   * none.
+   */
+  const Record *readable() const {
+    uint32_t next = tail.load(std::memory_order_relaxed);
+    if (next == head.load(std::memory_order_acquire)) return nullptr;
+    return &records[next % SHM_RING_SIZE];
+  }
+
+  /**
+   * Free the readable record for the writer.
+   */
+  void Consume() {
+    tail.store(tail.load(std::memory_order_relaxed) + 1,
+      std::memory_order_release);
+  }
+
+  /**
+   * Number of records published so far, for Wait.
+   */
+  uint32_t published() const {
+    return head.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Wait until a record is published after `seen` records, or for the given
+   * time in milliseconds. Returns false if it timed out.
+   */
+  bool Wait(uint32_t seen, int timeout_ms);
+
+  /**
+   * Wake the reader from Wait, e.g. to stop it.
+   */
+  void Wake();
+
+private:
+  std::atomic<uint32_t> head;
+  std::atomic<uint32_t> tail;
+  std::atomic<uint32_t> waiting;
+
+  Record records[SHM_RING_SIZE];
+};
+
+/**
+ * A shared memory segment (from shm_open) with a ring for telemetry from the
+ * simulator to the controller and a ring for steer messages back, for a
+ * simulator on the same host. Unlike the WebSocket, there is no TCP,
+ * framing or JSON in the way: each side writes the fields straight into the
+ * other's memory.
+ *
+ * The controller creates the segment and the simulator opens it. The
+ * futexes are only available on Linux; elsewhere, the reader polls.
+ */
+class ShmChannel {
+public:
+  ShmChannel();
+
+  virtual ~ShmChannel();
+
+  /**
+   * Create the segment with the given name (e.g. "/mpc"), replacing any
+   * stale one. Returns false if it could not be created.
+   */
+  bool Create(const std::string &name);
+
+  /**
+   * Open a segment that the controller has created. Returns false if there
+   * is none yet.
+   */
+  bool Open(const std::string &name);
+
+  /**
+   * Unmap the segment, and remove its name if we created it.
+   */
+  void Close();
+
+  /**
+   * Is the segment still live? The controller clears its magic number when
+   * it closes the segment, so a simulator can tell that nobody will read
+   * its records any more.
+   */
+  bool live() const;
+
+  ShmRing<ShmTelemetry> &telemetry();
+  ShmRing<ShmSteer> &steer();
+
+private:
+  struct Segment;
+
+  std::string name;
+  bool owner;
+  Segment *segment;
+};
+
+#endif /* SHM_CHANNEL_H */
@@ -0,0 +1,211 @@
+#include "shm_server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <signal.h>
+
+// Close code for a simulator that went away without detaching, as for a
+// WebSocket that drops.
+const int ABNORMAL_CLOSE_CODE = 1006;
+
+// Check that the simulator is still running this often, in milliseconds.
+const int LIVENESS_CHECK_MS = 1000;
+
+// Write a close record, if the simulator has left room for it.
+static bool WriteClose(ShmChannel &channel, int code, uint64_t sequence) {
+  ShmSteer *record = channel.steer().writable();
+  if (!record) return false;
+  record->type = SHM_CLOSE;
+  record->code = code;
+  record->sequence = sequence;
+  record->num_plan = record->num_reference = 0;
+  channel.steer().Publish();
+  return true;
+}
+
+/**
+ * Writes the session's replies into the steer ring.
+ */
+class ShmServer::Link : public SessionLink {
+public:
+  /**
+   * @param received the sequence number of the latest record received, which
+   * must outlive the link
+   * @param pending_close where to leave a close code that did not fit in the
+   * ring, for the server to retry; it must outlive the link
+   */
+  Link(ShmChannel &channel, const uint64_t &received, int &pending_close) :
+    channel(channel), received(received), pending_close(pending_close) { }
+
+  virtual void SendManual() {
+    ShmSteer *record = channel.steer().writable();
+    if (!record) return;
+    record->type = SHM_MANUAL;
+    record->code = 0;
+    record->sequence = received;
+    record->num_plan = record->num_reference = 0;
+    channel.steer().Publish();
+  }
+
+  virtual void SendActuations(const MPC &plan, uint64_t sequence) {
+    // If the simulator has stopped reading, it has no use for more; it only
+    // acts on the latest actuations anyway.
+    ShmSteer *record = channel.steer().writable();
+    if (!record) return;
+    record->type = SHM_STEER;
+    record->code = 0;
+    record->sequence = sequence;
+    record->steering_angle = plan.steer();
+    record->throttle = plan.throttle();
+
+    record->num_plan = std::min(plan.problem.n, SHM_MAX_POINTS);
+    for (size_t i = 0; i < record->num_plan; ++i) {
+      plan.PlanPoint(i, record->mpc_x[i], record->mpc_y[i]);
+    }
+
+    const Eigen::VectorXd &next_x = plan.reference.vehicle_ptsx;
+    record->num_reference = std::min((size_t)next_x.size(), SHM_MAX_POINTS);
+    for (size_t i = 0; i < record->num_reference; ++i) {
+      record->next_x[i] = next_x(i);
+      record->next_y[i] = plan.reference.Evaluate(next_x(i));
+    }
+
+    channel.steer().Publish();
+  }
+
+  virtual void Close(int code) {
+    // Unlike the actuations, the simulator must see this. If the ring is
+    // full, the server tries again whenever the loop wakes, rather than
+    // blocking the loop until the simulator makes room.
+    if (!WriteClose(channel, code, received)) pending_close = code;
+  }
+
+private:
+  ShmChannel &channel;
+  const uint64_t &received;
+  int &pending_close;
+};
+
+ShmServer::ShmServer(uv_loop_t *loop, StartFunction start, EndFunction end) :
+  start(start),
+  end(end),
+  async(new uv_async_t),
+  running(false),
+  session(nullptr),
+  peer(0),
+  received(0),
+  pending_close(0)
+{
+  uv_async_init(loop, async, OnAsync);
+  async->data = this;
+}
+
+ShmServer::~ShmServer() {
+  Close();
+}
+
+bool ShmServer::Listen(const std::string &name) {
+  Stop();
+  if (!async) return false;
+  if (!channel.Create(name)) return false;
+  running = true;
+  waiter = std::thread(&ShmServer::Wait, this);
+  return true;
+}
+
+void ShmServer::Stop() {
+  if (running) {
+    running = false;
+    channel.telemetry().Wake();
+    waiter.join();
+  }
+  if (session) EndSession(ABNORMAL_CLOSE_CODE);
+  channel.Close();
+}
+
+void ShmServer::Close() {
+  Stop();
+  if (!async) return;
+  async->data = nullptr;
+  uv_close((uv_handle_t *)async, [](uv_handle_t *handle) {
+    delete (uv_async_t *)handle;
+  });
+  async = nullptr;
+}
+
+void ShmServer::Wait() {
+  ShmRing<ShmTelemetry> &ring = channel.telemetry();
+  uint32_t seen = ring.published();
+  while (running) {
+    // Wake the loop after a timeout, too, so it can check on the simulator.
+    ring.Wait(seen, LIVENESS_CHECK_MS);
+    seen = ring.published();
+    uv_async_send(async);
+  }
+}
+
+void ShmServer::Receive() {
+  // The simulator reads the steer ring before it sends more telemetry, so
+  // there may be room for a close that did not fit before.
+  if (pending_close && WriteClose(channel, pending_close, received)) {
+    pending_close = 0;
+  }
+
+  ShmRing<ShmTelemetry> &ring = channel.telemetry();
+  const ShmTelemetry *record;
+  while ((record = ring.readable())) {
+    received = record->sequence;
+    switch (record->type) {
+      case SHM_CONNECT:
+        // A new simulator replaces one that did not detach.
+        if (session) EndSession(ABNORMAL_CLOSE_CODE);
+        peer = record->pid;
+        session = start(std::unique_ptr<SessionLink>(
+          new Link(channel, received, pending_close)));
+        break;
+      case SHM_TELEMETRY:
+        if (session) {
+          // The vectors keep their capacity, so this does not allocate.
+          size_t num_points = std::min((size_t)record->num_points,
+            SHM_MAX_POINTS);
+          Telemetry &telemetry = session->writable();
+          telemetry.ptsx.assign(record->ptsx, record->ptsx + num_points);
+          telemetry.ptsy.assign(record->ptsy, record->ptsy + num_points);
+          telemetry.x = record->x;
+          telemetry.y = record->y;
+          telemetry.psi = record->psi;
+          telemetry.speed = record->speed;
+          telemetry.steering_angle = record->steering_angle;
+          telemetry.throttle = record->throttle;
+          telemetry.sequence = record->sequence;
+          telemetry.sim_time = record->sim_time;
+          session->OnTelemetry();
+        }
+        break;
+      case SHM_MANUAL:
+        if (session) session->OnManual();
+        break;
+      case SHM_DISCONNECT:
+        if (session) EndSession(record->code);
+        break;
+    }
+    ring.Consume();
+  }
+
+  if (session && peer > 0 && kill(peer, 0) != 0 && errno == ESRCH) {
+    EndSession(ABNORMAL_CLOSE_CODE);
+  }
+}
+
+void ShmServer::EndSession(int code) {
+  Session *ended = session;
+  session = nullptr;
+  peer = 0;
+  pending_close = 0;
+  end(ended, code);
+}
+
+void ShmServer::OnAsync(uv_async_t *async) {
+  ShmServer *server = (ShmServer *)async->data;
+  if (server) server->Receive();
+}
@@ -0,0 +1,88 @@
+#ifndef SHM_SERVER_H
+#define SHM_SERVER_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <uv.h>
+
+#include "session.h"
+#include "shm_channel.h"
+
+/**
+ * Serves one simulator at a time over a shared memory channel, on a libuv
+ * loop, as an alternative to the WebSocket for a simulator on the same host.
+ *
+ * A waiter thread sleeps on the telemetry ring's futex and wakes the loop
+ * through a uv_async_t; the loop then handles the records in order, just as
+ * it would handle WebSocket messages, so the sessions work the same way on
+ * either transport. If the simulator process goes away without detaching,
+ * the session ends as if its socket had dropped.
+ */
+class ShmServer {
+public:
+  // Create a session for a simulator that has connected.
+  typedef std::function<Session *(std::unique_ptr<SessionLink>)>
+    StartFunction;
+
+  // End a session, with a close code, and delete it.
+  typedef std::function<void(Session *, int)> EndFunction;
+
+  ShmServer(uv_loop_t *loop, StartFunction start, EndFunction end);
+
+  virtual ~ShmServer();
+
+  /**
+   * Create the segment with the given name and start waiting for a
+   * simulator. Returns false if the segment could not be created.
+   */
+  bool Listen(const std::string &name);
+
+  /**
+   * Stop the waiter thread, end any session and remove the segment.
+   */
+  void Stop();
+
+  /**
+   * Stop, and close the server's handle on the loop, so that the loop can
+   * exit. Call on the loop thread. The server can't Listen again.
+   */
+  void Close();
+
+private:
+  class Link;
+
+  ShmChannel channel;
+
+  StartFunction start;
+  EndFunction end;
+
+  // Heap allocated, because libuv may still use it for a loop iteration
+  // after we close it.
+  uv_async_t *async;
+
+  std::thread waiter;
+  std::atomic<bool> running;
+
+  // The connected simulator's session and process, if any, the sequence
+  // number of the latest record, and the code of a close that is waiting
+  // for room in the steer ring, if any. Only the loop thread uses these.
+  Session *session;
+  int peer;
+  uint64_t received;
+  int pending_close;
+
+  // Wake the loop whenever there are new records.
+  void Wait();
+
+  // Handle the new records, on the loop thread.
+  void Receive();
+
+  void EndSession(int code);
+
+  static void OnAsync(uv_async_t *async);
+};
+
+#endif /* SHM_SERVER_H */
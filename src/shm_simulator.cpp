@@ -0,0 +1,211 @@
+//
+// A stand-in for the simulator that drives mpc over shared memory, for
+// exercising the shared memory transport without the Unity simulator. It
+// drives the kinematic vehicle simulator (vehicle_simulator.h) around the
+// track map, sends the telemetry that the simulator would, applies the
+// actuations that come back and reports the round trip times. Usage:
+//
+//   ./mpc --shm --latency-ms=0 &
+//   ./shm_simulator [--shm=/mpc] [--track=lake_track_waypoints.csv]
+//     [--steps=1000] [--dt=0.1] [--fast]
+//
+// With --fast, it sends the next telemetry as soon as the actuations arrive,
+// rather than every dt seconds. The telemetry carries the simulator's time,
+// so mpc --simulated-clock sees dt pass between messages either way.
+//
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <sysexits.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "close_codes.h"
+#include "shm_channel.h"
+#include "tool_support.h"
+#include "track_map.h"
+#include "vehicle_simulator.h"
+
+// Give up on a reply after this long, in milliseconds.
+const int REPLY_TIMEOUT_MS = 1000;
+
+// Wait this long for the controller to create the segment, in seconds.
+const int OPEN_TIMEOUT_S = 10;
+
+// Give up on sending a record after waiting this long for room in the ring,
+// in milliseconds.
+const int SEND_TIMEOUT_MS = 1000;
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * Send a record with the simulator's telemetry. Returns false if the
+ * controller has closed the segment, or has not made room for the record in
+ * time, e.g. because it has died.
+ */
+static bool Send(ShmChannel &channel, uint32_t type, int code,
+  uint64_t sequence, VehicleSimulator &simulator, Telemetry &telemetry)
+{
+  ShmRing<ShmTelemetry> &ring = channel.telemetry();
+  ShmTelemetry *record;
+  Clock::time_point give_up =
+    Clock::now() + std::chrono::milliseconds(SEND_TIMEOUT_MS);
+  for (;;) {
+    if (!channel.live()) {
+      std::cerr << "Controller closed the shared memory" << std::endl;
+      return false;
+    }
+    record = ring.writable();
+    if (record) break;
+    if (Clock::now() > give_up) {
+      std::cerr << "Controller is not reading the shared memory" << std::endl;
+      return false;
+    }
+    // The controller has fallen behind; let it catch up.
+    std::this_thread::yield();
+  }
+  record->type = type;
+  record->code = code;
+  record->pid = getpid();
+  record->sequence = sequence;
+
+  simulator.Observe(telemetry);
+  record->num_points = std::min(telemetry.ptsx.size(), SHM_MAX_POINTS);
+  std::copy(telemetry.ptsx.begin(),
+    telemetry.ptsx.begin() + record->num_points, record->ptsx);
+  std::copy(telemetry.ptsy.begin(),
+    telemetry.ptsy.begin() + record->num_points, record->ptsy);
+  record->x = telemetry.x;
+  record->y = telemetry.y;
+  record->psi = telemetry.psi;
+  record->speed = telemetry.speed;
+  record->steering_angle = telemetry.steering_angle;
+  record->throttle = telemetry.throttle;
+  record->sim_time = telemetry.sim_time;
+  ring.Publish();
+  return true;
+}
+
+int main(int argc, char **argv) {
+  std::map<std::string, std::string> options;
+  std::vector<std::string> arguments;
+  ParseArguments(argc, argv, options, arguments);
+
+  std::string name = options.count("shm") && !options["shm"].empty() ?
+    options["shm"] : DEFAULT_SHM_NAME;
+  std::string track_pathname = options.count("track") ?
+    options["track"] : "lake_track_waypoints.csv";
+  size_t steps = options.count("steps") ?
+    atoi(options["steps"].c_str()) : 1000;
+  double dt = options.count("dt") ? atof(options["dt"].c_str()) : 0.1;
+  bool fast = options.count("fast") > 0;
+
+  TrackMap track;
+  if (!track.Load(track_pathname)) {
+    std::cerr << "Failed to load track from " << track_pathname << std::endl;
+    return EX_NOINPUT;
+  }
+
+  ShmChannel channel;
+  Clock::time_point give_up =
+    Clock::now() + std::chrono::seconds(OPEN_TIMEOUT_S);
+  while (!channel.Open(name)) {
+    if (Clock::now() > give_up) {
+      std::cerr << "No controller on shared memory " << name << std::endl;
+      return EX_UNAVAILABLE;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+
+  // Drop any replies meant for a simulator before us.
+  ShmRing<ShmSteer> &replies = channel.steer();
+  while (replies.readable()) replies.Consume();
+
+  VehicleSimulator simulator(track);
+  Telemetry telemetry;
+  uint64_t sequence = 0;
+  if (!Send(channel, SHM_CONNECT, 0, ++sequence, simulator, telemetry)) {
+    return EX_UNAVAILABLE;
+  }
+
+  std::vector<double> round_trips;
+  round_trips.reserve(steps);
+  size_t lost = 0;
+  size_t stale = 0;
+  int close_code = NORMAL_CLOSE_CODE;
+  bool controller_gone = false;
+  Clock::time_point next_step = Clock::now();
+  for (size_t step = 0; step < steps; ++step) {
+    uint32_t seen = replies.published();
+    Clock::time_point sent = Clock::now();
+    if (!Send(channel, SHM_TELEMETRY, 0, ++sequence, simulator, telemetry)) {
+      controller_gone = true;
+      break;
+    }
+
+    // Wait for the actuations, skipping any late replies to telemetry that
+    // we gave up on. A close can come at any time.
+    const ShmSteer *reply = nullptr;
+    for (;;) {
+      reply = replies.readable();
+      if (reply && reply->type != SHM_CLOSE && reply->sequence != sequence) {
+        ++stale;
+        replies.Consume();
+        continue;
+      }
+      if (reply) break;
+
+      int waited_ms = (int)std::chrono::duration_cast<
+        std::chrono::milliseconds>(Clock::now() - sent).count();
+      if (waited_ms >= REPLY_TIMEOUT_MS) break;
+      replies.Wait(seen, REPLY_TIMEOUT_MS - waited_ms);
+      seen = replies.published();
+    }
+    if (!reply) {
+      ++lost;
+      simulator.Step(dt);
+      continue;
+    }
+    std::chrono::duration<double> round_trip = Clock::now() - sent;
+    round_trips.push_back(round_trip.count());
+
+    uint32_t type = reply->type;
+    double steer = reply->steering_angle;
+    double throttle = reply->throttle;
+    int code = reply->code;
+    replies.Consume();
+
+    if (type == SHM_CLOSE) {
+      close_code = code;
+      break;
+    }
+    if (type == SHM_STEER) {
+      simulator.Actuate(steer, throttle);
+    }
+    simulator.Step(dt);
+
+    if (!fast) {
+      next_step += std::chrono::microseconds((long)(dt * 1e6));
+      std::this_thread::sleep_until(next_step);
+    }
+  }
+
+  if (!controller_gone) {
+    Send(channel, SHM_DISCONNECT, close_code, ++sequence, simulator,
+      telemetry);
+  }
+
+  std::cout << "steps: " << round_trips.size() << " lost: " << lost <<
+    " stale: " << stale <<
+    " close code: " << close_code << " distance: " <<
+    simulator.distance() << "m" << std::endl;
+  std::cout << "round trip (ms): median " <<
+    Percentile(round_trips, 0.5) * 1e3 << " p99 " <<
+    Percentile(round_trips, 0.99) * 1e3 << " max " <<
+    Percentile(round_trips, 1) * 1e3 << std::endl;
+  return controller_gone ? EX_UNAVAILABLE : EX_OK;
+}
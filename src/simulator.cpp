@@ -0,0 +1,338 @@
+//
+// Drive the kinematic vehicle simulator (vehicle_simulator.h) around the
+// track in closed loop, either with the controller in process or as a local
+// stand-in for the Unity simulator that connects to mpc. Usage:
+//
+//   ./simulator [--runtime=60] [--latency-ms=100] [--real-time] [options]
+//
+//   ./mpc &
+//   ./simulator --connect[=ws://localhost:4567] [--binary] [--fast]
+//     [--dt=0.1] [--runtime=60] [options]
+//
+// In process, the controller takes the time from the simulator, so the run
+// goes as fast as the solver allows, unless --real-time is given. Each
+// telemetry message goes out --latency-ms after the previous actuations,
+// which take effect then, as with the Unity simulator and mpc's actuation
+// delay; the time spent solving passes in the simulation, too. The options
+// that configure the plain MPC in mpc (e.g. --track, --fallback) apply.
+//
+// Over the WebSocket, the simulator sends telemetry like the Unity
+// simulator's (or in the binary protocol, with --binary), applies the
+// actuations as they arrive (the controller has its own --latency-ms) and
+// advances the model by the real time between them. With --fast, it
+// advances by --dt instead, and sends the next telemetry straight away; run
+// mpc with --simulated-clock, which follows the simulator's time in the
+// telemetry, to match.
+//
+// Other options: --waypoints (default: lake_track_waypoints.csv) is the
+// track to drive; --latency-jitter-ms, --position-noise (m),
+// --heading-noise (radians), --speed-noise (mph), --steer-noise and
+// --throttle-noise are standard deviations of Gaussian noise; and --seed
+// seeds it. The run stops after --runtime simulated seconds or when the car
+// leaves the track, and the results are printed to stderr.
+//
+#include <uWS/uWS.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <string>
+#include <sysexits.h>
+#include <thread>
+#include <vector>
+
+#include "binary_protocol.h"
+#include "clock.h"
+#include "close_codes.h"
+#include "controller_options.h"
+#include "json.hpp"
+#include "MPC.h"
+#include "tool_support.h"
+#include "vehicle_simulator.h"
+
+using json = nlohmann::json;
+
+// The car has left the track if it is this far from the center, in meters.
+const double MAX_CTE = 4.5;
+
+static double Option(std::map<std::string, std::string> &options,
+  const std::string &name, double default_value)
+{
+  return options.count(name) ? atof(options[name].c_str()) : default_value;
+}
+
+// Statistics for a run, whichever way the controller is connected.
+struct RunStats {
+  RunStats() : ticks(0), total_absolute_cte(0), max_absolute_cte(0),
+    start(std::chrono::steady_clock::now()) { }
+
+  size_t ticks;
+  double total_absolute_cte;
+  double max_absolute_cte;
+
+  // Solve times in process, or round trips over the WebSocket, in seconds.
+  std::vector<double> times;
+
+  std::chrono::steady_clock::time_point start;
+
+  void Observe(const VehicleSimulator &simulator, double time) {
+    double cte = std::fabs(simulator.cte());
+    ++ticks;
+    total_absolute_cte += cte;
+    max_absolute_cte = std::max(max_absolute_cte, cte);
+    times.push_back(time);
+  }
+
+  void Report(const VehicleSimulator &simulator, const TrackMap &track,
+    const char *times_name) const
+  {
+    std::chrono::duration<double> real =
+      std::chrono::steady_clock::now() - start;
+    std::cerr << "ticks=" << ticks <<
+      " simulated_s=" << simulator.time() <<
+      " real_s=" << real.count() <<
+      " speedup=" << simulator.time() / real.count() <<
+      " laps=" << simulator.distance() / track.length() <<
+      " mean_abs_cte=" << (ticks ? total_absolute_cte / ticks : 0) <<
+      " max_abs_cte=" << max_absolute_cte <<
+      " " << times_name << "_p50_ms=" << Percentile(times, 0.5) * 1e3 <<
+      " " << times_name << "_p99_ms=" << Percentile(times, 0.99) * 1e3 <<
+      std::endl;
+  }
+};
+
+// Run the controller in process, on the simulator's time.
+static int RunInProcess(std::map<std::string, std::string> &options,
+  VehicleSimulator &simulator, const TrackMap &waypoints, double runtime)
+{
+  TrackMap track;
+  ReferencePolynomial reference;
+  Problem problem(reference);
+  MPC mpc(reference, problem);
+  mpc.tuning = true;
+  int status = ConfigureController(options, track, reference, problem, mpc);
+  if (status != EX_OK) return status;
+
+  bool real_time = options.count("real-time") > 0;
+
+  Clock::time_point origin = Clock::steady().now();
+  ManualClock clock;
+  clock.Set(origin);
+  mpc.SetClock(&clock);
+
+  RunStats stats;
+  Telemetry telemetry;
+  bool crashed = false;
+  while (simulator.time() < runtime) {
+    simulator.Observe(telemetry);
+    clock.Set(origin + std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(simulator.time())));
+    mpc.Update(telemetry.ptsx, telemetry.ptsy, telemetry.x, telemetry.y,
+      telemetry.psi, telemetry.speed, telemetry.steering_angle,
+      telemetry.throttle);
+    stats.Observe(simulator, mpc.solve_time);
+    if (std::fabs(simulator.cte()) > MAX_CTE) {
+      crashed = true;
+      break;
+    }
+
+    // The car carries on while we solve, and the next telemetry comes once
+    // the actuations have had their latency.
+    simulator.Step(mpc.solve_time);
+    simulator.Actuate(mpc.steer(), mpc.throttle());
+    if (real_time) {
+      std::this_thread::sleep_for(std::chrono::duration<double>(
+        simulator.actuation_latency));
+    }
+    simulator.Step(simulator.actuation_latency);
+  }
+
+  stats.Report(simulator, waypoints, "solve");
+  std::cout << mpc << std::endl;
+  return crashed ? 1 : EX_OK;
+}
+
+// Read the actuations from a socket.io steer message.
+static bool ParseSteer(const char *data, size_t length,
+  double &steering_angle, double &throttle)
+{
+  if (length < 2 || data[0] != '4' || data[1] != '2') return false;
+  try {
+    json message = json::parse(data + 2, data + length);
+    if (!message.is_array() || message.size() < 2 ||
+      message[0] != "steer") {
+      return false;
+    }
+    steering_angle = message[1]["steering_angle"];
+    throttle = message[1]["throttle"];
+    return true;
+  } catch (const std::exception &) {
+    // Malformed, or a manual reply without the actuations.
+    return false;
+  }
+}
+
+/**
+ * Plays the Unity simulator's part over a WebSocket to mpc.
+ */
+class WebSocketClient {
+public:
+  WebSocketClient(VehicleSimulator &simulator, const TrackMap &waypoints,
+    double runtime, bool binary, double fast_dt) :
+    simulator(simulator), waypoints(waypoints), runtime(runtime),
+    binary(binary), fast_dt(fast_dt) { }
+
+  void OnConnection(uWS::WebSocket<uWS::CLIENT> ws) {
+    if (binary) {
+      // Wait for mpc to agree on a version before sending telemetry.
+      encoder.Hello(BINARY_PROTOCOL_VERSION);
+      ws.send(encoder.data(), encoder.length(), uWS::OpCode::BINARY);
+    } else {
+      SendTelemetry(ws);
+    }
+  }
+
+  void OnMessage(uWS::WebSocket<uWS::CLIENT> ws, const char *data,
+    size_t length, uWS::OpCode op_code)
+  {
+    double steering_angle, throttle;
+    if (op_code == uWS::OpCode::BINARY) {
+      BinaryHeader header;
+      if (!ParseBinaryHeader(data, length, header)) return;
+      if (header.type == BINARY_HELLO) {
+        encoder.version = header.version;
+        if (header.version == 0) {
+          std::cerr << "No binary protocol version in common; using text" <<
+            std::endl;
+        }
+        SendTelemetry(ws);
+        return;
+      }
+      if (!ParseBinarySteer(data, length, steering_angle, throttle)) return;
+    } else if (!ParseSteer(data, length, steering_angle, throttle)) {
+      return;
+    }
+
+    // The previous actuations were in effect until now.
+    std::chrono::duration<double> round_trip =
+      std::chrono::steady_clock::now() - sent;
+    simulator.Step(fast_dt > 0 ? fast_dt : round_trip.count());
+    simulator.Actuate(steering_angle, throttle);
+    stats.Observe(simulator, round_trip.count());
+
+    if (simulator.time() >= runtime ||
+      std::fabs(simulator.cte()) > MAX_CTE) {
+      ws.close(NORMAL_CLOSE_CODE);
+      return;
+    }
+    SendTelemetry(ws);
+  }
+
+  int OnDisconnection(int code) {
+    stats.Report(simulator, waypoints, "round_trip");
+    if (code == CAR_CRASHED_CODE || std::fabs(simulator.cte()) > MAX_CTE) {
+      return 1;
+    }
+    if (code == NORMAL_CLOSE_CODE || code == MAX_RUNTIME_CODE) return EX_OK;
+    std::cerr << "Disconnected: code=" << code << std::endl;
+    return EX_UNAVAILABLE;
+  }
+
+private:
+  VehicleSimulator &simulator;
+  const TrackMap &waypoints;
+  double runtime;
+  bool binary;
+  double fast_dt;
+
+  Telemetry telemetry;
+  BinaryEncoder encoder;
+  std::chrono::steady_clock::time_point sent;
+  RunStats stats;
+
+  void SendTelemetry(uWS::WebSocket<uWS::CLIENT> ws) {
+    simulator.Observe(telemetry);
+    sent = std::chrono::steady_clock::now();
+    if (encoder.version > 0) {
+      encoder.EncodeTelemetry(telemetry);
+      ws.send(encoder.data(), encoder.length(), uWS::OpCode::BINARY);
+      return;
+    }
+
+    json data;
+    data["ptsx"] = telemetry.ptsx;
+    data["ptsy"] = telemetry.ptsy;
+    data["psi"] = telemetry.psi;
+    data["psi_unity"] = std::fmod(2.5 * M_PI - telemetry.psi, 2 * M_PI);
+    data["x"] = telemetry.x;
+    data["y"] = telemetry.y;
+    data["steering_angle"] = telemetry.steering_angle;
+    data["throttle"] = telemetry.throttle;
+    data["speed"] = telemetry.speed;
+    data["sim_time"] = telemetry.sim_time;
+    std::string frame = "42[\"telemetry\"," + data.dump() + "]";
+    ws.send(frame.data(), frame.length(), uWS::OpCode::TEXT);
+  }
+};
+
+static int RunWebSocket(std::map<std::string, std::string> &options,
+  VehicleSimulator &simulator, const TrackMap &waypoints, double runtime)
+{
+  std::string uri = options["connect"].empty() ?
+    "ws://localhost:4567" : options["connect"];
+  double fast_dt = options.count("fast") ? Option(options, "dt", 0.1) : 0;
+  WebSocketClient client(simulator, waypoints, runtime,
+    options.count("binary") > 0, fast_dt);
+
+  uWS::Hub h;
+  h.onConnection([&client](uWS::WebSocket<uWS::CLIENT> ws, uWS::HttpRequest req) {
+    client.OnConnection(ws);
+  });
+  h.onMessage([&client](uWS::WebSocket<uWS::CLIENT> ws, char *data, size_t length, uWS::OpCode opCode) {
+    client.OnMessage(ws, data, length, opCode);
+  });
+  h.onDisconnection([&client](uWS::WebSocket<uWS::CLIENT> ws, int code, char *message, size_t length) {
+    exit(client.OnDisconnection(code));
+  });
+  h.onError([uri](void *user) {
+    std::cerr << "Failed to connect to " << uri << std::endl;
+    exit(EX_UNAVAILABLE);
+  });
+  h.connect(uri, nullptr);
+  h.run();
+  return EX_OK;
+}
+
+int main(int argc, char **argv) {
+  std::map<std::string, std::string> options;
+  std::vector<std::string> arguments;
+  ParseArguments(argc, argv, options, arguments);
+
+  std::string waypoints_pathname = options.count("waypoints") ?
+    options["waypoints"] : "lake_track_waypoints.csv";
+  TrackMap waypoints;
+  if (!waypoints.Load(waypoints_pathname)) {
+    std::cerr << "Failed to load track from " << waypoints_pathname <<
+      std::endl;
+    return EX_NOINPUT;
+  }
+
+  bool connect = options.count("connect") > 0;
+  VehicleSimulator simulator(waypoints);
+  simulator.actuation_latency =
+    Option(options, "latency-ms", connect ? 0 : 100) / 1000;
+  simulator.latency_jitter = Option(options, "latency-jitter-ms", 0) / 1000;
+  simulator.position_noise = Option(options, "position-noise", 0);
+  simulator.heading_noise = Option(options, "heading-noise", 0);
+  simulator.speed_noise = Option(options, "speed-noise", 0);
+  simulator.steer_noise = Option(options, "steer-noise", 0);
+  simulator.throttle_noise = Option(options, "throttle-noise", 0);
+  simulator.Seed((unsigned)Option(options, "seed", 1));
+  double runtime = Option(options, "runtime", 60);
+
+  if (connect) return RunWebSocket(options, simulator, waypoints, runtime);
+  return RunInProcess(options, simulator, waypoints, runtime);
+}
@@ -0,0 +1,90 @@
+#include "smoothing_spline.h"
+
+#include <algorithm>
+#include <cassert>
+#include "Eigen-3.3/Eigen/Cholesky"
+
+const int SPLINE_DEGREE = SmoothingSpline::Spline::Degree;
+
+SmoothingSpline::SmoothingSpline(int segments, double smoothing) :
+  segments(segments),
+  smoothing(smoothing),
+  x_min(0),
+  x_range(1),
+  knots(segments + 2 * SPLINE_DEGREE + 1),
+  ata(segments + SPLINE_DEGREE, segments + SPLINE_DEGREE),
+  aty(segments + SPLINE_DEGREE)
+{
+  // Clamped knots: repeat the end knots so the spline starts and ends at
+  // the first and last control points.
+  for (int i = 0; i < knots.size(); ++i) {
+    int k = std::min(std::max(i - SPLINE_DEGREE, 0), segments);
+    knots(i) = (double)k / segments;
+  }
+}
+
+void SmoothingSpline::Fit(const Eigen::VectorXd &xs,
+  const Eigen::VectorXd &ys, const Eigen::VectorXd &weights)
+{
+  x_min = xs.minCoeff();
+  x_range = xs.maxCoeff() - x_min;
+  assert(x_range > 0);
+
+  // Each point only touches the Degree + 1 basis functions that are nonzero
+  // in its knot span.
+  ata.setZero();
+  aty.setZero();
+  double total_weight = 0;
+  for (int i = 0; i < xs.size(); ++i) {
+    double u = (xs(i) - x_min) / x_range;
+    Eigen::DenseIndex span = Spline::Span(u, SPLINE_DEGREE, knots);
+    Spline::BasisVectorType basis =
+      Spline::BasisFunctions(u, SPLINE_DEGREE, knots);
+    Eigen::DenseIndex first = span - SPLINE_DEGREE;
+    double w = weights(i);
+    for (int j = 0; j <= SPLINE_DEGREE; ++j) {
+      for (int k = 0; k <= SPLINE_DEGREE; ++k) {
+        ata(first + j, first + k) += w * basis(j) * basis(k);
+      }
+      aty(first + j) += w * basis(j) * ys(i);
+    }
+    total_weight += w;
+  }
+
+  // Second difference penalty: (c[j] - 2 c[j + 1] + c[j + 2])^2.
+  double lambda = smoothing * total_weight;
+  const double D[3] = { 1, -2, 1 };
+  for (int j = 0; j + 2 < ata.rows(); ++j) {
+    for (int a = 0; a < 3; ++a) {
+      for (int b = 0; b < 3; ++b) {
+        ata(j + a, j + b) += lambda * D[a] * D[b];
+      }
+    }
+  }
+
+  Eigen::VectorXd ctrls = ata.ldlt().solve(aty);
+  spline = Spline(knots, ctrls.transpose());
+}
+
+void SmoothingSpline::Evaluate(double x, double &value, double &slope,
+  double &second) const
+{
+  double u = (x - x_min) / x_range;
+  double clamped_u = std::min(std::max(u, 0.0), 1.0);
+  Eigen::Matrix<double, 1, 3> derivatives =
+    spline.derivatives<2>(clamped_u);
+  value = derivatives(0);
+  slope = derivatives(1) / x_range;
+  second = derivatives(2) / (x_range * x_range);
+
+  if (u != clamped_u) {
+    value += slope * (x - (x_min + clamped_u * x_range));
+    second = 0;
+  }
+}
+
+double SmoothingSpline::Evaluate(double x) const {
+  double value, slope, second;
+  Evaluate(x, value, slope, second);
+  return value;
+}
@@ -0,0 +1,63 @@
+#ifndef SMOOTHING_SPLINE_H
+#define SMOOTHING_SPLINE_H
+
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/unsupported/Eigen/Splines"
+
+/**
+ * Weighted least squares fit of a cubic B-spline y = f(x), with a penalty on
+ * the second differences of the control points to keep it smooth (a
+ * "P-spline").
+ *
+ * The knots are evenly spaced over the range of the x values, so each fit
+ * only has a handful of control points, and the normal equations are small
+ * and banded. Evaluation uses the vendored Eigen Splines module. Outside the
+ * range of the x values, the spline is extended along its tangent at the end.
+ */
+class SmoothingSpline {
+public:
+  typedef Eigen::Spline<double, 1, 3> Spline;
+
+  /**
+   * @param segments number of polynomial pieces
+   * @param smoothing weight of the second difference penalty, relative to
+   *        the total weight of the points
+   */
+  SmoothingSpline(int segments, double smoothing);
+
+  /**
+   * Fit the spline to the given points. There must be at least two distinct
+   * x values.
+   */
+  void Fit(const Eigen::VectorXd &xs, const Eigen::VectorXd &ys,
+    const Eigen::VectorXd &weights);
+
+  /**
+   * Evaluate the spline and its first and second derivatives at x.
+   */
+  void Evaluate(double x, double &value, double &slope, double &second)
+    const;
+
+  /**
+   * Evaluate the spline at x.
+   */
+  double Evaluate(double x) const;
+
+private:
+  int segments;
+  double smoothing;
+
+  // Range of x values in the fit; the spline parameter is u = (x - x_min) /
+  // x_range, in [0, 1].
+  double x_min;
+  double x_range;
+
+  Spline::KnotVectorType knots;
+  Spline spline;
+
+  // Normal equations; kept here to reuse their storage.
+  Eigen::MatrixXd ata;
+  Eigen::VectorXd aty;
+};
+
+#endif /* SMOOTHING_SPLINE_H */
@@ -0,0 +1,81 @@
+#include "solver_threads.h"
+
+#include <atomic>
+#include <cassert>
+#include <cppad/cppad.hpp>
+#include <vector>
+
+namespace {
+  // Number of threads that CppAD was set up for.
+  size_t max_solver_threads = 1;
+
+  // The next thread number to hand out; the main thread is number 0.
+  std::atomic<size_t> next_thread_number(1);
+
+  thread_local size_t this_thread_number = 0;
+
+  // Thread numbers given up by threads that have finished.
+  std::mutex thread_numbers_mutex;
+  std::vector<size_t> free_thread_numbers;
+
+  std::string linear_solver;
+  bool linear_solver_thread_safe = false;
+  std::mutex solver_mutex;
+
+  bool in_parallel() {
+    return next_thread_number > 1;
+  }
+
+  size_t thread_number() {
+    return this_thread_number;
+  }
+}
+
+void SetUpSolverThreads(size_t max_threads) {
+  assert(!in_parallel());
+  max_solver_threads = max_threads;
+  CppAD::thread_alloc::parallel_setup(max_threads, in_parallel, thread_number);
+  CppAD::parallel_ad<double>();
+}
+
+void RegisterSolverThread() {
+  {
+    std::lock_guard<std::mutex> lock(thread_numbers_mutex);
+    if (!free_thread_numbers.empty()) {
+      this_thread_number = free_thread_numbers.back();
+      free_thread_numbers.pop_back();
+      return;
+    }
+  }
+  this_thread_number = next_thread_number++;
+  assert(this_thread_number < max_solver_threads);
+}
+
+void UnregisterSolverThread() {
+  if (this_thread_number == 0) return;
+  CppAD::thread_alloc::free_available(this_thread_number);
+  std::lock_guard<std::mutex> lock(thread_numbers_mutex);
+  free_thread_numbers.push_back(this_thread_number);
+  this_thread_number = 0;
+}
+
+void SetLinearSolver(const std::string &name, bool thread_safe) {
+  linear_solver = name;
+  linear_solver_thread_safe = thread_safe;
+}
+
+bool LinearSolverThreadSafe() {
+  return linear_solver_thread_safe;
+}
+
+std::string LinearSolverOptions() {
+  if (linear_solver.empty()) return "";
+  return "String  linear_solver       " + linear_solver + "\n";
+}
+
+std::unique_lock<std::mutex> LockSolver() {
+  if (linear_solver_thread_safe) {
+    return std::unique_lock<std::mutex>(solver_mutex, std::defer_lock);
+  }
+  return std::unique_lock<std::mutex>(solver_mutex);
+}
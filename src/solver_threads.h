@@ -0,0 +1,59 @@
+#ifndef SOLVER_THREADS_H
+#define SOLVER_THREADS_H
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+
+/**
+ * Support for solving on more than one thread.
+ *
+ * CppAD has to be told up front how many threads will record tapes, and it
+ * has to be able to tell which thread is which. Ipopt is only thread safe if
+ * its linear solver is; MUMPS, which install_ipopt.sh builds, is not. So,
+ * unless a thread safe linear solver (e.g. one of the HSL solvers) is
+ * configured, the Ipopt solves themselves are serialized with a global lock.
+ * Everything else, such as fitting the reference, can still run in parallel.
+ */
+
+/**
+ * Prepare CppAD for up to max_threads threads (including the main thread).
+ * Call this from the main thread before starting any threads that solve.
+ */
+void SetUpSolverThreads(size_t max_threads);
+
+/**
+ * Give the calling thread its own CppAD thread number. Call this once at the
+ * start of each thread (other than the main thread) that solves.
+ */
+void RegisterSolverThread();
+
+/**
+ * Give up the calling thread's CppAD thread number, so that a later thread
+ * can reuse it. Call this at the end of each thread that registered.
+ */
+void UnregisterSolverThread();
+
+/**
+ * Use the given Ipopt linear solver (e.g. "ma27"). If `thread_safe` is true,
+ * solves on different threads are allowed to run concurrently.
+ */
+void SetLinearSolver(const std::string &name, bool thread_safe);
+
+/**
+ * Can solves on different threads run concurrently?
+ */
+bool LinearSolverThreadSafe();
+
+/**
+ * Ipopt options for the configured linear solver, if any.
+ */
+std::string LinearSolverOptions();
+
+/**
+ * Hold this while calling Ipopt. It does nothing if the linear solver is
+ * thread safe.
+ */
+std::unique_lock<std::mutex> LockSolver();
+
+#endif /* SOLVER_THREADS_H */
@@ -0,0 +1,137 @@
+#include "speculative_solver.h"
+
+#include <cmath>
+#include <vector>
+
+#include "solver_threads.h"
+#include "wrap_angle.h"
+
+// Linearly interpolate between values spaced dt apart at time t, holding the
+// last value past the end.
+static double Interpolate(const std::vector<double> &values, double dt,
+  double t)
+{
+  double k = t / dt;
+  size_t i = (size_t)k;
+  if (i + 1 >= values.size()) return values.back();
+  double w = k - i;
+  return (1 - w) * values[i] + w * values[i + 1];
+}
+
+SpeculativeSolver::SpeculativeSolver() :
+  hits(0),
+  misses(0),
+  problem(reference),
+  mpc(reference, problem),
+  running(false),
+  state(IDLE)
+{ }
+
+SpeculativeSolver::~SpeculativeSolver() {
+  Stop();
+}
+
+void SpeculativeSolver::Start() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (running) return;
+  running = true;
+  thread = std::thread(&SpeculativeSolver::Run, this);
+}
+
+void SpeculativeSolver::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!running) return;
+    running = false;
+  }
+  condition.notify_one();
+  thread.join();
+}
+
+void SpeculativeSolver::Speculate(
+  const MPC &source, double px, double py, double psi)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+
+  // If the previous speculative solve is still running, let it be; it is
+  // too late to start another one.
+  if (state == SOLVING) return;
+
+  reference = source.reference;
+  problem.CopySettings(source.problem);
+  mpc.SetHorizon(source.problem.n, source.problem.dt);
+  mpc.vars = source.vars;
+
+  // The next update will project forward from its telemetry by about one
+  // latency, and its telemetry should arrive about one latency after this
+  // update's telemetry. The plan starts one latency after this update's
+  // telemetry, so the next initial state is about one latency into the plan.
+  x0 = Interpolate(source.x_values(), problem.dt, source.latency);
+  y0 = Interpolate(source.y_values(), problem.dt, source.latency);
+  psi0 = Interpolate(source.psi_values(), problem.dt, source.latency);
+  v0 = Interpolate(source.v_values(), problem.dt, source.latency);
+
+  pose_x = px;
+  pose_y = py;
+  pose_psi = psi;
+
+  state = PENDING;
+  lock.unlock();
+  condition.notify_one();
+}
+
+bool SpeculativeSolver::Apply(MPC &target, double px, double py, double psi)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (state != DONE || target.problem.n != problem.n ||
+    target.problem.dt != problem.dt) {
+    if (state != IDLE) ++misses;
+    return false;
+  }
+  state = IDLE;
+  ++hits;
+
+  // Transform the states from the speculative solve's vehicle coordinates
+  // into the target's vehicle coordinates, via world coordinates.
+  double cos_from = cos(pose_psi);
+  double sin_from = sin(pose_psi);
+  double cos_to = cos(psi);
+  double sin_to = sin(psi);
+
+  // The headings are in [0, 2 pi), so wrap the rotation, or the predicted
+  // headings would be off by 2 pi when the car's heading crosses 0.
+  double rotation = WrapAngle(pose_psi - psi);
+  for (size_t i = 0; i < problem.n; ++i) {
+    double x = mpc.vars[problem.x_start + i];
+    double y = mpc.vars[problem.y_start + i];
+    double world_x = pose_x + x * cos_from - y * sin_from - px;
+    double world_y = pose_y + x * sin_from + y * cos_from - py;
+    target.vars[problem.x_start + i] = world_x * cos_to + world_y * sin_to;
+    target.vars[problem.y_start + i] = -world_x * sin_to + world_y * cos_to;
+    target.vars[problem.psi_start + i] =
+      mpc.vars[problem.psi_start + i] + rotation;
+    target.vars[problem.v_start + i] = mpc.vars[problem.v_start + i];
+  }
+  for (size_t i = problem.delta_start; i < problem.n_vars; ++i) {
+    target.vars[i] = mpc.vars[i];
+  }
+  return true;
+}
+
+void SpeculativeSolver::Run() {
+  RegisterSolverThread();
+
+  std::unique_lock<std::mutex> lock(mutex);
+  while (running) {
+    condition.wait(lock, [this] { return !running || state == PENDING; });
+    if (!running) break;
+
+    state = SOLVING;
+    lock.unlock();
+    mpc.Solve(x0, y0, psi0, v0);
+    lock.lock();
+    state = DONE;
+  }
+
+  UnregisterSolverThread();
+}
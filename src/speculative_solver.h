@@ -0,0 +1,84 @@
+#ifndef SPECULATIVE_SOLVER_H
+#define SPECULATIVE_SOLVER_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "MPC.h"
+#include "problem.h"
+#include "reference_polynomial.h"
+
+/**
+ * Solve the next update's problem in the background, while we wait out the
+ * actuation delay.
+ *
+ * The next update will start from where the current plan says the car will
+ * be about one latency from the start of the plan, so we solve from there
+ * with the current reference. When the next telemetry arrives, we transform
+ * that solution into the new vehicle coordinates and use it as the initial
+ * guess, so the real solve has less work to do.
+ */
+class SpeculativeSolver {
+public:
+  SpeculativeSolver();
+
+  virtual ~SpeculativeSolver();
+
+  // Number of speculative solutions that were used as an initial guess.
+  size_t hits;
+
+  // Number of speculative solutions that were not ready or did not match.
+  size_t misses;
+
+  /**
+   * Start the background thread.
+   */
+  void Start();
+
+  /**
+   * Stop the background thread and wait for it to finish.
+   */
+  void Stop();
+
+  /**
+   * Start a speculative solve from the given MPC's latest solution. The pose
+   * is the car's pose in world coordinates for that solve.
+   */
+  void Speculate(const MPC &source, double px, double py, double psi);
+
+  /**
+   * If the speculative solve has finished, and it matches the target's
+   * horizon, use it as the target's initial guess and return true. The pose
+   * is the car's pose in world coordinates for the upcoming solve.
+   */
+  bool Apply(MPC &target, double px, double py, double psi);
+
+private:
+  enum State { IDLE, PENDING, SOLVING, DONE };
+
+  ReferencePolynomial reference;
+  Problem problem;
+  MPC mpc;
+
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable condition;
+
+  // The following are protected by the mutex.
+  bool running;
+  State state;
+  double x0;
+  double y0;
+  double psi0;
+  double v0;
+
+  // Pose of the vehicle coordinate system for the speculative solve.
+  double pose_x;
+  double pose_y;
+  double pose_psi;
+
+  void Run();
+};
+
+#endif /* SPECULATIVE_SOLVER_H */
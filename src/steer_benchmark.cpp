@@ -0,0 +1,288 @@
+//
+// Benchmark encoding the steer message with the JSON library, as main.cpp
+// used to, with the SteerEncoder and with the BinaryEncoder, and check that
+// they all give the same numbers. Then compare parsing telemetry frames in
+// the socket.io text protocol and in the binary protocol. Usage:
+//
+//   ./steer_benchmark [messages]
+//
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <sysexits.h>
+#include <vector>
+
+#include "binary_protocol.h"
+#include "json.hpp"
+#include "steer_encoder.h"
+#include "telemetry.h"
+
+using json = nlohmann::json;
+
+// Size of the plan and number of waypoints, as in the default MPC settings.
+const size_t N = 20;
+const size_t WAYPOINTS = 6;
+
+typedef std::chrono::steady_clock Clock;
+
+// Count heap allocations, to check that the encoder doesn't make any. The
+// replacements are not inlined, so that GCC doesn't see memory from
+// operator new going to free (or from malloc going to operator delete) and
+// warn about mismatched allocation functions.
+static size_t allocations = 0;
+
+__attribute__((noinline)) void *operator new(size_t size) {
+  ++allocations;
+  void *p = malloc(size);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+  free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept {
+  free(p);
+}
+
+// Vehicle coordinates for a plan and the waypoints.
+struct Plan {
+  double steering_angle;
+  double throttle;
+  std::vector<double> mpc_x;
+  std::vector<double> mpc_y;
+  std::vector<double> next_x;
+  std::vector<double> next_y;
+};
+
+static Plan RandomPlan(std::mt19937 &random) {
+  std::uniform_real_distribution<double> unit(-1, 1);
+  Plan plan;
+  plan.steering_angle = 0.1 * unit(random);
+  plan.throttle = unit(random);
+  for (size_t i = 0; i < N; ++i) {
+    plan.mpc_x.push_back(i * (1 + 0.1 * unit(random)));
+    plan.mpc_y.push_back(0.01 * i * i * unit(random));
+  }
+  for (size_t i = 0; i < WAYPOINTS; ++i) {
+    plan.next_x.push_back(10 * i + unit(random));
+    plan.next_y.push_back(0.02 * i * i * unit(random));
+  }
+  return plan;
+}
+
+// The message as main.cpp used to build it.
+static std::string JsonMessage(const Plan &plan) {
+  json msgJson;
+  msgJson["steering_angle"] = plan.steering_angle;
+  msgJson["throttle"] = plan.throttle;
+  msgJson["mpc_x"] = plan.mpc_x;
+  msgJson["mpc_y"] = plan.mpc_y;
+  msgJson["next_x"] = plan.next_x;
+  msgJson["next_y"] = plan.next_y;
+  return "42[\"steer\"," + msgJson.dump() + "]";
+}
+
+template <typename Encoder>
+static void AddArray(Encoder &encoder, const char *name,
+  const std::vector<double> &values)
+{
+  encoder.BeginArray(name);
+  for (size_t i = 0; i < values.size(); ++i) encoder.Add(values[i]);
+  encoder.EndArray();
+}
+
+template <typename Encoder>
+static void EncodeMessage(Encoder &encoder, const Plan &plan) {
+  encoder.Begin(plan.steering_angle, plan.throttle);
+  AddArray(encoder, "mpc_x", plan.mpc_x);
+  AddArray(encoder, "mpc_y", plan.mpc_y);
+  AddArray(encoder, "next_x", plan.next_x);
+  AddArray(encoder, "next_y", plan.next_y);
+  encoder.End();
+}
+
+// Count the numbers in the message that don't read back exactly.
+static size_t CountMismatches(const std::string &message, const Plan &plan) {
+  // Strip the 42[ and ] around the event.
+  json event = json::parse(message.substr(2));
+  const json &data = event[1];
+  size_t mismatches = 0;
+  mismatches += data["steering_angle"].get<double>() != plan.steering_angle;
+  mismatches += data["throttle"].get<double>() != plan.throttle;
+  const char *names[] = { "mpc_x", "mpc_y", "next_x", "next_y" };
+  const std::vector<double> *values[] = {
+    &plan.mpc_x, &plan.mpc_y, &plan.next_x, &plan.next_y };
+  for (size_t k = 0; k < 4; ++k) {
+    std::vector<double> parsed = data[names[k]];
+    mismatches += parsed != *values[k];
+  }
+  return mismatches;
+}
+
+// Count the numbers in the binary message that don't read back exactly.
+static size_t CountBinaryMismatches(const BinaryEncoder &encoder,
+  const Plan &plan)
+{
+  size_t mismatches = 0;
+  double steering_angle, throttle;
+  if (!ParseBinarySteer(encoder.data(), encoder.length(), steering_angle,
+    throttle)) {
+    return 6;
+  }
+  mismatches += steering_angle != plan.steering_angle;
+  mismatches += throttle != plan.throttle;
+
+  // The arrays follow the header and the actuations, each with its count.
+  const char *p = encoder.data() + BINARY_HEADER_SIZE + 2 * sizeof(double);
+  const std::vector<double> *values[] = {
+    &plan.mpc_x, &plan.mpc_y, &plan.next_x, &plan.next_y };
+  for (size_t k = 0; k < 4; ++k) {
+    uint32_t count;
+    memcpy(&count, p, sizeof(count));
+    p += sizeof(count);
+    std::vector<double> parsed(count);
+    memcpy(parsed.data(), p, count * sizeof(double));
+    p += count * sizeof(double);
+    mismatches += parsed != *values[k];
+  }
+  return mismatches;
+}
+
+// A telemetry frame like the simulator's, in the socket.io text protocol.
+static std::string TelemetryFrame(const Telemetry &telemetry) {
+  json data;
+  data["ptsx"] = telemetry.ptsx;
+  data["ptsy"] = telemetry.ptsy;
+  data["psi_unity"] = 4.12;
+  data["psi"] = telemetry.psi;
+  data["x"] = telemetry.x;
+  data["y"] = telemetry.y;
+  data["steering_angle"] = telemetry.steering_angle;
+  data["throttle"] = telemetry.throttle;
+  data["speed"] = telemetry.speed;
+  return "42[\"telemetry\"," + data.dump() + "]";
+}
+
+static Telemetry RandomTelemetry(std::mt19937 &random) {
+  std::uniform_real_distribution<double> unit(-1, 1);
+  Telemetry telemetry;
+  telemetry.x = 100 * unit(random);
+  telemetry.y = 100 * unit(random);
+  telemetry.psi = M_PI * unit(random);
+  telemetry.speed = 50 + 50 * unit(random);
+  telemetry.steering_angle = 0.4 * unit(random);
+  telemetry.throttle = unit(random);
+  for (size_t i = 0; i < WAYPOINTS; ++i) {
+    telemetry.ptsx.push_back(telemetry.x + 10 * i + unit(random));
+    telemetry.ptsy.push_back(telemetry.y + 10 * i + unit(random));
+  }
+  return telemetry;
+}
+
+// Parse each frame in turn, and return the time per frame in microseconds.
+template <typename Parse>
+static double TimeParse(const std::vector<std::string> &frames,
+  size_t messages, Parse parse)
+{
+  Telemetry telemetry;
+  size_t failures = 0;
+  Clock::time_point t0 = Clock::now();
+  for (size_t i = 0; i < messages; ++i) {
+    const std::string &frame = frames[i % frames.size()];
+    failures += parse(frame.data(), frame.size(), telemetry) != TELEMETRY_OK;
+  }
+  Clock::time_point t1 = Clock::now();
+  if (failures > 0) std::cerr << "Failed to parse: " << failures << std::endl;
+  return 1e6 * std::chrono::duration<double>(t1 - t0).count() / messages;
+}
+
+int main(int argc, char **argv) {
+  size_t messages = argc > 1 ? atoi(argv[1]) : 100000;
+
+  std::mt19937 random(0);
+  std::vector<Plan> plans;
+  for (size_t i = 0; i < 100; ++i) plans.push_back(RandomPlan(random));
+
+  size_t json_bytes = 0;
+  size_t start_allocations = allocations;
+  Clock::time_point t0 = Clock::now();
+  for (size_t i = 0; i < messages; ++i) {
+    json_bytes += JsonMessage(plans[i % plans.size()]).size();
+  }
+  Clock::time_point t1 = Clock::now();
+  size_t json_allocations = allocations - start_allocations;
+
+  SteerEncoder encoder;
+  size_t encoder_bytes = 0;
+  start_allocations = allocations;
+  Clock::time_point t2 = Clock::now();
+  for (size_t i = 0; i < messages; ++i) {
+    EncodeMessage(encoder, plans[i % plans.size()]);
+    encoder_bytes += encoder.length();
+  }
+  Clock::time_point t3 = Clock::now();
+  size_t encoder_allocations = allocations - start_allocations;
+
+  BinaryEncoder binary;
+  size_t binary_bytes = 0;
+  start_allocations = allocations;
+  Clock::time_point t4 = Clock::now();
+  for (size_t i = 0; i < messages; ++i) {
+    EncodeMessage(binary, plans[i % plans.size()]);
+    binary_bytes += binary.length();
+  }
+  Clock::time_point t5 = Clock::now();
+  size_t binary_allocations = allocations - start_allocations;
+
+  size_t json_mismatches = 0;
+  size_t encoder_mismatches = 0;
+  size_t binary_mismatches = 0;
+  for (size_t i = 0; i < plans.size(); ++i) {
+    json_mismatches += CountMismatches(JsonMessage(plans[i]), plans[i]);
+    EncodeMessage(encoder, plans[i]);
+    encoder_mismatches += CountMismatches(
+      std::string(encoder.data(), encoder.length()), plans[i]);
+    EncodeMessage(binary, plans[i]);
+    binary_mismatches += CountBinaryMismatches(binary, plans[i]);
+  }
+
+  double json_time = std::chrono::duration<double>(t1 - t0).count();
+  double encoder_time = std::chrono::duration<double>(t3 - t2).count();
+  double binary_time = std::chrono::duration<double>(t5 - t4).count();
+  std::cout <<
+    "   json: us=" << 1e6 * json_time / messages <<
+    " bytes=" << json_bytes / messages <<
+    " allocations=" << double(json_allocations) / messages <<
+    " mismatched_fields=" << json_mismatches << std::endl <<
+    "encoder: us=" << 1e6 * encoder_time / messages <<
+    " bytes=" << encoder_bytes / messages <<
+    " allocations=" << double(encoder_allocations) / messages <<
+    " mismatched_fields=" << encoder_mismatches << std::endl <<
+    " binary: us=" << 1e6 * binary_time / messages <<
+    " bytes=" << binary_bytes / messages <<
+    " allocations=" << double(binary_allocations) / messages <<
+    " mismatched_fields=" << binary_mismatches << std::endl;
+
+  std::vector<std::string> text_frames, binary_frames;
+  for (size_t i = 0; i < 100; ++i) {
+    Telemetry telemetry = RandomTelemetry(random);
+    text_frames.push_back(TelemetryFrame(telemetry));
+    binary.EncodeTelemetry(telemetry);
+    binary_frames.push_back(std::string(binary.data(), binary.length()));
+  }
+  std::cout <<
+    "telemetry text: us=" << TimeParse(text_frames, messages, ParseTelemetry)
+      << " bytes=" << text_frames[0].size() << std::endl <<
+    "telemetry binary: us=" <<
+      TimeParse(binary_frames, messages, ParseBinaryTelemetry) <<
+      " bytes=" << binary_frames[0].size() << std::endl;
+
+  return EX_OK;
+}
@@ -0,0 +1,68 @@
+#include "steer_encoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "format_double.h"
+
+// Initial size of the buffer; a message with 20 steps in the plan and six
+// waypoints takes about 1kB.
+const size_t INITIAL_BUFFER_SIZE = 4096;
+
+SteerEncoder::SteerEncoder() :
+  buffer(INITIAL_BUFFER_SIZE), size(0), first_value(true)
+{ }
+
+void SteerEncoder::Begin(double steering_angle, double throttle) {
+  size = 0;
+  AppendString("42[\"steer\",{\"steering_angle\":");
+  AppendNumber(steering_angle);
+  AppendString(",\"throttle\":");
+  AppendNumber(throttle);
+}
+
+void SteerEncoder::BeginArray(const char *name) {
+  AppendString(",\"");
+  AppendString(name);
+  AppendString("\":[");
+  first_value = true;
+}
+
+void SteerEncoder::Add(double value) {
+  if (!first_value) Append(",", 1);
+  first_value = false;
+  AppendNumber(value);
+}
+
+void SteerEncoder::EndArray() {
+  Append("]", 1);
+}
+
+void SteerEncoder::End() {
+  Append("}]", 2);
+}
+
+char *SteerEncoder::Reserve(size_t count) {
+  if (size + count > buffer.size()) {
+    buffer.resize(std::max(2 * buffer.size(), size + count));
+  }
+  return &buffer[size];
+}
+
+void SteerEncoder::Append(const char *text, size_t length) {
+  memcpy(Reserve(length), text, length);
+  size += length;
+}
+
+void SteerEncoder::AppendString(const char *text) {
+  Append(text, strlen(text));
+}
+
+void SteerEncoder::AppendNumber(double value) {
+  if (!std::isfinite(value)) {
+    Append("null", 4);
+    return;
+  }
+  char *start = Reserve(FORMAT_DOUBLE_BUFFER_SIZE);
+  size += FormatDouble(start, value) - start;
+}
@@ -0,0 +1,66 @@
+#ifndef STEER_ENCODER_H
+#define STEER_ENCODER_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Writes the steer message for the simulator, like
+ *
+ *   42["steer",{"steering_angle":0.1,"throttle":0.5,"mpc_x":[...],...}]
+ *
+ * directly into a buffer that is reused from message to message, so encoding
+ * does not allocate once the buffer is big enough. Numbers are written with
+ * the fewest digits that read back as the same double.
+ *
+ * Usage: Begin, then BeginArray, Add and EndArray for each array, then End.
+ * The message is in data() and length() until the next Begin.
+ */
+class SteerEncoder {
+public:
+  SteerEncoder();
+
+  /**
+   * Start a new message with the given actuations, in [-1, 1].
+   */
+  void Begin(double steering_angle, double throttle);
+
+  /**
+   * Start an array of numbers with the given name, which is written as is.
+   */
+  void BeginArray(const char *name);
+
+  /**
+   * Add a number to the current array. Numbers that are not finite are
+   * written as null.
+   */
+  void Add(double value);
+
+  void EndArray();
+
+  void End();
+
+  const char *data() const { return &buffer[0]; }
+
+  size_t length() const { return size; }
+
+private:
+  std::vector<char> buffer;
+
+  // Length of the message so far.
+  size_t size;
+
+  // Is the next value the first in its array?
+  bool first_value;
+
+  // Make room for `count` more characters and return where they go.
+  char *Reserve(size_t count);
+
+  void Append(const char *text, size_t length);
+
+  void AppendString(const char *text);
+
+  void AppendNumber(double value);
+};
+
+#endif /* STEER_ENCODER_H */
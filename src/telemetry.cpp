@@ -0,0 +1,241 @@
+#include "telemetry.h"
+
+#include <cstdlib>
+#include <cstring>
+
+// Capacity to reserve for the waypoints; the simulator sends six.
+const size_t RESERVED_WAYPOINTS = 64;
+
+// Longest number we accept, in characters.
+const size_t MAX_NUMBER_LENGTH = 63;
+
+// Deepest nesting of values that we skip over.
+const int MAX_DEPTH = 32;
+
+// Bits for the fields that we require.
+enum {
+  FIELD_PTSX = 1 << 0,
+  FIELD_PTSY = 1 << 1,
+  FIELD_X = 1 << 2,
+  FIELD_Y = 1 << 3,
+  FIELD_PSI = 1 << 4,
+  FIELD_SPEED = 1 << 5,
+  FIELD_STEERING_ANGLE = 1 << 6,
+  FIELD_THROTTLE = 1 << 7,
+  ALL_FIELDS = (1 << 8) - 1
+};
+
+Telemetry::Telemetry() :
+  x(0), y(0), psi(0), speed(0), steering_angle(0), throttle(0), sequence(0),
+  sim_time(-1)
+{
+  ptsx.reserve(RESERVED_WAYPOINTS);
+  ptsy.reserve(RESERVED_WAYPOINTS);
+}
+
+namespace {
+
+// Position in a frame; all reads are bounds checked against `end`.
+struct Cursor {
+  const char *p;
+  const char *end;
+
+  void SkipSpace() {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+      ++p;
+    }
+  }
+
+  // Skip whitespace and then the given character, if it is next.
+  bool Consume(char c) {
+    SkipSpace();
+    if (p < end && *p == c) {
+      ++p;
+      return true;
+    }
+    return false;
+  }
+
+  // Skip whitespace and then the given word, if it is next.
+  bool ConsumeWord(const char *word) {
+    SkipSpace();
+    size_t length = strlen(word);
+    if ((size_t)(end - p) >= length && memcmp(p, word, length) == 0) {
+      p += length;
+      return true;
+    }
+    return false;
+  }
+};
+
+// Parse a string, returning its contents without decoding any escapes.
+bool ParseString(Cursor &cursor, const char *&start, size_t &length) {
+  if (!cursor.Consume('"')) return false;
+  start = cursor.p;
+  while (cursor.p < cursor.end && *cursor.p != '"') {
+    if (*cursor.p == '\\') ++cursor.p;
+    ++cursor.p;
+  }
+  if (cursor.p >= cursor.end) return false;
+  length = cursor.p - start;
+  ++cursor.p;
+  return true;
+}
+
+bool ParseNumber(Cursor &cursor, double &value) {
+  cursor.SkipSpace();
+
+  // strtod needs a terminator, and the frame may not have one, so copy the
+  // number onto the stack.
+  char buffer[MAX_NUMBER_LENGTH + 1];
+  size_t length = 0;
+  while (cursor.p < cursor.end && length < MAX_NUMBER_LENGTH &&
+    (('0' <= *cursor.p && *cursor.p <= '9') || *cursor.p == '-' ||
+      *cursor.p == '+' || *cursor.p == '.' || *cursor.p == 'e' ||
+      *cursor.p == 'E')) {
+    buffer[length++] = *cursor.p++;
+  }
+  if (length == 0) return false;
+  buffer[length] = 0;
+
+  char *number_end;
+  value = strtod(buffer, &number_end);
+  return number_end == buffer + length;
+}
+
+bool ParseNumberArray(Cursor &cursor, std::vector<double> &values) {
+  values.clear();
+  if (!cursor.Consume('[')) return false;
+  if (cursor.Consume(']')) return true;
+  do {
+    double value;
+    if (!ParseNumber(cursor, value)) return false;
+    values.push_back(value);
+  } while (cursor.Consume(','));
+  return cursor.Consume(']');
+}
+
+bool SkipValue(Cursor &cursor, int depth) {
+  if (depth > MAX_DEPTH) return false;
+  cursor.SkipSpace();
+  if (cursor.p >= cursor.end) return false;
+
+  const char *start;
+  size_t length;
+  double number;
+  switch (*cursor.p) {
+    case '"':
+      return ParseString(cursor, start, length);
+    case '[':
+      ++cursor.p;
+      if (cursor.Consume(']')) return true;
+      do {
+        if (!SkipValue(cursor, depth + 1)) return false;
+      } while (cursor.Consume(','));
+      return cursor.Consume(']');
+    case '{':
+      ++cursor.p;
+      if (cursor.Consume('}')) return true;
+      do {
+        if (!ParseString(cursor, start, length) || !cursor.Consume(':') ||
+          !SkipValue(cursor, depth + 1)) return false;
+      } while (cursor.Consume(','));
+      return cursor.Consume('}');
+    case 't':
+      return cursor.ConsumeWord("true");
+    case 'f':
+      return cursor.ConsumeWord("false");
+    case 'n':
+      return cursor.ConsumeWord("null");
+    default:
+      return ParseNumber(cursor, number);
+  }
+}
+
+bool KeyIs(const char *key, size_t length, const char *name) {
+  return length == strlen(name) && memcmp(key, name, length) == 0;
+}
+
+// Parse one field of the telemetry object into the struct, or skip it.
+bool ParseField(Cursor &cursor, const char *key, size_t length,
+  Telemetry &telemetry, int &fields)
+{
+  if (KeyIs(key, length, "ptsx")) {
+    fields |= FIELD_PTSX;
+    return ParseNumberArray(cursor, telemetry.ptsx);
+  }
+  if (KeyIs(key, length, "ptsy")) {
+    fields |= FIELD_PTSY;
+    return ParseNumberArray(cursor, telemetry.ptsy);
+  }
+
+  double *value = nullptr;
+  int field = 0;
+  if (KeyIs(key, length, "x")) {
+    value = &telemetry.x;
+    field = FIELD_X;
+  } else if (KeyIs(key, length, "y")) {
+    value = &telemetry.y;
+    field = FIELD_Y;
+  } else if (KeyIs(key, length, "psi")) {
+    value = &telemetry.psi;
+    field = FIELD_PSI;
+  } else if (KeyIs(key, length, "speed")) {
+    value = &telemetry.speed;
+    field = FIELD_SPEED;
+  } else if (KeyIs(key, length, "steering_angle")) {
+    value = &telemetry.steering_angle;
+    field = FIELD_STEERING_ANGLE;
+  } else if (KeyIs(key, length, "throttle")) {
+    value = &telemetry.throttle;
+    field = FIELD_THROTTLE;
+  } else if (KeyIs(key, length, "sim_time")) {
+    // Only our own simulators send this, so it is optional.
+    value = &telemetry.sim_time;
+  } else {
+    return SkipValue(cursor, 1);
+  }
+  fields |= field;
+  return ParseNumber(cursor, *value);
+}
+
+} // namespace
+
+TelemetryEvent ParseTelemetry(const char *data, size_t length,
+  Telemetry &telemetry)
+{
+  // The 4 signifies a websocket message, and the 2 signifies an event.
+  if (length < 2 || data[0] != '4' || data[1] != '2') return TELEMETRY_NONE;
+  Cursor cursor = { data + 2, data + length };
+
+  // The event is an array with its name and then its data, which is null in
+  // manual mode.
+  const char *name;
+  size_t name_length;
+  if (!cursor.Consume('[') || !ParseString(cursor, name, name_length) ||
+    !cursor.Consume(',') || cursor.ConsumeWord("null")) {
+    return TELEMETRY_MANUAL;
+  }
+  if (!KeyIs(name, name_length, "telemetry")) return TELEMETRY_OTHER;
+
+  int fields = 0;
+  telemetry.sim_time = -1;
+  if (!cursor.Consume('{')) return TELEMETRY_INVALID;
+  if (!cursor.Consume('}')) {
+    do {
+      const char *key;
+      size_t key_length;
+      if (!ParseString(cursor, key, key_length) || !cursor.Consume(':') ||
+        !ParseField(cursor, key, key_length, telemetry, fields)) {
+        return TELEMETRY_INVALID;
+      }
+    } while (cursor.Consume(','));
+    if (!cursor.Consume('}')) return TELEMETRY_INVALID;
+  }
+  if (!cursor.Consume(']')) return TELEMETRY_INVALID;
+
+  if (fields != ALL_FIELDS || telemetry.ptsx.size() != telemetry.ptsy.size()) {
+    return TELEMETRY_INVALID;
+  }
+  return TELEMETRY_OK;
+}
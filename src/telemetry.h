@@ -0,0 +1,69 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * The fields of a telemetry message from the simulator that we use.
+ *
+ * The waypoint vectors keep their capacity from message to message, so
+ * parsing into the same Telemetry does not allocate once they are big enough.
+ */
+struct Telemetry {
+  Telemetry();
+
+  // Waypoints, in world coordinates.
+  std::vector<double> ptsx;
+  std::vector<double> ptsy;
+
+  // Position (m), heading (radians) and speed (mph) of the car.
+  double x;
+  double y;
+  double psi;
+  double speed;
+
+  // Current actuations, in the simulator's conventions.
+  double steering_angle;
+  double throttle;
+
+  // When the message arrived, and when it was parsed and handed to the
+  // solver, for the flight recorder. The parsers don't set these.
+  std::chrono::steady_clock::time_point received;
+  std::chrono::steady_clock::time_point posted;
+
+  // Number of the message, for a transport that numbers them, so that the
+  // reply can say which message it answers; otherwise 0.
+  uint64_t sequence;
+
+  // The simulator's own time when it sent the message, in seconds since it
+  // started, which drives a session on a simulated clock; negative if the
+  // simulator doesn't send it.
+  double sim_time;
+};
+
+enum TelemetryEvent {
+  // Not a socket.io event message (it doesn't start with "42").
+  TELEMETRY_NONE,
+  // An event with no data; the simulator is in manual mode.
+  TELEMETRY_MANUAL,
+  // An event other than telemetry.
+  TELEMETRY_OTHER,
+  // A telemetry event with all of the fields.
+  TELEMETRY_OK,
+  // A telemetry event that we could not parse, or with fields missing.
+  TELEMETRY_INVALID
+};
+
+/**
+ * Parse a socket.io frame like 42["telemetry",{"ptsx":[...],...}] in a
+ * single pass, without building a DOM or any intermediate strings. The frame
+ * does not need to be null terminated. Other fields in the object are
+ * skipped.
+ */
+TelemetryEvent ParseTelemetry(const char *data, size_t length,
+  Telemetry &telemetry);
+
+#endif /* TELEMETRY_H */
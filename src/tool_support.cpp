@@ -0,0 +1,29 @@
+#include "tool_support.h"
+
+#include <algorithm>
+
+void ParseArguments(int argc, char **argv,
+  std::map<std::string, std::string> &options,
+  std::vector<std::string> &arguments)
+{
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    if (arg.compare(0, 2, "--") == 0) {
+      size_t equals = arg.find('=');
+      if (equals == std::string::npos) {
+        options[arg.substr(2)] = "";
+      } else {
+        options[arg.substr(2, equals - 2)] = arg.substr(equals + 1);
+      }
+    } else {
+      arguments.push_back(arg);
+    }
+  }
+}
+
+double Percentile(std::vector<double> values, double p) {
+  if (values.empty()) return 0;
+  size_t i = std::min((size_t)(p * values.size()), values.size() - 1);
+  std::nth_element(values.begin(), values.begin() + i, values.end());
+  return values[i];
+}
@@ -0,0 +1,21 @@
+#ifndef TOOL_SUPPORT_H
+#define TOOL_SUPPORT_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * Split the command line into `--name=value` (or just `--name`) options and
+ * positional arguments.
+ */
+void ParseArguments(int argc, char **argv,
+  std::map<std::string, std::string> &options,
+  std::vector<std::string> &arguments);
+
+/**
+ * The value at the given quantile p in [0, 1], or 0 if there are none.
+ */
+double Percentile(std::vector<double> values, double p);
+
+#endif /* TOOL_SUPPORT_H */
@@ -0,0 +1,258 @@
+#include "track_map.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+
+#include "wrap_angle.h"
+
+// Number of points per waypoint segment for estimating arc length.
+const int SUBSAMPLES = 50;
+
+// Target distance between the tabulated points, in meters.
+const double RESOLUTION = 0.5;
+
+// Size of each cell in the grid, in meters.
+const double GRID_CELL = 5;
+
+// Evaluate a uniform Catmull-Rom spline segment from p1 (t = 0) to p2 (t = 1).
+static double CatmullRom(double p0, double p1, double p2, double p3, double t)
+{
+  return 0.5 * (2 * p1 + t * ((p2 - p0) + t * (
+    (2 * p0 - 5 * p1 + 4 * p2 - p3) + t * (3 * (p1 - p2) + p3 - p0))));
+}
+
+TrackMap::TrackMap() :
+  total_length(0),
+  resolution(RESOLUTION),
+  grid_min_x(0),
+  grid_min_y(0),
+  grid_columns(0),
+  grid_rows(0)
+{ }
+
+bool TrackMap::Load(const std::string &pathname) {
+  std::ifstream file(pathname.c_str());
+  if (!file) return false;
+
+  std::vector<double> waypoints_x;
+  std::vector<double> waypoints_y;
+  std::string line;
+  while (std::getline(file, line)) {
+    double x, y;
+    // This skips the header, because it doesn't parse.
+    if (sscanf(line.c_str(), "%lf,%lf", &x, &y) == 2) {
+      waypoints_x.push_back(x);
+      waypoints_y.push_back(y);
+    }
+  }
+  if (waypoints_x.size() < 3) return false;
+
+  Build(waypoints_x, waypoints_y);
+  return true;
+}
+
+void TrackMap::Build(const std::vector<double> &waypoints_x,
+  const std::vector<double> &waypoints_y)
+{
+  size_t n = waypoints_x.size();
+  points_x = waypoints_x;
+  points_y = waypoints_y;
+
+  // Sample the spline densely and accumulate the arc length.
+  std::vector<double> dense_x;
+  std::vector<double> dense_y;
+  std::vector<double> dense_s;
+  double arc_length = 0;
+  for (size_t i = 0; i < n; ++i) {
+    size_t i0 = (i + n - 1) % n;
+    size_t i2 = (i + 1) % n;
+    size_t i3 = (i + 2) % n;
+    for (int k = 0; k < SUBSAMPLES; ++k) {
+      double t = (double)k / SUBSAMPLES;
+      double x = CatmullRom(waypoints_x[i0], waypoints_x[i],
+        waypoints_x[i2], waypoints_x[i3], t);
+      double y = CatmullRom(waypoints_y[i0], waypoints_y[i],
+        waypoints_y[i2], waypoints_y[i3], t);
+      if (!dense_x.empty()) {
+        arc_length += hypot(x - dense_x.back(), y - dense_y.back());
+      }
+      dense_x.push_back(x);
+      dense_y.push_back(y);
+      dense_s.push_back(arc_length);
+    }
+  }
+  // Close the loop.
+  arc_length +=
+    hypot(dense_x[0] - dense_x.back(), dense_y[0] - dense_y.back());
+  dense_x.push_back(dense_x[0]);
+  dense_y.push_back(dense_y[0]);
+  dense_s.push_back(arc_length);
+  total_length = arc_length;
+
+  // Tabulate at regular intervals of arc length.
+  size_t count = (size_t)std::ceil(total_length / RESOLUTION);
+  resolution = total_length / count;
+  s.resize(count);
+  xs.resize(count);
+  ys.resize(count);
+  size_t k = 0;
+  for (size_t j = 0; j < count; ++j) {
+    s[j] = j * resolution;
+    while (dense_s[k + 1] < s[j]) ++k;
+    double fraction = (s[j] - dense_s[k]) / (dense_s[k + 1] - dense_s[k]);
+    xs[j] = dense_x[k] + fraction * (dense_x[k + 1] - dense_x[k]);
+    ys[j] = dense_y[k] + fraction * (dense_y[k + 1] - dense_y[k]);
+  }
+
+  // Estimate the heading and curvature with central differences.
+  headings.resize(count);
+  curvatures.resize(count);
+  for (size_t j = 0; j < count; ++j) {
+    size_t next = (j + 1) % count;
+    size_t previous = (j + count - 1) % count;
+    headings[j] = atan2(ys[next] - ys[previous], xs[next] - xs[previous]);
+  }
+  for (size_t j = 0; j < count; ++j) {
+    size_t next = (j + 1) % count;
+    size_t previous = (j + count - 1) % count;
+    curvatures[j] =
+      WrapAngle(headings[next] - headings[previous]) / (2 * resolution);
+  }
+
+  BuildGrid();
+}
+
+void TrackMap::BuildGrid() {
+  double max_x = *std::max_element(xs.begin(), xs.end());
+  double max_y = *std::max_element(ys.begin(), ys.end());
+  grid_min_x = *std::min_element(xs.begin(), xs.end());
+  grid_min_y = *std::min_element(ys.begin(), ys.end());
+  grid_columns = (int)std::floor((max_x - grid_min_x) / GRID_CELL) + 1;
+  grid_rows = (int)std::floor((max_y - grid_min_y) / GRID_CELL) + 1;
+
+  grid.assign(grid_columns * grid_rows, std::vector<size_t>());
+  for (size_t j = 0; j < s.size(); ++j) {
+    int column = (int)std::floor((xs[j] - grid_min_x) / GRID_CELL);
+    int row = (int)std::floor((ys[j] - grid_min_y) / GRID_CELL);
+    grid[row * grid_columns + column].push_back(j);
+  }
+}
+
+double TrackMap::Project(double x, double y) const {
+  int column = (int)std::floor((x - grid_min_x) / GRID_CELL);
+  int row = (int)std::floor((y - grid_min_y) / GRID_CELL);
+  column = std::min(std::max(column, 0), grid_columns - 1);
+  row = std::min(std::max(row, 0), grid_rows - 1);
+
+  // Search rings of cells around the car's cell until no closer point can be
+  // in the next ring.
+  size_t best = 0;
+  double best_distance2 = std::numeric_limits<double>::infinity();
+  int max_radius = std::max(grid_columns, grid_rows);
+  for (int radius = 0; radius <= max_radius; ++radius) {
+    for (int r = row - radius; r <= row + radius; ++r) {
+      if (r < 0 || r >= grid_rows) continue;
+      for (int c = column - radius; c <= column + radius; ++c) {
+        if (c < 0 || c >= grid_columns) continue;
+        // Only the cells on the ring itself.
+        if (std::max(abs(r - row), abs(c - column)) != radius) continue;
+        const std::vector<size_t> &cell = grid[r * grid_columns + c];
+        for (size_t k = 0; k < cell.size(); ++k) {
+          size_t j = cell[k];
+          double distance2 = (xs[j] - x) * (xs[j] - x) +
+            (ys[j] - y) * (ys[j] - y);
+          if (distance2 < best_distance2) {
+            best = j;
+            best_distance2 = distance2;
+          }
+        }
+      }
+    }
+    double reach = radius * GRID_CELL;
+    if (best_distance2 <= reach * reach) break;
+  }
+
+  // Refine by projecting onto the chords on either side of the closest point.
+  double best_s = s[best];
+  for (int side = -1; side <= 0; ++side) {
+    size_t a = (best + s.size() + side) % s.size();
+    size_t b = (a + 1) % s.size();
+    double dx = xs[b] - xs[a];
+    double dy = ys[b] - ys[a];
+    double t = ((x - xs[a]) * dx + (y - ys[a]) * dy) / (dx * dx + dy * dy);
+    t = std::min(std::max(t, 0.0), 1.0);
+    double px = xs[a] + t * dx;
+    double py = ys[a] + t * dy;
+    double distance2 = (px - x) * (px - x) + (py - y) * (py - y);
+    if (distance2 < best_distance2) {
+      best_distance2 = distance2;
+      best_s = s[a] + t * resolution;
+    }
+  }
+  return Wrap(best_s);
+}
+
+double TrackMap::Wrap(double arc_length) const {
+  double wrapped = std::fmod(arc_length, total_length);
+  if (wrapped < 0) wrapped += total_length;
+  return wrapped;
+}
+
+size_t TrackMap::Locate(double arc_length, double &fraction) const {
+  double k = Wrap(arc_length) / resolution;
+  size_t j = std::min((size_t)k, s.size() - 1);
+  fraction = k - j;
+  return j;
+}
+
+double TrackMap::Interpolate(
+  const std::vector<double> &values, double arc_length) const
+{
+  double fraction;
+  size_t j = Locate(arc_length, fraction);
+  size_t next = (j + 1) % s.size();
+  return values[j] + fraction * (values[next] - values[j]);
+}
+
+void TrackMap::Position(double arc_length, double &x, double &y) const {
+  x = Interpolate(xs, arc_length);
+  y = Interpolate(ys, arc_length);
+}
+
+double TrackMap::Heading(double arc_length) const {
+  double fraction;
+  size_t j = Locate(arc_length, fraction);
+  size_t next = (j + 1) % s.size();
+  return WrapAngle(headings[j] +
+    fraction * WrapAngle(headings[next] - headings[j]));
+}
+
+double TrackMap::Curvature(double arc_length) const {
+  return Interpolate(curvatures, arc_length);
+}
+
+void TrackMap::LocalWaypoints(double x, double y, double behind,
+  double ahead, double spacing, std::vector<double> &ptsx,
+  std::vector<double> &ptsy) const
+{
+  ptsx.clear();
+  ptsy.clear();
+
+  // Adjust the spacing so that it divides the track length; otherwise, the
+  // points would not line up when we go around the track again.
+  long count = std::max(std::lround(total_length / spacing), 1L);
+  double lap_spacing = total_length / count;
+
+  double arc_length = Project(x, y);
+  long first = (long)std::ceil((arc_length - behind) / lap_spacing);
+  long last = (long)std::floor((arc_length + ahead) / lap_spacing);
+  for (long k = first; k <= last; ++k) {
+    double point_x, point_y;
+    Position(((k % count + count) % count) * lap_spacing, point_x, point_y);
+    ptsx.push_back(point_x);
+    ptsy.push_back(point_y);
+  }
+}
@@ -0,0 +1,102 @@
+#ifndef TRACK_MAP_H
+#define TRACK_MAP_H
+
+#include <string>
+#include <vector>
+
+/**
+ * A map of the whole track, loaded from a CSV of waypoints (with an "x,y"
+ * header, like lake_track_waypoints.csv).
+ *
+ * The waypoints are interpolated with a closed Catmull-Rom spline, which is
+ * then tabulated at regular intervals of arc length, s, with the position,
+ * heading and curvature at each point. A uniform grid over the tabulated
+ * points makes it cheap to find the point on the track closest to the car.
+ */
+class TrackMap {
+public:
+  TrackMap();
+
+  /**
+   * Load the waypoints from a CSV file. Returns false if the file could not
+   * be read or had too few waypoints.
+   */
+  bool Load(const std::string &pathname);
+
+  /**
+   * Build the map from waypoints in world coordinates, in order around the
+   * track.
+   */
+  void Build(const std::vector<double> &waypoints_x,
+    const std::vector<double> &waypoints_y);
+
+  // Is the map loaded?
+  bool empty() const { return s.empty(); }
+
+  // Total length of the track, in meters.
+  double length() const { return total_length; }
+
+  // The waypoints that the map was built from, in order around the track.
+  const std::vector<double> &waypoints_x() const { return points_x; }
+  const std::vector<double> &waypoints_y() const { return points_y; }
+
+  /**
+   * Find the arc length of the point on the track closest to (x, y).
+   */
+  double Project(double x, double y) const;
+
+  /**
+   * Wrap an arc length into [0, length).
+   */
+  double Wrap(double arc_length) const;
+
+  // Position, heading (radians) and curvature (1/m) at the given arc length.
+  void Position(double arc_length, double &x, double &y) const;
+  double Heading(double arc_length) const;
+  double Curvature(double arc_length) const;
+
+  /**
+   * Get points on the track from `behind` meters behind the point closest to
+   * (x, y) to `ahead` meters in front of it. The points are at multiples of
+   * `spacing` from the start of the track, so they stay the same as the car
+   * moves along the track, apart from new ones at the front and old ones at
+   * the back. The vectors are cleared first.
+   */
+  void LocalWaypoints(double x, double y, double behind, double ahead,
+    double spacing, std::vector<double> &ptsx, std::vector<double> &ptsy)
+    const;
+
+private:
+  double total_length;
+
+  // Distance between the tabulated points, in meters.
+  double resolution;
+
+  std::vector<double> points_x;
+  std::vector<double> points_y;
+
+  // The tabulated points.
+  std::vector<double> s;
+  std::vector<double> xs;
+  std::vector<double> ys;
+  std::vector<double> headings;
+  std::vector<double> curvatures;
+
+  // Uniform grid of cells, each listing the tabulated points in it.
+  double grid_min_x;
+  double grid_min_y;
+  int grid_columns;
+  int grid_rows;
+  std::vector<std::vector<size_t> > grid;
+
+  void BuildGrid();
+
+  // Index of the tabulated point at or before the given arc length, and the
+  // fraction of the way to the next point.
+  size_t Locate(double arc_length, double &fraction) const;
+
+  double Interpolate(const std::vector<double> &values, double arc_length)
+    const;
+};
+
+#endif /* TRACK_MAP_H */
@@ -0,0 +1,46 @@
+#ifndef VEHICLE_MODEL_H
+#define VEHICLE_MODEL_H
+
+#include <cmath>
+
+/**
+ * Constants of the car's kinematic model, shared by the controller (see
+ * Problem) and the simulators that stand in for the Unity one. This has no
+ * dependencies, so the simulators don't need CppAD.
+ */
+
+// Length from front to CoG that has a similar radius.
+//
+// This value assumes the model presented in the classroom is used.
+//
+// It was obtained by measuring the radius formed by running the vehicle in the
+// simulator around in a circle with a constant steering angle and velocity on a
+// flat terrain.
+//
+// Lf was tuned until the the radius formed by the simulating the model
+// presented in the classroom matched the previous radius.
+//
+const double Lf = 2.67;
+
+// 1609.34m / mile * 1h / 3600s = x (m / s) / (miles / h).
+const double MPH_TO_METERS_PER_SECOND = (1609.34 / 3600.0);
+
+// Maximum steering angle (25 degrees) in radians.
+const double MAX_STEER_RADIANS = 25.0 / 180 * M_PI;
+
+/**
+ * Convert a throttle value to an acceleration, based on current speed. This
+ * is an empirical formula based on recording the speed under full throttle
+ * at the start with no steering (before the vehicle crashes); see
+ * data/acceleration_estimate.xlsx for details.
+ *
+ * @param  throttle in [-1, 1]
+ * @param  speed in m/s
+ * @return in m/s^2
+ */
+template <typename T>
+T throttle_to_acceleration(T throttle, T speed) {
+  return throttle * (5.1886 - 0.0923 * speed);
+}
+
+#endif /* VEHICLE_MODEL_H */
@@ -0,0 +1,151 @@
+#include "vehicle_simulator.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "vehicle_model.h"
+
+// Longest time step for integrating the model, in seconds.
+const double INTEGRATION_STEP = 0.005;
+
+// The Unity simulator sends this many waypoints, starting with this many
+// behind the car.
+const size_t TELEMETRY_WAYPOINTS = 6;
+const size_t TELEMETRY_WAYPOINTS_BEHIND = 1;
+
+static double Clamp(double value, double limit) {
+  return std::min(std::max(value, -limit), limit);
+}
+
+VehicleSimulator::VehicleSimulator(const TrackMap &track) :
+  actuation_latency(0),
+  latency_jitter(0),
+  position_noise(0),
+  heading_noise(0),
+  speed_noise(0),
+  steer_noise(0),
+  throttle_noise(0),
+  track(track),
+  elapsed(0),
+  arc_length(0),
+  travelled(0)
+{
+  const std::vector<double> &xs = track.waypoints_x();
+  const std::vector<double> &ys = track.waypoints_y();
+  waypoint_s.resize(xs.size());
+  for (size_t i = 1; i < xs.size(); ++i) {
+    waypoint_s[i] = std::max(track.Project(xs[i], ys[i]), waypoint_s[i - 1]);
+  }
+  Reset();
+}
+
+VehicleSimulator::~VehicleSimulator() { }
+
+void VehicleSimulator::Seed(unsigned seed) {
+  random.seed(seed);
+  normal.reset();
+}
+
+void VehicleSimulator::Reset(double arc_length) {
+  this->arc_length = track.Wrap(arc_length);
+  track.Position(this->arc_length, car.x, car.y);
+  car.psi = track.Heading(this->arc_length);
+  car.speed = 0;
+  car.steering_angle = 0;
+  car.throttle = 0;
+  pending.clear();
+  elapsed = 0;
+  travelled = 0;
+}
+
+void VehicleSimulator::Actuate(double steering_angle, double throttle) {
+  Pending actuations;
+  double delay = std::max(actuation_latency + Noise(latency_jitter), 0.0);
+  actuations.time = elapsed + delay;
+  actuations.steering_angle = steering_angle;
+  actuations.throttle = throttle;
+
+  // Jitter doesn't reorder the actuations.
+  if (!pending.empty()) {
+    actuations.time = std::max(actuations.time, pending.back().time);
+  }
+  pending.push_back(actuations);
+  if (delay == 0 && pending.size() == 1) Step(0);
+}
+
+void VehicleSimulator::Step(double dt) {
+  double end = elapsed + std::max(dt, 0.0);
+  for (;;) {
+    while (!pending.empty() && pending.front().time <= elapsed) {
+      const Pending &actuations = pending.front();
+      car.steering_angle = Clamp(
+        actuations.steering_angle + Noise(steer_noise), 1) * MAX_STEER_RADIANS;
+      car.throttle = Clamp(actuations.throttle + Noise(throttle_noise), 1);
+      pending.pop_front();
+    }
+    if (elapsed >= end) break;
+
+    // Stop at the next actuations, so they take effect on time.
+    double step_end = std::min(elapsed + INTEGRATION_STEP, end);
+    if (!pending.empty()) step_end = std::min(step_end, pending.front().time);
+    Integrate(step_end - elapsed);
+    elapsed = step_end;
+  }
+
+  // Keep track of the distance along the track, through the laps.
+  double new_arc_length = track.Project(car.x, car.y);
+  double length = track.length();
+  double ds = new_arc_length - arc_length;
+  ds -= length * std::floor(ds / length + 0.5);
+  travelled += ds;
+  arc_length = new_arc_length;
+}
+
+void VehicleSimulator::Observe(Telemetry &telemetry) {
+  // The waypoint behind the car and the ones after it, around the track.
+  const std::vector<double> &xs = track.waypoints_x();
+  const std::vector<double> &ys = track.waypoints_y();
+  size_t n = xs.size();
+  size_t next = std::upper_bound(waypoint_s.begin(), waypoint_s.end(),
+    arc_length) - waypoint_s.begin();
+  size_t first = (next + n - TELEMETRY_WAYPOINTS_BEHIND) % n;
+  size_t count = std::min(TELEMETRY_WAYPOINTS, n);
+  telemetry.ptsx.resize(count);
+  telemetry.ptsy.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    telemetry.ptsx[i] = xs[(first + i) % n];
+    telemetry.ptsy[i] = ys[(first + i) % n];
+  }
+
+  double psi = car.psi + Noise(heading_noise);
+  telemetry.x = car.x + Noise(position_noise);
+  telemetry.y = car.y + Noise(position_noise);
+  telemetry.psi = psi - 2 * M_PI * std::floor(psi / (2 * M_PI));
+  telemetry.speed = std::max(
+    car.speed / MPH_TO_METERS_PER_SECOND + Noise(speed_noise), 0.0);
+  telemetry.steering_angle = car.steering_angle;
+  telemetry.throttle = car.throttle;
+  telemetry.sim_time = elapsed;
+}
+
+double VehicleSimulator::cte() const {
+  double x, y;
+  track.Position(arc_length, x, y);
+  double heading = track.Heading(arc_length);
+  return -(car.x - x) * std::sin(heading) + (car.y - y) * std::cos(heading);
+}
+
+double VehicleSimulator::Noise(double sigma) {
+  if (sigma <= 0) return 0;
+  return sigma * normal(random);
+}
+
+void VehicleSimulator::Integrate(double dt) {
+  // The same model as the controller's (see Problem), in the simulator's
+  // steering convention.
+  double acceleration = throttle_to_acceleration(car.throttle, car.speed);
+  car.x += car.speed * std::cos(car.psi) * dt;
+  car.y += car.speed * std::sin(car.psi) * dt;
+  car.psi -= car.speed * car.steering_angle / Lf * dt;
+  car.speed = std::max(car.speed + acceleration * dt, 0.0);
+}
@@ -0,0 +1,143 @@
+#ifndef VEHICLE_SIMULATOR_H
+#define VEHICLE_SIMULATOR_H
+
+#include <deque>
+#include <random>
+#include <vector>
+
+#include "telemetry.h"
+#include "track_map.h"
+
+/**
+ * The car's true state, in the simulator's conventions.
+ */
+struct VehicleState {
+  // Position (m) and heading (radians, anticlockwise from the x axis).
+  double x;
+  double y;
+  double psi;
+
+  // Speed, in m/s.
+  double speed;
+
+  // Actuations in effect: steering angle in radians, positive to the right,
+  // and throttle in [-1, 1].
+  double steering_angle;
+  double throttle;
+};
+
+/**
+ * A stand-in for the Unity simulator that drives the same kinematic model as
+ * the controller (Lf and throttle_to_acceleration, in vehicle_model.h) around a
+ * track map, for closed-loop runs without the simulator.
+ *
+ * The telemetry is what the Unity simulator sends: six waypoints from the
+ * track's CSV (the one behind the car and the five ahead of it), the heading
+ * in [0, 2 pi), the speed in miles per hour and the steering angle in
+ * radians. The actuations take effect after a configurable latency, and the
+ * telemetry and actuations can have Gaussian noise added, from a seeded
+ * generator so that runs are repeatable.
+ *
+ * Time is simulated: it only passes in Step, so the simulator runs as fast
+ * as its caller drives it.
+ */
+class VehicleSimulator {
+public:
+  /**
+   * @param track to drive around, which must be loaded and outlive the
+   * simulator
+   */
+  explicit VehicleSimulator(const TrackMap &track);
+
+  virtual ~VehicleSimulator();
+
+  // Time from Actuate until the actuations take effect, in seconds, and the
+  // standard deviation of its jitter.
+  double actuation_latency;
+  double latency_jitter;
+
+  // Standard deviations of the noise in the telemetry: position (m), heading
+  // (radians) and speed (mph).
+  double position_noise;
+  double heading_noise;
+  double speed_noise;
+
+  // Standard deviations of the noise in the actuations as they take effect,
+  // in the units of Actuate.
+  double steer_noise;
+  double throttle_noise;
+
+  /**
+   * Restart the noise from the given seed.
+   */
+  void Seed(unsigned seed);
+
+  /**
+   * Put the car at rest at the given arc length along the track, facing
+   * along it, with no actuations pending, and start the time from zero.
+   */
+  void Reset(double arc_length = 0);
+
+  /**
+   * Take actuations in [-1, 1], as in the steer message (positive steering
+   * is to the right). They take effect after the actuation latency.
+   */
+  void Actuate(double steering_angle, double throttle);
+
+  /**
+   * Run the model forward by the given time, in seconds.
+   */
+  void Step(double dt);
+
+  /**
+   * Fill in the telemetry that the Unity simulator would send now, with the
+   * simulated time. Only the waypoint vectors allocate, until they are big
+   * enough.
+   */
+  void Observe(Telemetry &telemetry);
+
+  // Simulated time since Reset, in seconds.
+  double time() const { return elapsed; }
+
+  const VehicleState &state() const { return car; }
+
+  // Distance driven along the track since Reset, in meters.
+  double distance() const { return travelled; }
+
+  // Signed distance of the car from the center of the track, in meters,
+  // positive to the left.
+  double cte() const;
+
+private:
+  // Actuations waiting to take effect.
+  struct Pending {
+    double time;
+    double steering_angle;
+    double throttle;
+  };
+
+  const TrackMap &track;
+
+  // Arc lengths of the track's waypoints, which increase around the track.
+  std::vector<double> waypoint_s;
+
+  VehicleState car;
+  std::deque<Pending> pending;
+  double elapsed;
+
+  // Arc length at the end of the latest step, and the distance along the
+  // track since Reset.
+  double arc_length;
+  double travelled;
+
+  std::mt19937 random;
+  std::normal_distribution<double> normal;
+
+  // Zero mean noise with the given standard deviation.
+  double Noise(double sigma);
+
+  // Integrate the model over a short time, in seconds.
+  void Integrate(double dt);
+};
+
+#endif /* VEHICLE_SIMULATOR_H */
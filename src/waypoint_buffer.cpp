@@ -0,0 +1,144 @@
+#include "waypoint_buffer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+// Points closer than this, in meters, on both axes, are the same point. The
+// simulator sends exactly the same coordinates for the same waypoint.
+const double QUANTUM = 1e-6;
+
+// Numerical tolerance for comparisons to the 0 (no weight) and 1 (full
+// weight) boundaries.
+const double EPSILON = 1e-6;
+
+const size_t WaypointBuffer::CAPACITY;
+const size_t WaypointBuffer::BUCKETS;
+const int WaypointBuffer::EMPTY;
+
+static uint64_t Quantize(double value) {
+  return (uint64_t)(int64_t)std::llround(value / QUANTUM);
+}
+
+static size_t Hash(double x, double y) {
+  // Combine the quantized coordinates and mix the bits (splitmix64 finalizer).
+  uint64_t h = Quantize(x) * 0x9e3779b97f4a7c15ULL ^ Quantize(y);
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  return (size_t)h;
+}
+
+WaypointBuffer::WaypointBuffer() {
+  Clear();
+}
+
+void WaypointBuffer::Clear() {
+  head = 0;
+  count = 0;
+  removed_count = 0;
+  generation = 0;
+  std::fill(present, present + CAPACITY, 0);
+  std::fill(buckets, buckets + BUCKETS, EMPTY);
+}
+
+size_t WaypointBuffer::FindBucket(double x, double y) const {
+  uint64_t qx = Quantize(x);
+  uint64_t qy = Quantize(y);
+  size_t bucket = Hash(x, y) % BUCKETS;
+  while (buckets[bucket] != EMPTY) {
+    int slot = buckets[bucket];
+    if (Quantize(xs[slot]) == qx && Quantize(ys[slot]) == qy) break;
+    bucket = (bucket + 1) % BUCKETS;
+  }
+  return bucket;
+}
+
+void WaypointBuffer::PushBack(double x, double y, double weight) {
+  if (count == CAPACITY) PopFront();
+
+  size_t slot = Slot(count);
+  xs[slot] = x;
+  ys[slot] = y;
+  weights[slot] = weight;
+  present[slot] = generation;
+  buckets[FindBucket(x, y)] = (int)slot;
+  ++count;
+}
+
+void WaypointBuffer::PopFront() {
+  assert(count > 0);
+
+  // Remove the point from the index with backward shift deletion: move later
+  // entries in the same probe sequence back to fill the hole, so lookups
+  // don't stop early.
+  size_t hole = FindBucket(xs[head], ys[head]);
+  buckets[hole] = EMPTY;
+  size_t bucket = (hole + 1) % BUCKETS;
+  while (buckets[bucket] != EMPTY) {
+    int slot = buckets[bucket];
+    size_t home = Hash(xs[slot], ys[slot]) % BUCKETS;
+    // Move the entry into the hole unless its home lies cyclically in
+    // (hole, bucket].
+    bool home_after_hole = hole <= bucket ?
+      (hole < home && home <= bucket) : (hole < home || home <= bucket);
+    if (!home_after_hole) {
+      buckets[hole] = slot;
+      buckets[bucket] = EMPTY;
+      hole = bucket;
+    }
+    bucket = (bucket + 1) % BUCKETS;
+  }
+
+  head = (head + 1) % CAPACITY;
+  --count;
+  ++removed_count;
+}
+
+void WaypointBuffer::Update(
+  const std::vector<double> &ptsx_vector,
+  const std::vector<double> &ptsy_vector,
+  double delta)
+{
+  ++generation;
+
+  // Mark the known points that are present in the new set.
+  for (size_t i = 0; i < ptsx_vector.size(); ++i) {
+    int slot = buckets[FindBucket(ptsx_vector[i], ptsy_vector[i])];
+    if (slot != EMPTY) present[slot] = generation;
+  }
+
+  // If they are present, and they are not already at full weight (1), then
+  // up-weight them by delta. If they are not present, down-weight them.
+  for (size_t i = 0; i < count; ++i) {
+    size_t slot = Slot(i);
+    if (present[slot] == generation) {
+      if (weights[slot] < 1.0 - EPSILON) {
+        weights[slot] += delta;
+      } else {
+        weights[slot] = 1.0;
+      }
+    } else {
+      weights[slot] = std::max(weights[slot] - delta, 0.0);
+    }
+  }
+
+  // Remove points with zero weight. We assume that these are the ones at the
+  // start of the buffer, since that is where old points seem to disappear
+  // from.
+  while (count > 0 && weights[head] < 0 + EPSILON) {
+    PopFront();
+  }
+
+  // If any new points were added, append them with a small weight; we'll
+  // increase the weight gradually.
+  for (size_t i = 0; i < ptsx_vector.size(); ++i) {
+    double x = ptsx_vector[i];
+    double y = ptsy_vector[i];
+    if (buckets[FindBucket(x, y)] == EMPTY) {
+      PushBack(x, y, delta);
+    }
+  }
+}
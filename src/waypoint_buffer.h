@@ -0,0 +1,83 @@
+#ifndef WAYPOINT_BUFFER_H
+#define WAYPOINT_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * The waypoints that we know about, with their weights, in the order that we
+ * first saw them.
+ *
+ * The points are kept in a fixed-capacity ring buffer, so removing the oldest
+ * point and adding a new one are O(1) and do not allocate. A hash index on the
+ * quantized coordinates makes it O(1) to find whether a point is known, so
+ * updating from m new points is O(m + n) rather than O(m * n).
+ */
+class WaypointBuffer {
+public:
+  // Maximum number of points; if we see more, we forget the oldest.
+  static const size_t CAPACITY = 256;
+
+  WaypointBuffer();
+
+  /**
+   * Forget all points.
+   */
+  void Clear();
+
+  /**
+   * Update the weights from the latest set of waypoints: points that are
+   * present gain `delta` weight, up to 1, and those that are not lose it,
+   * down to 0. Points with no weight are removed from the front, and new
+   * points are added at the back with weight `delta`.
+   */
+  void Update(
+    const std::vector<double> &ptsx_vector,
+    const std::vector<double> &ptsy_vector,
+    double delta);
+
+  // Number of known points.
+  size_t size() const { return count; }
+
+  // Number of points removed from the front since the last Clear, so the
+  // i-th oldest known point is the (removed() + i)-th point ever added.
+  size_t removed() const { return removed_count; }
+
+  // The coordinates and weight of the i-th oldest known point.
+  double x(size_t i) const { return xs[Slot(i)]; }
+  double y(size_t i) const { return ys[Slot(i)]; }
+  double weight(size_t i) const { return weights[Slot(i)]; }
+
+private:
+  // The hash table has twice as many buckets as the ring buffer has slots, so
+  // it is never more than half full. It uses linear probing.
+  static const size_t BUCKETS = 2 * CAPACITY;
+  static const int EMPTY = -1;
+
+  double xs[CAPACITY];
+  double ys[CAPACITY];
+  double weights[CAPACITY];
+
+  // The update in which each point was last present.
+  uint32_t present[CAPACITY];
+  uint32_t generation;
+
+  size_t head;
+  size_t count;
+  size_t removed_count;
+
+  // Slot in the ring buffer for each bucket, or EMPTY.
+  int buckets[BUCKETS];
+
+  size_t Slot(size_t i) const { return (head + i) % CAPACITY; }
+
+  // Find the bucket for the given point: either the one that holds it, or
+  // the empty one where it would go.
+  size_t FindBucket(double x, double y) const;
+
+  void PushBack(double x, double y, double weight);
+  void PopFront();
+};
+
+#endif /* WAYPOINT_BUFFER_H */
@@ -0,0 +1,13 @@
+#ifndef WRAP_ANGLE_H
+#define WRAP_ANGLE_H
+
+#include <cmath>
+
+/**
+ * Wrap an angle, in radians, into [-pi, pi).
+ */
+inline double WrapAngle(double angle) {
+  return angle - 2 * M_PI * std::floor((angle + M_PI) / (2 * M_PI));
+}
+
+#endif /* WRAP_ANGLE_H */
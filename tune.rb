@@ -119,14 +119,82 @@ def strip_non_json(out)
   out.lines.grep(/^{/).join
 end
 
+#
+# With MPC_DAEMON=1 in the environment, start one `build/mpc --daemon` and
+# give it the parameters for each run on stdin, rather than starting a new
+# process (and paying for Ipopt and CppAD to start up) for each run.
+#
+class MpcDaemon
+  RESULT_STATUS = { 'finished' => 0, 'crashed' => 1 }.freeze
+
+  # How long to wait for the result of a run that timed out, in seconds.
+  ABANDON_TIMEOUT = 10
+
+  def initialize
+    @io = IO.popen(%w(build/mpc --daemon), 'r+', err: File::NULL)
+  end
+
+  # Set the parameters for the next run, and wait until the daemon has applied
+  # them, so that a sim that connects straight away gets them. Any results
+  # that arrive in the meantime are from runs that we abandoned.
+  def configure(*params)
+    @io.puts params.join(' ')
+    @io.flush
+    loop do
+      line = next_line
+      next unless line.start_with?('{"configured"')
+      return if JSON.parse(line)['configured']
+      raise "mpc daemon rejected parameters: #{params}"
+    end
+  end
+
+  # Return the exit status that build/mpc would have had, and the stats.
+  def result
+    loop do
+      line = next_line
+      next unless line.start_with?('{"session"')
+      report = JSON.parse(line)
+      return [RESULT_STATUS.fetch(report['result'], 2), report['stats']]
+    end
+  end
+
+  # Skip the result of a run that timed out, which arrives when the sim stops,
+  # unless the session never started.
+  def abandon
+    Timeout.timeout(ABANDON_TIMEOUT) do
+      loop { break if next_line.start_with?('{"session"') }
+    end
+  rescue Timeout::Error
+    STDERR.puts 'WARNING: No result from the abandoned run'
+  end
+
+  private
+
+  def next_line
+    line = @io.gets
+    raise 'mpc daemon exited' unless line
+    line
+  end
+end
+
+DAEMON = ENV['MPC_DAEMON'] ? MpcDaemon.new : nil
+
+def run_mpc(*params)
+  return DAEMON.result if DAEMON
+  status, out, _err = run('build/mpc', *params)
+  stats = JSON.parse(strip_non_json(out)) if [0, 1].member?(status)
+  [status, stats]
+end
+
 def run_and_log(csv, *params)
+  timed_out = false
+  DAEMON&.configure(*params)
   start_sim
-  status, out, _err = Timeout.timeout(RUN_TIMEOUT) do
-    run('build/mpc', *params)
+  status, stats = Timeout.timeout(RUN_TIMEOUT) do
+    run_mpc(*params)
   end
   if [0, 1].member?(status)
     crashed = status == 1
-    stats = JSON.parse(strip_non_json(out))
     csv << [
       *params,
       crashed,
@@ -141,10 +209,12 @@ def run_and_log(csv, *params)
   end
 rescue Timeout::Error
   STDERR.puts 'WARNING: Simulator timed out'
+  timed_out = true
   csv << params
   Float::INFINITY
 ensure
   stop_sim
+  DAEMON&.abandon if timed_out
 end
 
 #